@@ -27,6 +27,7 @@ SOURCES += \
     src/core/protocol.cpp \
     src/core/record-analysis.cpp \
     src/core/roomstate.cpp \
+    src/core/seatring.cpp \
     src/core/settings.cpp \
     src/core/skill.cpp \
     src/core/structs.cpp \
@@ -75,10 +76,13 @@ SOURCES += \
     src/server/ai.cpp \
     src/server/gamerule.cpp \
     src/server/generalselector.cpp \
+    src/server/luastatepool.cpp \
     src/server/room.cpp \
+    src/server/roomscheduler.cpp \
     src/server/roomthread.cpp \
     src/server/server.cpp \
     src/server/serverplayer.cpp \
+    src/server/simulator.cpp \
     src/ui/button.cpp \
     src/ui/cardcontainer.cpp \
     src/ui/carditem.cpp \
@@ -130,6 +134,7 @@ HEADERS += \
     src/client/client.h \
     src/client/clientplayer.h \
     src/client/clientstruct.h \
+    src/core/atommap.h \
     src/core/audio.h \
     src/core/banpair.h \
     src/core/card.h \
@@ -142,6 +147,7 @@ HEADERS += \
     src/core/protocol.h \
     src/core/record-analysis.h \
     src/core/roomstate.h \
+    src/core/seatring.h \
     src/core/settings.h \
     src/core/skill.h \
     src/core/structs.h \
@@ -190,10 +196,13 @@ HEADERS += \
     src/server/ai.h \
     src/server/gamerule.h \
     src/server/generalselector.h \
+    src/server/luastatepool.h \
     src/server/room.h \
+    src/server/roomscheduler.h \
     src/server/roomthread.h \
     src/server/server.h \
     src/server/serverplayer.h \
+    src/server/simulator.h \
     src/ui/button.h \
     src/ui/cardcontainer.h \
     src/ui/carditem.h \
@@ -253,6 +262,12 @@ CONFIG(buildbot) {
     SOURCES += src/bot_version.cpp
 }
 
+# headless self-play build: qmake "CONFIG+=simulator"
+CONFIG(simulator) {
+    TARGET = qsgs-sim
+    DEFINES += QSAN_SIMULATOR
+}
+
 win32 {
     FORMS += src/dialog/mainwindow.ui
 }
@@ -6,6 +6,9 @@
 --注意距离技一经声明全场生效，即使不附加给玩家
 --锁定与单一玩家的距离不用距离技，用setFixedDistance
 --国战中同名的距离技也要区分开
+--距离会被缓存，装备、技能、武将、势力、座次变化时自动失效
+--若correct_func还读取了标记、标志或私人牌堆，请把它们的名字写在dependencies里，如dependencies = {"@mark", "field"}
+--不写dependencies的距离技无法缓存，全场的距离都会每次重新计算
 
 --马术实现：
 
@@ -18,6 +21,7 @@ function sgs.CreateMashuSkill(name) --创建马术技能，在CreateDistanceSkil
 		end
 		return 0
 	end
+	mashu_skill.dependencies = {} --只读取了技能是否明置，无需额外声明
 	return sgs.CreateDistanceSkill(mashu_skill)
 end
 
@@ -74,6 +78,7 @@ LuaQicai = sgs.CreateTargetModSkill{
 --顾名思义，修改攻击范围的
 --目前只有黄忠和吴六剑用到了攻击范围技
 --注意攻击范围技不会亮将，所以使用时请注意一些
+--dependencies的用法同距离技
 
 --黄忠君主效果实现：注意shouyue这个技能是附加给关羽/张飞/赵云/马超/黄忠各个人的，在君刘备这里只是个标志而已。
 LuaLiegongRange = sgs.CreateAttackRangeSkill{
@@ -87,6 +92,7 @@ LuaLiegongRange = sgs.CreateAttackRangeSkill{
 		end
 		return 0
 	end ,
+	dependencies = {} ,
 }
 
 --锁定视为技(sgs.CreateFilterSkill)
@@ -294,6 +294,7 @@ function SmartAI:initialize(player)
 	sgs.updateAlivePlayerRoles()
 	self:updatePlayers(true, true)
 	self:assignKeep(true)
+	self:subscribeEvents()
 end
 
 function sgs.cloneCard(name, suit, number)
@@ -301,10 +302,17 @@ function sgs.cloneCard(name, suit, number)
 	number = number or -1
 	local card = sgs.Sanguosha:cloneCard(name, suit, number)
 	if not card then global_room:writeToConsole(debug.traceback()) return end
-	card:deleteLater()
+	sgs.Sanguosha:autoReleaseCard(card)
 	return card
 end
 
+-- one call for many names, the cards are released like those of sgs.cloneCard
+function sgs.cloneCards(names, suit, number)
+	suit = suit or sgs.Card_SuitToBeDecided
+	number = number or -1
+	return sgs.Sanguosha:cloneCards(names, suit, number)
+end
+
 function SmartAI:getTurnUse()
 	local cards = {}
 	for _ ,c in sgs.qlist(self.player:getHandcards()) do
@@ -2050,6 +2058,28 @@ sgs.ai_choicemade_filter.Yiji.general = function(self, from, promptlist)
 	end
 end
 
+-- the events SmartAI:filterEvent handles by itself, besides those with callbacks
+sgs.ai_filter_events = {
+	sgs.ChoiceMade, sgs.GameStart, sgs.EventPhaseStart, sgs.EventPhaseEnd, sgs.RemoveStateChanged,
+	sgs.BuryVictim, sgs.HpChanged, sgs.MaxHpChanged, sgs.AskForPeaches, sgs.CardsMoveOneTime,
+	sgs.GeneralShown, sgs.GeneralHidden, sgs.TargetConfirmed, sgs.PreDamageDone, sgs.CardUsed
+}
+
+-- let the room skip the events nobody listens to instead of calling filterEvent for each of them
+function SmartAI:subscribeEvents()
+	local events = sgs.IntList()
+	for _, event in ipairs(sgs.ai_filter_events) do
+		events:append(event)
+	end
+	for i = sgs.NonTrigger, sgs.NumOfEvents, 1 do
+		if not table.contains(sgs.ai_filter_events, i)
+			and (next(sgs.ai_debug_func[i]) or next(sgs.ai_chat_func[i]) or next(sgs.ai_event_callback[i])) then
+			events:append(i)
+		end
+	end
+	self.lua_ai:setSubscribedEvents(events)
+end
+
 function SmartAI:filterEvent(event, player, data)
 	if not sgs.recorder then
 		sgs.recorder = self
@@ -2060,7 +2090,7 @@ function SmartAI:filterEvent(event, player, data)
 				if type(callback) == "function" then callback(self, player, data) end
 			end
 		end
-		if type(sgs.ai_chat_func[event]) == "table" and sgs.GetConfig("AIChat", false) and sgs.GetConfig("OriginAIDelay", 0) > 0 then
+		if type(sgs.ai_chat_func[event]) == "table" and next(sgs.ai_chat_func[event]) and sgs.GetConfig("AIChat", false) and sgs.GetConfig("OriginAIDelay", 0) > 0 then
 			for _, callback in pairs(sgs.ai_chat_func[event]) do
 				if type(callback) == "function" then callback(self, player, data) end
 			end
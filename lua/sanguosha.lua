@@ -111,11 +111,13 @@ function load_extensions()
 	sgs.SetConfig("LuaPackages", lua_packages)
 end
 
-if not sgs.GetConfig("DisableLua", false) then
+-- only the engine's own state registers the extensions, their skills run there as well.
+-- The states of the rooms are prepared out of the main thread and must not touch the engine.
+local done_loading = sgs.Sanguosha:property("DoneLoading"):toBool()
+if not done_loading and not sgs.GetConfig("DisableLua", false) then
 	load_extensions()
 end
 
-local done_loading = sgs.Sanguosha:property("DoneLoading"):toBool()
 if not done_loading then
 	load_translations()
 	done_loading = sgs.QVariant(true)
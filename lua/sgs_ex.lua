@@ -122,6 +122,7 @@ function sgs.CreateViewHasSkill(spec)
 	local skill = sgs.LuaViewHasSkill(spec.name)
 	skill.is_viewhas = spec.is_viewhas
 	if type(spec.global) == "boolean" then skill:setGlobal(spec.global) end
+	if type(spec.viewhas_skills) == "string" then skill:setViewHasSkills(spec.viewhas_skills) end
 
 	return skill
 end
@@ -155,6 +156,14 @@ function sgs.CreateDistanceSkill(spec)
 
 	skill.correct_func = spec.correct_func
 
+	if spec.dependencies then
+		if type(spec.dependencies) == "table" then
+			skill:setDependencies(table.concat(spec.dependencies, "|"))
+		else
+			skill:setDependencies(spec.dependencies)
+		end
+	end
+
 	return skill
 end
 
@@ -215,6 +224,14 @@ function sgs.CreateAttackRangeSkill(spec)
 		skill.fixed_func = spec.fixed_func or -1
 	end
 
+	if spec.dependencies then
+		if type(spec.dependencies) == "table" then
+			skill:setDependencies(table.concat(spec.dependencies, "|"))
+		else
+			skill:setDependencies(spec.dependencies)
+		end
+	end
+
 	return skill
 end
 
@@ -320,7 +320,8 @@ sgs.CommandType = {
     "S_COMMAND_MIRROR_MOVECARDS_STEP",
 	"S_COMMAND_SET_VISIBLE_CARDS",
 	"S_COMMAND_SET_ACTULGENERAL",
-	"S_COMMAND_GLOBAL_CHOOSECARD"
+	"S_COMMAND_GLOBAL_CHOOSECARD",
+	"S_COMMAND_SETUP_SYMBOLS"
 }
 
 local i = 0
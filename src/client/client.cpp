@@ -53,6 +53,7 @@ Client::Client(QObject *parent, const QString &filename)
 
     callbacks[S_COMMAND_CHECK_VERSION] = &Client::checkVersion;
     callbacks[S_COMMAND_SETUP] = &Client::setup;
+    callbacks[S_COMMAND_SETUP_SYMBOLS] = &Client::setupSymbols;
     callbacks[S_COMMAND_NETWORK_DELAY_TEST] = &Client::networkDelayTest;
     callbacks[S_COMMAND_ADD_PLAYER] = &Client::addPlayer;
     callbacks[S_COMMAND_REMOVE_PLAYER] = &Client::removePlayer;
@@ -167,7 +168,6 @@ Client::Client(QObject *parent, const QString &filename)
 
         recorder = new Recorder(this);
 
-        connect(socket, &NativeClientSocket::message_got, recorder, &Recorder::recordLine);
         connect(socket, &NativeClientSocket::message_got, this, &Client::processServerPacket);
         connect(socket, &NativeClientSocket::error_message, this, &Client::error_message);
         socket->connectToHost();
@@ -326,6 +326,8 @@ void Client::signup()
         arg << Config.value("EnableReconnection", false).toBool();
         arg << Config.UserName;
         arg << Config.UserAvatar;
+        arg << Config.value("BinaryProtocol", true).toBool();
+        arg << Config.value("FramedTransport", true).toBool();
         notifyServer(S_COMMAND_SIGNUP, arg);
     }
 }
@@ -404,6 +406,12 @@ void Client::setup(const QVariant &setup_json)
     }
 }
 
+void Client::setupSymbols(const QVariant &symbols)
+{
+    if (!packetSymbols.tryParse(symbols))
+        QMessageBox::warning(NULL, tr("Warning"), tr("Symbol table can not be parsed"));
+}
+
 void Client::disconnectFromHost()
 {
     if (socket) {
@@ -416,9 +424,22 @@ typedef char buffer_t[65535];
 
 void Client::processServerPacket(const QByteArray &cmd)
 {
-    if (m_isGameOver) return;
     Packet packet;
-    if (packet.parse(cmd)) {
+    bool parsed = false;
+    if (Packet::isBinary(cmd)) {
+        parsed = packet.parseBinary(cmd, &packetSymbols);
+        // replays only understand JSON lines
+        if (recorder && parsed)
+            recorder->recordLine(packet.toJson());
+    } else {
+        if (recorder)
+            recorder->recordLine(cmd);
+        if (!m_isGameOver)
+            parsed = packet.parse(cmd);
+    }
+
+    if (m_isGameOver) return;
+    if (parsed) {
         if (packet.getPacketType() == S_TYPE_NOTIFICATION) {
             Callback callback = callbacks[packet.getCommandType()];
             if (callback) {
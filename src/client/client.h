@@ -126,6 +126,7 @@ public:
 
     void checkVersion(const QVariant &server_version);
     void setup(const QVariant &setup_str);
+    void setupSymbols(const QVariant &symbols);
     void networkDelayTest(const QVariant &);
     void addPlayer(const QVariant &player_info);
     void removePlayer(const QVariant &player_name);
@@ -310,6 +311,7 @@ protected:
 
 private:
     ClientSocket *socket;
+    QSanProtocol::PacketSymbolTable packetSymbols;
     bool m_isGameOver;
     QHash<QSanProtocol::CommandType, Callback> interactions;
     QHash<QSanProtocol::CommandType, Callback> callbacks;
@@ -191,6 +191,7 @@ void ClientPlayer::changePile(const QString &name, bool add, QList<int> card_ids
                 piles[name].takeLast();
         }
     }
+    touchDistanceDependency(name);
     if (!name.startsWith("#") && !name.startsWith("^"))
         emit pile_changed(name);
 }
@@ -227,9 +228,10 @@ void ClientPlayer::setFlags(const QString &flag)
 
 void ClientPlayer::setMark(const QString &mark, int value)
 {
-    if (marks[mark] == value)
+    int atom = Sanguosha->getAtom(mark);
+    if (!marks.insert(atom, value))
         return;
-    marks[mark] = value;
+    touchDistanceDependency(atom);
 
     if (mark == "drank")
         emit drank_changed();
@@ -240,7 +242,10 @@ void ClientPlayer::setMark(const QString &mark, int value)
     // @todo: consider move all the codes below to PlayerCardContainerUI.cpp
     // set mark doc
     QString text = "";
-    QMapIterator<QString, int> itor(marks);
+    QMap<QString, int> visible_marks; // sorted by name
+    foreach (int atom, marks.keys())
+        visible_marks.insert(Sanguosha->getAtomName(atom), marks.value(atom));
+    QMapIterator<QString, int> itor(visible_marks);
     while (itor.hasNext()) {
         itor.next();
         if (itor.key().startsWith("@") && itor.value() > 0) {
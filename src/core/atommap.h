@@ -0,0 +1,102 @@
+/********************************************************************
+    Copyright (c) 2013-2015 - Mogara
+
+    This file is part of QSanguosha-Hegemony.
+
+    This game is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 3.0
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    See the LICENSE file for more details.
+
+    Mogara
+    *********************************************************************/
+
+#ifndef _ATOMMAP_H
+#define _ATOMMAP_H
+
+#include <QVector>
+#include <QList>
+#include <QtAlgorithms>
+
+// A small flat map from atoms (see Engine::getAtom()) to integers.
+// The keys are kept sorted in a contiguous array, which is both smaller
+// and faster than a hash for the handful of flags, marks and history
+// entries a player usually carries. Zero values are not stored, so a
+// flag is simply an atom whose value is 1.
+class AtomMap
+{
+public:
+    inline int value(int atom) const
+    {
+        int i = indexOf(atom);
+        return i == -1 ? 0 : m_values.at(i);
+    }
+
+    inline bool contains(int atom) const
+    {
+        return indexOf(atom) != -1;
+    }
+
+    // returns false if the value was already there
+    bool insert(int atom, int value)
+    {
+        QVector<int>::iterator it = qLowerBound(m_keys.begin(), m_keys.end(), atom);
+        int i = it - m_keys.begin();
+        if (it != m_keys.end() && *it == atom) {
+            if (m_values.at(i) == value)
+                return false;
+            if (value == 0) {
+                m_keys.remove(i);
+                m_values.remove(i);
+            } else {
+                m_values[i] = value;
+            }
+            return true;
+        }
+        if (value == 0)
+            return false;
+        m_keys.insert(i, atom);
+        m_values.insert(i, value);
+        return true;
+    }
+
+    inline bool remove(int atom)
+    {
+        return insert(atom, 0);
+    }
+
+    inline void clear()
+    {
+        m_keys.clear();
+        m_values.clear();
+    }
+
+    inline bool isEmpty() const
+    {
+        return m_keys.isEmpty();
+    }
+
+    inline QList<int> keys() const
+    {
+        return m_keys.toList();
+    }
+
+private:
+    inline int indexOf(int atom) const
+    {
+        QVector<int>::const_iterator it = qLowerBound(m_keys.constBegin(), m_keys.constEnd(), atom);
+        return (it != m_keys.constEnd() && *it == atom) ? it - m_keys.constBegin() : -1;
+    }
+
+    QVector<int> m_keys;
+    QVector<int> m_values;
+};
+
+#endif
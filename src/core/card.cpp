@@ -580,7 +580,7 @@ const Card *Card::Parse(const QString &card_str)
             user_string.remove(0, 1);
             card->setUserString(user_string);
         }
-        card->deleteLater();
+        Sanguosha->autoReleaseCard(card);
         card->setSkillPosition(position);
         return card;
     } else if (str.startsWith(QChar('$'))) {
@@ -588,11 +588,11 @@ const Card *Card::Parse(const QString &card_str)
         copy.remove(QChar('$'));
         QStringList card_strs = copy.split("+");
         DummyCard *dummy = new DummyCard(StringList2IntList(card_strs));
-        dummy->deleteLater();
+        Sanguosha->autoReleaseCard(dummy);
         return dummy;
     } else if (str.startsWith(QChar('#'))) {
         LuaSkillCard *new_card = LuaSkillCard::Parse(str);
-        new_card->deleteLater();
+        Sanguosha->autoReleaseCard(new_card);
         new_card->setSkillPosition(position);
         return new_card;
     } else if (str.contains(QChar('='))) {
@@ -612,12 +612,10 @@ const Card *Card::Parse(const QString &card_str)
             subcard_ids = subcard_str.split("+");
 
         Suit suit = Card::NoSuit;
-        DummyCard *dummy = new DummyCard(StringList2IntList(subcard_ids));
         if (suit_string == "to_be_decided")
-            suit = dummy->getSuit();
+            suit = DummyCard(StringList2IntList(subcard_ids)).getSuit();
         else
             suit = suit_map.value(suit_string, Card::NoSuit);
-        dummy->deleteLater();
 
         int number = 0;
         if (number_string == "A")
@@ -638,7 +636,7 @@ const Card *Card::Parse(const QString &card_str)
         card->addSubcards(StringList2IntList(subcard_ids));
         card->setSkillName(m_skillName);
         card->setShowSkill(show_skill);
-        card->deleteLater();
+        Sanguosha->autoReleaseCard(card);
         card->setSkillPosition(position);
         return card;
     } else {
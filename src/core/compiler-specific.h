@@ -33,4 +33,11 @@
 #   define WARN(exp) ("WARNING: " exp)
 #endif
 
+// thread_local is not supported before VS2015, but __declspec(thread) works for plain pointers
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#   define QSAN_THREAD_LOCAL __declspec(thread)
+#else
+#   define QSAN_THREAD_LOCAL thread_local
+#endif
+
 #endif
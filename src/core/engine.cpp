@@ -31,6 +31,7 @@
 #include "banpair.h"
 #include "miniscenarios.h"
 #include "jiange-defense-scenario.h"
+#include "compiler-specific.h"
 
 #include <lua.hpp>
 #include <QFile>
@@ -43,6 +44,9 @@
 
 Engine *Sanguosha = NULL;
 
+// set while a Lua state is prepared for a room, everything it could register belongs to the engine's own state
+static QSAN_THREAD_LOCAL bool RegistrationForbidden = false;
+
 int Engine::getMiniSceneCounts()
 {
     return m_miniScenes.size();
@@ -82,6 +86,8 @@ void Engine::addPackage(const QString &name)
 Engine::Engine()
 {
     Sanguosha = this;
+    distance_cacheable = true;
+    patterns_frozen = false;
 
     lua = CreateLuaState();
     DoLuaScript(lua, "lua/config.lua");
@@ -99,6 +105,7 @@ Engine::Engine()
         addPackage(name);
 
     metaobjects.insert("TransferCard", &TransferCard::staticMetaObject);
+    addNativeCardFactories(&TransferCard::staticMetaObject, QString());
 
     transfer = new TransferSkill;
 
@@ -127,6 +134,23 @@ Engine::Engine()
         Skill *mutable_skill = const_cast<Skill *>(skill);
         mutable_skill->initMediaSource();
     }
+
+    freezePatterns();
+}
+
+void Engine::freezePatterns()
+{
+    // the target mod patterns are matched on every target check, so they are compiled up front
+    foreach (const TargetModSkill *skill, targetmod_skills)
+        getExpPatternUnlocked(skill->getPattern());
+
+    QWriteLocker locker(&m_patternLock);
+    for (QHash<QString, const CardPattern *>::const_iterator it = patterns.constBegin(); it != patterns.constEnd(); ++it)
+        static_patterns.insert(it.key(), it.value());
+    static_exp_patterns = expPatterns;
+    patterns.clear();
+    expPatterns.clear();
+    patterns_frozen = true;
 }
 
 lua_State *Engine::getLuaState() const
@@ -136,6 +160,7 @@ lua_State *Engine::getLuaState() const
 
 void Engine::addTranslationEntry(const char *key, const char *value)
 {
+    Q_ASSERT(!RegistrationForbidden);
     translations.insert(key, QString::fromUtf8(value));
 }
 
@@ -159,6 +184,7 @@ QStringList Engine::getModScenarioNames() const
 
 void Engine::addScenario(Scenario *scenario)
 {
+    Q_ASSERT(!RegistrationForbidden);
     QString key = scenario->objectName();
     if (m_scenarios.contains(key))
         return;
@@ -181,6 +207,7 @@ const Scenario *Engine::getScenario(const QString &name) const
 
 void Engine::addSkills(const QList<const Skill *> &all_skills)
 {
+    Q_ASSERT(!RegistrationForbidden);
     foreach (const Skill *skill, all_skills) {
         if (!skill) {
             QMessageBox::warning(NULL, "", tr("The engine tries to add an invalid skill"));
@@ -191,26 +218,91 @@ void Engine::addSkills(const QList<const Skill *> &all_skills)
 
         skills.insert(skill->objectName(), skill);
 
+        int id = skill_table.size();
+        const_cast<Skill *>(skill)->skill_id = id;
+        skill_table << skill;
+        skill_ids.insert(skill->objectName(), id);
+        main_skill_ids << -1;
+
+        quint8 traits = 0;
+        if (!skill->isVisible())
+            traits |= HiddenSkillTrait;
+        if (skill->inherits("ArmorSkill") || skill->inherits("WeaponSkill") || skill->inherits("TreasureSkill"))
+            traits |= EquipSkillTrait;
+        const TriggerSkill *trigger = qobject_cast<const TriggerSkill *>(skill);
+        if (trigger && trigger->isGlobal())
+            traits |= GlobalSkillTrait;
+        skill_traits << traits;
+
         if (skill->inherits("ProhibitSkill"))
             prohibit_skills << qobject_cast<const ProhibitSkill *>(skill);
         else if (skill->inherits("FixCardSkill"))
             fixcard_skills << qobject_cast<const FixCardSkill *>(skill);
-        else if (skill->inherits("ViewHasSkill"))
+        else if (skill->inherits("ViewHasSkill")) {
             viewhas_skills << qobject_cast<const ViewHasSkill *>(skill);
-        else if (skill->inherits("DistanceSkill"))
-            distance_skills << qobject_cast<const DistanceSkill *>(skill);
-        else if (skill->inherits("MaxCardsSkill"))
+            // may lend a distance skill depending on anything
+            if (skill->inherits("LuaViewHasSkill"))
+                distance_cacheable = false;
+        } else if (skill->inherits("DistanceSkill")) {
+            const DistanceSkill *distance_skill = qobject_cast<const DistanceSkill *>(skill);
+            distance_skills << distance_skill;
+            distance_cacheable = distance_cacheable && distance_skill->isCacheable();
+            foreach (const QString &name, distance_skill->getDependencies()) {
+                distance_dependencies << name;
+                distance_dependency_atoms << getAtom(name);
+            }
+        } else if (skill->inherits("MaxCardsSkill"))
             maxcards_skills << qobject_cast<const MaxCardsSkill *>(skill);
         else if (skill->inherits("TargetModSkill"))
             targetmod_skills << qobject_cast<const TargetModSkill *>(skill);
-        else if (skill->inherits("AttackRangeSkill"))
-            attackrange_skills << qobject_cast<const AttackRangeSkill *>(skill);
-        else if (skill->inherits("TriggerSkill")) {
+        else if (skill->inherits("AttackRangeSkill")) {
+            const AttackRangeSkill *range_skill = qobject_cast<const AttackRangeSkill *>(skill);
+            attackrange_skills << range_skill;
+            distance_cacheable = distance_cacheable && range_skill->isCacheable();
+            foreach (const QString &name, range_skill->getDependencies()) {
+                distance_dependencies << name;
+                distance_dependency_atoms << getAtom(name);
+            }
+        } else if (skill->inherits("TriggerSkill")) {
             const TriggerSkill *trigger_skill = qobject_cast<const TriggerSkill *>(skill);
             if (trigger_skill && trigger_skill->isGlobal())
                 global_trigger_skills << trigger_skill;
         }
     }
+
+    updateMainSkillIds();
+}
+
+void Engine::updateMainSkillIds()
+{
+    for (int i = 0; i < skill_table.size(); ++i) {
+        if (!(skill_traits.at(i) & HiddenSkillTrait))
+            continue;
+        const Skill *main_skill = getMainSkill(skill_table.at(i)->objectName());
+        main_skill_ids[i] = main_skill ? main_skill->getId() : -1;
+        if (main_skill && (skill_traits.at(main_skill->getId()) & GeneralSkillTrait))
+            skill_traits[i] |= GeneralSkillTrait;
+    }
+}
+
+int Engine::getSkillId(const QString &skill_name) const
+{
+    return skill_ids.value(skill_name, -1);
+}
+
+const Skill *Engine::getSkillById(int skill_id) const
+{
+    return skill_table.value(skill_id, NULL);
+}
+
+int Engine::getSkillTraits(int skill_id) const
+{
+    return skill_traits.value(skill_id, 0);
+}
+
+int Engine::getMainSkillId(int skill_id) const
+{
+    return main_skill_ids.value(skill_id, -1);
 }
 
 QList<const DistanceSkill *> Engine::getDistanceSkills() const
@@ -240,6 +332,7 @@ QList<const TriggerSkill *> Engine::getGlobalTriggerSkills() const
 
 void Engine::addPackage(Package *package)
 {
+    Q_ASSERT(!RegistrationForbidden);
     foreach (const Package *p, packages) {
         if (p->objectName() == package->objectName())
             return;
@@ -248,9 +341,21 @@ void Engine::addPackage(Package *package)
     packages << package;
     package->setParent(this);
     sp_convert_pairs.unite(package->getConvertPairs());
-    patterns.unite(package->getPatterns());
+    QMap<QString, const CardPattern *> package_patterns = package->getPatterns();
+    QWriteLocker pattern_locker(&m_patternLock);
+    for (QMap<QString, const CardPattern *>::const_iterator it = package_patterns.constBegin(); it != package_patterns.constEnd(); ++it)
+        patterns.insert(it.key(), it.value());
+    pattern_locker.unlock();
     related_skills.unite(package->getRelatedSkills());
 
+    QMultiMap<QString, QString> package_related = package->getRelatedSkills();
+    QMultiMap<QString, QString>::const_iterator it;
+    for (it = package_related.constBegin(); it != package_related.constEnd(); ++it) {
+        const QString &main_skill = main_skills.value(it.value());
+        if (main_skill.isEmpty() || it.key() < main_skill)
+            main_skills.insert(it.value(), it.key());
+    }
+
     QList<Card *> all_cards = package->findChildren<Card *>();
     foreach (Card *card, all_cards) {
         card->setId(cards.length());
@@ -259,37 +364,38 @@ void Engine::addPackage(Package *package)
         if (card->isKindOf("LuaBasicCard")) {
             const LuaBasicCard *lcard = qobject_cast<const LuaBasicCard *>(card);
             Q_ASSERT(lcard != NULL);
-            luaBasicCard_className2objectName.insert(lcard->getClassName(), lcard->objectName());
             if (!luaBasicCards.contains(lcard->getClassName()))
                 luaBasicCards.insert(lcard->getClassName(), lcard->clone());
+            addLuaCardFactories(luaBasicCards.value(lcard->getClassName()), lcard->objectName());
         } else if (card->isKindOf("LuaTrickCard")) {
             const LuaTrickCard *lcard = qobject_cast<const LuaTrickCard *>(card);
             Q_ASSERT(lcard != NULL);
-            luaTrickCard_className2objectName.insert(lcard->getClassName(), lcard->objectName());
             if (!luaTrickCards.contains(lcard->getClassName()))
                 luaTrickCards.insert(lcard->getClassName(), lcard->clone());
+            addLuaCardFactories(luaTrickCards.value(lcard->getClassName()), lcard->objectName());
         } else if (card->isKindOf("LuaWeapon")) {
             const LuaWeapon *lcard = qobject_cast<const LuaWeapon *>(card);
             Q_ASSERT(lcard != NULL);
-            luaWeapon_className2objectName.insert(lcard->getClassName(), lcard->objectName());
             if (!luaWeapons.contains(lcard->getClassName()))
                 luaWeapons.insert(lcard->getClassName(), lcard->clone());
+            addLuaCardFactories(luaWeapons.value(lcard->getClassName()), lcard->objectName());
         } else if (card->isKindOf("LuaArmor")) {
             const LuaArmor *lcard = qobject_cast<const LuaArmor *>(card);
             Q_ASSERT(lcard != NULL);
-            luaArmor_className2objectName.insert(lcard->getClassName(), lcard->objectName());
             if (!luaArmors.contains(lcard->getClassName()))
                 luaArmors.insert(lcard->getClassName(), lcard->clone());
+            addLuaCardFactories(luaArmors.value(lcard->getClassName()), lcard->objectName());
         } else if (card->isKindOf("LuaTreasure")) {
             const LuaTreasure *lcard = qobject_cast<const LuaTreasure *>(card);
             Q_ASSERT(lcard != NULL);
-            luaTreasure_className2objectName.insert(lcard->getClassName(), lcard->objectName());
             if (!luaTreasures.contains(lcard->getClassName()))
                 luaTreasures.insert(lcard->getClassName(), lcard->clone());
+            addLuaCardFactories(luaTreasures.value(lcard->getClassName()), lcard->objectName());
         } else {
             QString class_name = card->metaObject()->className();
             metaobjects.insert(class_name, card->metaObject());
             className2objectName.insert(class_name, card->objectName());
+            addNativeCardFactories(card->metaObject(), card->objectName());
         }
     }
 
@@ -303,15 +409,27 @@ void Engine::addPackage(Package *package)
             foreach(const Skill *related, getRelatedSkills(skill_name))
                 general->addSkill(related->objectName());
         }
+        QStringList general_skills = general->getExtraSkillSet().toList();
+        foreach (const Skill *skill, general->findChildren<const Skill *>())
+            general_skills << skill->objectName();
+        foreach (const QString &skill_name, general_skills) {
+            int id = getSkillId(skill_name);
+            // hidden skills follow the skill they are related to, see updateMainSkillIds()
+            if (id != -1 && !(skill_traits.at(id) & (GlobalSkillTrait | EquipSkillTrait | HiddenSkillTrait)))
+                skill_traits[id] |= GeneralSkillTrait;
+        }
         generalList << general;
         generalHash.insert(general->objectName(), general);
         if (isGeneralHidden(general->objectName())) continue;
         if (general->isLord()) lord_list << general->objectName();
     }
+    updateMainSkillIds();
 
     QList<const QMetaObject *> metas = package->getMetaObjects();
-    foreach(const QMetaObject *meta, metas)
+    foreach (const QMetaObject *meta, metas) {
         metaobjects.insert(meta->className(), meta);
+        addNativeCardFactories(meta, className2objectName.value(meta->className()));
+    }
 }
 
 void Engine::addBanPackage(const QString &package_name)
@@ -375,20 +493,97 @@ QString Engine::translate(const QString &toTranslate, const QString &defaultValu
 
 const CardPattern *Engine::getPattern(const QString &name) const
 {
+    if (patterns_frozen) {
+        const CardPattern *ptn = static_patterns.value(name, NULL);
+        if (ptn) return ptn;
+    }
+
+    {
+        QReadLocker locker(&m_patternLock);
+        const CardPattern *ptn = patterns.value(name, NULL);
+        if (ptn) return ptn;
+    }
+
+    QWriteLocker locker(&m_patternLock);
     const CardPattern *ptn = patterns.value(name, NULL);
     if (ptn) return ptn;
 
-    ExpPattern *expptn = new ExpPattern(name);
-    enginePatterns << expptn;
-    patterns.insert(name, expptn);
+    ptn = getExpPatternUnlocked(name);
+    patterns.insert(name, ptn);
+
+    return ptn;
+}
+
+const ExpPattern *Engine::getExpPattern(const QString &exp) const
+{
+    if (patterns_frozen) {
+        const ExpPattern *expptn = static_exp_patterns.value(exp, NULL);
+        if (expptn) return expptn;
+    }
+
+    {
+        QReadLocker locker(&m_patternLock);
+        const ExpPattern *expptn = expPatterns.value(exp, NULL);
+        if (expptn) return expptn;
+    }
 
-    return expptn;
+    QWriteLocker locker(&m_patternLock);
+    return getExpPatternUnlocked(exp);
+}
+
+// the caller holds the write lock, or the engine is still loading
+const ExpPattern *Engine::getExpPatternUnlocked(const QString &exp) const
+{
+    const ExpPattern *expptn = static_exp_patterns.value(exp, NULL);
+    if (expptn) return expptn;
+    expptn = expPatterns.value(exp, NULL);
+    if (expptn) return expptn;
+
+    ExpPattern *compiled = new ExpPattern(exp);
+    enginePatterns << compiled;
+    expPatterns.insert(exp, compiled);
+
+    return compiled;
 }
 
 bool Engine::matchExpPattern(const QString &pattern, const Player *player, const Card *card) const
 {
-    ExpPattern p(pattern);
-    return p.match(player, card);
+    const ExpPattern *expptn = patterns_frozen ? static_exp_patterns.value(pattern, NULL) : NULL;
+    if (expptn == NULL) {
+        QReadLocker locker(&m_patternLock);
+        expptn = expPatterns.value(pattern, NULL);
+    }
+    if (expptn) return expptn->match(player, card);
+
+    ExpPattern compiled(pattern);
+    if (!compiled.hasCardIds()) {
+        QWriteLocker locker(&m_patternLock);
+        if (!expPatterns.contains(pattern)) {
+            ExpPattern *interned = new ExpPattern(compiled);
+            enginePatterns << interned;
+            expPatterns.insert(pattern, interned);
+        }
+    }
+    return compiled.match(player, card);
+}
+
+int Engine::getCardClassId(const Card *card) const
+{
+    return card_class_ids.value(card->metaObject(), -1);
+}
+
+QBitArray Engine::getCardKinds(const char *class_name) const
+{
+    QBitArray kinds(card_classes.size());
+    for (int i = 0; i < card_classes.size(); ++i) {
+        for (const QMetaObject *meta = card_classes.at(i); meta != NULL; meta = meta->superClass()) {
+            if (qstrcmp(meta->className(), class_name) == 0) {
+                kinds.setBit(i);
+                break;
+            }
+        }
+    }
+    return kinds;
 }
 
 Card::HandlingMethod Engine::getCardHandlingMethod(const QString &method_name) const
@@ -426,10 +621,8 @@ const Skill *Engine::getMainSkill(const QString &skill_name) const
 {
     const Skill *skill = getSkill(skill_name);
     if (!skill || skill->isVisible() || related_skills.contains(skill_name)) return skill;
-    foreach (const QString &key, related_skills.keys()) {
-        foreach (const QString &name, related_skills.values(key))
-            if (name == skill_name) return getSkill(key);
-    }
+    if (main_skills.contains(skill_name))
+        return getSkill(main_skills.value(skill_name));
     return skill;
 }
 
@@ -455,27 +648,29 @@ int Engine::getGeneralCount(bool include_banned) const
     return total;
 }
 
+// the room (a Room on the server, the Client on the client) which the current thread is working for.
+// Each room thread binds itself once, so looking it up never needs a lock.
+static QSAN_THREAD_LOCAL QObject *CurrentRoomObject = NULL;
+
 void Engine::registerRoom(QObject *room)
 {
-    m_mutex.lock();
-    m_rooms[QThread::currentThread()] = room;
-    m_mutex.unlock();
+    CurrentRoomObject = room;
 }
 
 void Engine::unregisterRoom()
 {
-    m_mutex.lock();
-    m_rooms.remove(QThread::currentThread());
-    m_mutex.unlock();
+    CurrentRoomObject = NULL;
+}
+
+void Engine::setRegistrationForbidden(bool forbidden)
+{
+    RegistrationForbidden = forbidden;
 }
 
 QObject *Engine::currentRoomObject()
 {
-    QObject *room = NULL;
-    m_mutex.lock();
-    room = m_rooms[QThread::currentThread()];
+    QObject *room = CurrentRoomObject;
     Q_ASSERT(room);
-    m_mutex.unlock();
     return room;
 }
 
@@ -489,7 +684,23 @@ Room *Engine::currentRoom()
 
 RoomState *Engine::currentRoomState()
 {
-    QObject *roomObject = currentRoomObject();
+    return getRoomState(currentRoomObject());
+}
+
+void Engine::autoReleaseCard(const Card *card) const
+{
+    if (card == NULL)
+        return;
+    // the current room is per thread, so this is the room thread itself
+    Room *room = qobject_cast<Room *>(CurrentRoomObject);
+    if (room != NULL)
+        room->getRoomState()->addTransientCard(const_cast<Card *>(card));
+    else
+        card->deleteLater();
+}
+
+RoomState *Engine::getRoomState(QObject *roomObject)
+{
     Room *room = qobject_cast<Room *>(roomObject);
     if (room != NULL) {
         return room->getRoomState();
@@ -534,11 +745,17 @@ WrappedCard *Engine::getWrappedCard(int cardId)
 }
 
 Card *Engine::getCard(int cardId)
+{
+    if (cardId < 0 || cardId >= cards.length())
+        return NULL;
+    return getCard(cardId, currentRoomObject());
+}
+
+Card *Engine::getCard(int cardId, QObject *room)
 {
     Card *card = NULL;
     if (cardId < 0 || cardId >= cards.length())
         return NULL;
-    QObject *room = currentRoomObject();
     Q_ASSERT(room);
     Room *serverRoom = qobject_cast<Room *>(room);
     if (serverRoom != NULL) {
@@ -580,62 +797,11 @@ Card *Engine::cloneCard(const Card *card) const
 
 Card *Engine::cloneCard(const QString &name, Card::Suit suit, int number, const QStringList &flags) const
 {
-    Card *card = NULL;
-    if (luaBasicCard_className2objectName.contains(name)) {
-        const LuaBasicCard *lcard = luaBasicCards.value(name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else if (luaBasicCard_className2objectName.values().contains(name)) {
-        QString class_name = luaBasicCard_className2objectName.key(name, name);
-        const LuaBasicCard *lcard = luaBasicCards.value(class_name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else if (luaTrickCard_className2objectName.contains(name)) {
-        const LuaTrickCard *lcard = luaTrickCards.value(name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else if (luaTrickCard_className2objectName.values().contains(name)) {
-        QString class_name = luaTrickCard_className2objectName.key(name, name);
-        const LuaTrickCard *lcard = luaTrickCards.value(class_name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else if (luaWeapon_className2objectName.contains(name)) {
-        const LuaWeapon *lcard = luaWeapons.value(name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else if (luaWeapon_className2objectName.values().contains(name)) {
-        QString class_name = luaWeapon_className2objectName.key(name, name);
-        const LuaWeapon *lcard = luaWeapons.value(class_name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else if (luaArmor_className2objectName.contains(name)) {
-        const LuaArmor *lcard = luaArmors.value(name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else if (luaArmor_className2objectName.values().contains(name)) {
-        QString class_name = luaArmor_className2objectName.key(name, name);
-        const LuaArmor *lcard = luaArmors.value(class_name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else if (luaTreasure_className2objectName.contains(name)) {
-        const LuaTreasure *lcard = luaTreasures.value(name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else if (luaTreasure_className2objectName.values().contains(name)) {
-        QString class_name = luaTreasure_className2objectName.key(name, name);
-        const LuaTreasure *lcard = luaTreasures.value(class_name, NULL);
-        if (!lcard) return NULL;
-        card = lcard->clone(suit, number);
-    } else {
-        const QMetaObject *meta = metaobjects.value(name, NULL);
-        if (meta == NULL)
-            meta = metaobjects.value(className2objectName.key(name, QString()), NULL);
-        if (meta) {
-            QObject *card_obj = meta->newInstance(Q_ARG(Card::Suit, suit), Q_ARG(int, number));
-            card_obj->setObjectName(className2objectName.value(name, name));
-            card = qobject_cast<Card *>(card_obj);
-        }
-    }
+    QHash<QString, CardFactory>::const_iterator it = card_factories.constFind(name);
+    if (it == card_factories.constEnd())
+        return NULL;
+
+    Card *card = it->create(*it, suit, number);
     if (!card) return NULL;
     card->clearFlags();
     if (!flags.isEmpty()) {
@@ -645,6 +811,79 @@ Card *Engine::cloneCard(const QString &name, Card::Suit suit, int number, const
     return card;
 }
 
+QList<const Card *> Engine::cloneCards(const QStringList &names, Card::Suit suit, int number) const
+{
+    QList<const Card *> result;
+    foreach (const QString &name, names) {
+        Card *card = cloneCard(name, suit, number);
+        if (card == NULL)
+            continue;
+        autoReleaseCard(card);
+        result << card;
+    }
+    return result;
+}
+
+template<typename T>
+Card *Engine::CardFactory::cloneLuaCard(const CardFactory &factory, Card::Suit suit, int number)
+{
+    return static_cast<const T *>(factory.prototype)->clone(suit, number);
+}
+
+Card *Engine::CardFactory::newNativeCard(const CardFactory &factory, Card::Suit suit, int number)
+{
+    QObject *card_obj = factory.meta->newInstance(Q_ARG(Card::Suit, suit), Q_ARG(int, number));
+    if (card_obj == NULL)
+        return NULL;
+    card_obj->setObjectName(factory.objectName);
+    return qobject_cast<Card *>(card_obj);
+}
+
+void Engine::addCardFactory(const QString &name, const CardFactory &factory)
+{
+    QHash<QString, CardFactory>::const_iterator it = card_factories.constFind(name);
+    if (it == card_factories.constEnd() || it->rank <= factory.rank)
+        card_factories.insert(name, factory);
+}
+
+void Engine::addNativeCardFactories(const QMetaObject *meta, const QString &object_name)
+{
+    QString class_name = meta->className();
+    CardFactory factory;
+    factory.create = &CardFactory::newNativeCard;
+    factory.prototype = NULL;
+    factory.meta = meta;
+    factory.objectName = object_name.isEmpty() ? class_name : object_name;
+    factory.rank = CardFactory::NativeClassName;
+    addCardFactory(class_name, factory);
+
+    if (!card_class_ids.contains(meta)) {
+        card_class_ids.insert(meta, card_classes.size());
+        card_classes << meta;
+    }
+
+    if (!object_name.isEmpty() && object_name != class_name) {
+        factory.rank = CardFactory::NativeObjectName;
+        addCardFactory(object_name, factory);
+    }
+}
+
+template<typename T>
+void Engine::addLuaCardFactories(const T *prototype, const QString &object_name)
+{
+    if (prototype == NULL)
+        return;
+    CardFactory factory;
+    factory.create = &CardFactory::cloneLuaCard<T>;
+    factory.prototype = prototype;
+    factory.meta = NULL;
+    factory.objectName = prototype->objectName();
+    factory.rank = CardFactory::LuaClassName;
+    addCardFactory(prototype->getClassName(), factory);
+    factory.rank = CardFactory::LuaObjectName;
+    addCardFactory(object_name, factory);
+}
+
 SkillCard *Engine::cloneSkillCard(const QString &name) const
 {
     const QMetaObject *meta = metaobjects.value(name, NULL);
@@ -1071,6 +1310,10 @@ const ViewHasSkill *Engine::ViewHas(const Player *player, const QString &skill_n
     return NULL;
 }
 
+QList<const ViewHasSkill *> Engine::getViewHasSkills() const
+{
+    return viewhas_skills;
+}
 
 int Engine::correctDistance(const Player *from, const Player *to) const
 {
@@ -1105,8 +1348,7 @@ int Engine::correctCardTarget(const TargetModSkill::ModType type, const Player *
 
     if (type == TargetModSkill::Residue) {
         foreach (const TargetModSkill *skill, targetmod_skills) {
-            ExpPattern p(skill->getPattern());
-            if (p.match(from, card)) {
+            if (getExpPattern(skill->getPattern())->match(from, card)) {
                 int residue = skill->getResidueNum(from, card);
                 if (residue >= 998) return residue;
                 x += residue;
@@ -1114,8 +1356,7 @@ int Engine::correctCardTarget(const TargetModSkill::ModType type, const Player *
         }
     } else if (type == TargetModSkill::DistanceLimit) {
         foreach (const TargetModSkill *skill, targetmod_skills) {
-            ExpPattern p(skill->getPattern());
-            if (p.match(from, card)) {
+            if (getExpPattern(skill->getPattern())->match(from, card)) {
                 int distance_limit = skill->getDistanceLimit(from, card);
                 if (distance_limit >= 998) return distance_limit;
                 x += distance_limit;
@@ -1123,8 +1364,7 @@ int Engine::correctCardTarget(const TargetModSkill::ModType type, const Player *
         }
     } else if (type == TargetModSkill::ExtraTarget) {
         foreach (const TargetModSkill *skill, targetmod_skills) {
-            ExpPattern p(skill->getPattern());
-            if (p.match(from, card)) {
+            if (getExpPattern(skill->getPattern())->match(from, card)) {
                 x += skill->getExtraTargetNum(from, card);
             }
         }
@@ -1151,6 +1391,49 @@ int Engine::correctAttackRange(const Player *target, bool include_weapon, bool f
     return extra;
 }
 
+bool Engine::isDistanceCacheable() const
+{
+    return distance_cacheable;
+}
+
+bool Engine::isDistanceDependency(const QString &name) const
+{
+    return distance_dependencies.contains(name);
+}
+
+bool Engine::isDistanceDependency(int atom) const
+{
+    return distance_dependency_atoms.contains(atom);
+}
+
+int Engine::getAtom(const QString &name) const
+{
+    int atom = findAtom(name);
+    if (atom != -1)
+        return atom;
+
+    QWriteLocker locker(&m_atomLock);
+    QHash<QString, int>::const_iterator it = atoms.constFind(name);
+    if (it != atoms.constEnd())
+        return it.value();
+    atom = atom_names.length();
+    atom_names << name;
+    atoms.insert(name, atom);
+    return atom;
+}
+
+int Engine::findAtom(const QString &name) const
+{
+    QReadLocker locker(&m_atomLock);
+    return atoms.value(name, -1);
+}
+
+QString Engine::getAtomName(int atom) const
+{
+    QReadLocker locker(&m_atomLock);
+    return atom_names.value(atom);
+}
+
 QList<Card *> Engine::getCards() const
 {
     return cards;
@@ -36,7 +36,10 @@
 #include <QMetaObject>
 #include <QThread>
 #include <QList>
+#include <QVector>
+#include <QBitArray>
 #include <QMutex>
+#include <QReadWriteLock>
 
 class AI;
 class Scenario;
@@ -72,6 +75,8 @@ public:
     QStringList getBanPackages() const;
     Card *cloneCard(const Card *card) const;
     Card *cloneCard(const QString &name, Card::Suit suit = Card::SuitToBeDecided, int number = -1, const QStringList &flags = QStringList()) const;
+    // clones one card per name for evaluation, the cards are handed to autoReleaseCard()
+    QList<const Card *> cloneCards(const QStringList &names, Card::Suit suit = Card::SuitToBeDecided, int number = -1) const;
     SkillCard *cloneSkillCard(const QString &name) const;
     //************************************
     // Method:    getVersionNumber
@@ -106,7 +111,11 @@ public:
     QStringList getRoleList(const QString &mode) const;
 
     const CardPattern *getPattern(const QString &name) const;
+    const ExpPattern *getExpPattern(const QString &exp) const; // kept for the engine's lifetime, matchExpPattern() does not keep patterns with card ids
     bool matchExpPattern(const QString &pattern, const Player *player, const Card *card) const;
+    // native card classes are numbered as they are added, -1 for Lua cards and unknown classes
+    int getCardClassId(const Card *card) const;
+    QBitArray getCardKinds(const char *class_name) const;
     Card::HandlingMethod getCardHandlingMethod(const QString &method_name) const;
     QList<const Skill *> getRelatedSkills(const QString &skill_name) const;
     const Skill *getMainSkill(const QString &skill_name) const;
@@ -124,6 +133,19 @@ public:
     const Skill *getSkill(const QString &skill_name) const;
     const Skill *getSkill(const EquipCard *card) const;
     QStringList getSkillNames() const;
+
+    // skills are numbered densely in the order they are added, see Player::hasSkillById()
+    enum SkillTrait
+    {
+        GlobalSkillTrait = 0x1,
+        EquipSkillTrait = 0x2,
+        HiddenSkillTrait = 0x4,
+        GeneralSkillTrait = 0x8 // comes with a general, or is related to a skill which does
+    };
+    int getSkillId(const QString &skill_name) const;
+    const Skill *getSkillById(int skill_id) const;
+    int getSkillTraits(int skill_id) const;
+    int getMainSkillId(int skill_id) const;
     const TriggerSkill *getTriggerSkill(const QString &skill_name) const;
     const ViewAsSkill *getViewAsSkill(const QString &skill_name) const;
     QList<const DistanceSkill *> getDistanceSkills() const;
@@ -137,6 +159,7 @@ public:
     const Card *getEngineCard(int cardId) const;
     // @todo: consider making this const Card *
     Card *getCard(int cardId);
+    Card *getCard(int cardId, QObject *room);
     WrappedCard *getWrappedCard(int cardId);
 
     //************************************
@@ -197,22 +220,41 @@ public:
     const ProhibitSkill *isProhibited(const Player *from, const Player *to, const Card *card, const QList<const Player *> &others = QList<const Player *>()) const;
     const FixCardSkill *isCardFixed(const Player *from, const Player *to, const QString &flags, Card::HandlingMethod method) const;
     const ViewHasSkill *ViewHas(const Player *player, const QString &skill_name, const QString &flag) const;
+    QList<const ViewHasSkill *> getViewHasSkills() const;
     int correctDistance(const Player *from, const Player *to) const;
     int correctMaxCards(const ServerPlayer *target, bool fixed = false, MaxCardsType::MaxCardsCount type = MaxCardsType::Max) const;
     int correctCardTarget(const TargetModSkill::ModType type, const Player *from, const Card *card) const;
     int correctAttackRange(const Player *target, bool include_weapon = true, bool fixed = false) const;
+    bool isDistanceCacheable() const;
+    bool isDistanceDependency(const QString &name) const;
+    bool isDistanceDependency(int atom) const;
+
+    // names of player flags, marks and history entries are interned into
+    // small integers, see AtomMap. Atoms are never released.
+    int getAtom(const QString &name) const;
+    // like getAtom(), but never interns; -1 if the name has no atom yet
+    int findAtom(const QString &name) const;
+    QString getAtomName(int atom) const;
 
     void registerRoom(QObject *room);
     void unregisterRoom();
+    // while set, the current thread must not add anything to the engine, see LuaStatePool
+    void setRegistrationForbidden(bool forbidden);
     QObject *currentRoomObject();
     Room *currentRoom();
     RoomState *currentRoomState();
+    RoomState *getRoomState(QObject *room);
 
     QString getCurrentCardUsePattern();
     CardUseStruct::CardUseReason getCurrentCardUseReason();
 
     bool isGeneralHidden(const QString &general_name) const;
 
+    // Releases a card which is only needed for the rest of the current step, in
+    // place of deleteLater(). In a room thread the card goes to the room's
+    // transient card arena, elsewhere to the event loop.
+    void autoReleaseCard(const Card *card) const;
+
     TransferSkill *getTransfer() const;
     QList<Card *> getCards() const;
 
@@ -220,19 +262,66 @@ private:
     void _loadMiniScenarios();
     void _loadModScenarios();
 
-    QMutex m_mutex;
     QHash<QString, QString> translations;
     GeneralList generalList;
     QHash<QString, const General *> generalHash;
     QHash<QString, const QMetaObject *> metaobjects;
     QHash<QString, QString> className2objectName;
+    QHash<const QMetaObject *, int> card_class_ids;
+    QList<const QMetaObject *> card_classes;
+
+    // how cloneCard() builds a card, keyed by both class name and object name
+    struct CardFactory
+    {
+        // Lua class names win over Lua object names, over native class names, over native object names
+        enum Rank
+        {
+            NativeObjectName,
+            NativeClassName,
+            LuaObjectName,
+            LuaClassName
+        };
+        Card *(*create)(const CardFactory &factory, Card::Suit suit, int number);
+        template<typename T>
+        static Card *cloneLuaCard(const CardFactory &factory, Card::Suit suit, int number);
+        static Card *newNativeCard(const CardFactory &factory, Card::Suit suit, int number);
+
+        const Card *prototype; // Lua cards
+        const QMetaObject *meta; // native cards
+        QString objectName;
+        Rank rank;
+    };
+    QHash<QString, CardFactory> card_factories;
+    void addCardFactory(const QString &name, const CardFactory &factory);
+    void addNativeCardFactories(const QMetaObject *meta, const QString &object_name);
+    template<typename T>
+    void addLuaCardFactories(const T *prototype, const QString &object_name);
+
     QHash<QString, const Skill *> skills;
-    QHash<QThread *, QObject *> m_rooms;
     QMap<QString, QString> modes;
     QMultiMap<QString, QString> related_skills;
+    QHash<QString, QString> main_skills; // related skill -> first main skill owning it
+    QHash<QString, int> skill_ids;
+    QVector<const Skill *> skill_table;
+    QVector<quint8> skill_traits;
+    QVector<int> main_skill_ids;
+    void updateMainSkillIds();
     //QMultiMap<QString, QString> related_generals;
-    mutable QMap<QString, const CardPattern *> patterns;
+    // Patterns known once the engine is loaded, never changed afterwards, so the
+    // room threads read them without locking. The ones added later, by packages
+    // or by expressions first seen while playing, go to the maps below them.
+    QHash<QString, const CardPattern *> static_patterns;
+    QHash<QString, const ExpPattern *> static_exp_patterns;
+    bool patterns_frozen;
+    void freezePatterns();
+    mutable QHash<QString, const CardPattern *> patterns;
     mutable QList<ExpPattern *> enginePatterns;
+    mutable QHash<QString, const ExpPattern *> expPatterns; // compiled expressions without card ids, owned by enginePatterns
+    mutable QReadWriteLock m_patternLock;
+    mutable QHash<QString, int> atoms;
+    mutable QStringList atom_names;
+    mutable QReadWriteLock m_atomLock;
+    const ExpPattern *getExpPatternUnlocked(const QString &exp) const;
 
     // special skills
     QList<const ProhibitSkill *> prohibit_skills;
@@ -244,6 +333,11 @@ private:
     QList<const AttackRangeSkill *> attackrange_skills;
     QList<const TriggerSkill *> global_trigger_skills;
 
+    // what the distance and attack range skills read, see SeatRing
+    QSet<QString> distance_dependencies;
+    QSet<int> distance_dependency_atoms;
+    bool distance_cacheable;
+
     QList<const Package *> packages;
     QList<Card *> cards;
     QStringList lord_list;
@@ -254,15 +348,10 @@ private:
 
     lua_State *lua;
 
-    QHash<QString, QString> luaBasicCard_className2objectName;
     QHash<QString, const LuaBasicCard *> luaBasicCards;
-    QHash<QString, QString> luaTrickCard_className2objectName;
     QHash<QString, const LuaTrickCard *> luaTrickCards;
-    QHash<QString, QString> luaWeapon_className2objectName;
     QHash<QString, const LuaWeapon*> luaWeapons;
-    QHash<QString, QString> luaArmor_className2objectName;
     QHash<QString, const LuaArmor *> luaArmors;
-    QHash<QString, QString> luaTreasure_className2objectName;
     QHash<QString, const LuaTreasure *> luaTreasures;
 
     QMultiMap<QString, QString> sp_convert_pairs;
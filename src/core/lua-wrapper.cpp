@@ -90,6 +90,7 @@ QString LuaViewAsSkill::getGuhuoBox() const
 LuaViewHasSkill::LuaViewHasSkill(const char *name)
     : ViewHasSkill(name), is_viewhas(0)
 {
+    viewhas_any = true;
 }
 
 LuaFilterSkill::LuaFilterSkill(const char *name)
@@ -100,6 +101,8 @@ LuaFilterSkill::LuaFilterSkill(const char *name)
 LuaDistanceSkill::LuaDistanceSkill(const char *name)
     : DistanceSkill(name), correct_func(0)
 {
+    // a Lua function may read anything, unless the spec says otherwise
+    cacheable = false;
 }
 
 LuaMaxCardsSkill::LuaMaxCardsSkill(const char *name)
@@ -116,6 +119,7 @@ LuaTargetModSkill::LuaTargetModSkill(const char *name, const char *pattern)
 LuaAttackRangeSkill::LuaAttackRangeSkill(const char *name)
     : AttackRangeSkill(name), extra_func(0), fixed_func(0)
 {
+    cacheable = false;
 }
 
 static QHash<QString, const LuaSkillCard *> LuaSkillCards;
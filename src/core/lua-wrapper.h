@@ -182,6 +182,11 @@ public:
     {
         this->global = global;
     }
+    inline void setViewHasSkills(const char *skills)
+    {
+        viewhas_skills = QString(skills).split("+", QString::SkipEmptyParts);
+        viewhas_any = false;
+    }
 };
 
 class LuaFilterSkill : public FilterSkill
@@ -24,6 +24,9 @@
 #include "client.h"
 #include "standard-basics.h"
 #include "settings.h"
+#include "seatring.h"
+
+#include <QEvent>
 
 Player::Player(QObject *parent)
     : QObject(parent), general(NULL), general2(NULL),
@@ -36,6 +39,12 @@ Player::Player(QObject *parent)
     weapon(NULL), armor(NULL), defensive_horse(NULL), offensive_horse(NULL), treasure(NULL),
     face_up(true), chained(false), removed(false), scenario_role_shown(false)
 {
+    if (qobject_cast<Room *>(parent) != NULL || qobject_cast<Client *>(parent) != NULL)
+        seat_epochs = Sanguosha->getRoomState(parent)->getSeatEpochs();
+    else
+        seat_epochs = SeatEpochs::detached();
+    // the rings of the siblings do not know this player yet
+    seat_epochs->touch();
 }
 
 void Player::setScreenName(const QString &screen_name)
@@ -69,6 +78,7 @@ bool Player::hasShownRole() const
 void Player::setShownRole(bool shown)
 {
     this->role_shown = shown;
+    seat_epochs->touchDistances();
 }
 
 void Player::setHp(int hp)
@@ -144,7 +154,10 @@ int Player::getSeat() const
 
 void Player::setSeat(int seat)
 {
-    this->seat = seat;
+    if (this->seat != seat) {
+        this->seat = seat;
+        seat_epochs->touch();
+    }
 }
 
 void Player::setDisableShow(const QString &flags, const QString &reason)
@@ -160,6 +173,7 @@ void Player::setDisableShow(const QString &flags, const QString &reason)
 
     QString dis_str = flags + ',' + reason;
     disable_show << dis_str;
+    seat_epochs->touchDistances();
     emit disable_show_changed();
 }
 
@@ -177,6 +191,7 @@ void Player::removeDisableShow(const QString &reason)
     foreach (const QString &to_remove, remove_list)
         disable_show.removeOne(to_remove);
 
+    seat_epochs->touchDistances();
     emit disable_show_changed();
 }
 
@@ -229,17 +244,23 @@ bool Player::isDead() const
 
 void Player::setAlive(bool alive)
 {
-    this->alive = alive;
+    if (this->alive != alive) {
+        this->alive = alive;
+        seat_epochs->touch();
+    }
 }
 
 QString Player::getFlags() const
 {
-    return QStringList(flags.toList()).join("|");
+    return getFlagList().join("|");
 }
 
 QStringList Player::getFlagList() const
 {
-    return QStringList(flags.toList());
+    QStringList flag_list;
+    foreach (int flag, flags.keys())
+        flag_list << Sanguosha->getAtomName(flag);
+    return flag_list;
 }
 
 void Player::setFlags(const QString &flag)
@@ -252,13 +273,28 @@ void Player::setFlags(const QString &flag)
     if (flag.startsWith(unset_symbol)) {
         QString copy = flag;
         copy.remove(unset_symbol);
-        flags.remove(copy);
+        // a name without an atom was never set on anyone
+        int atom = Sanguosha->findAtom(copy);
+        if (atom != -1)
+            setFlag(atom, false);
     } else {
-        flags.insert(flag);
+        setFlag(Sanguosha->getAtom(flag), true);
     }
 }
 
+void Player::setFlag(int flag, bool set)
+{
+    if (flags.insert(flag, set ? 1 : 0))
+        touchDistanceDependency(flag);
+}
+
 bool Player::hasFlag(const QString &flag) const
+{
+    int atom = Sanguosha->findAtom(flag);
+    return atom != -1 && flags.contains(atom);
+}
+
+bool Player::hasFlag(int flag) const
 {
     return flags.contains(flag);
 }
@@ -266,15 +302,31 @@ bool Player::hasFlag(const QString &flag) const
 void Player::clearFlags()
 {
     flags.clear();
+    seat_epochs->touchDistances();
 }
 
 int Player::getAttackRange(bool include_weapon) const
 {
-    if (hasFlag("InfinityAttackRange") || getMark("InfinityAttackRange") > 0)
+    static const int infinity_attack_range = Sanguosha->getAtom("InfinityAttackRange");
+    if (hasFlag(infinity_attack_range) || getMark(infinity_attack_range) > 0)
         return 1000;
 
     include_weapon = include_weapon && weapon != NULL;
 
+    if (!Sanguosha->isDistanceCacheable())
+        return computeAttackRange(include_weapon);
+
+    QSharedPointer<SeatRing> ring = seatRing();
+    int range = ring->cachedAttackRange(this, include_weapon);
+    if (range == SeatRing::Unknown) {
+        range = computeAttackRange(include_weapon);
+        ring->cacheAttackRange(this, include_weapon, range);
+    }
+    return range;
+}
+
+int Player::computeAttackRange(bool include_weapon) const
+{
     int fixeddis = Sanguosha->correctAttackRange(this, include_weapon, true);
     if (fixeddis > 0)
         return fixeddis;
@@ -297,12 +349,34 @@ int Player::getAttackRange(bool include_weapon) const
 
 bool Player::inMyAttackRange(const Player *other) const
 {
-    if (distanceTo(other) == -1)
+    int distance = distanceTo(other);
+    if (distance == -1)
         return false;
-    QStringList in_attack_range_players = property("in_my_attack_range").toString().split("+");
-    if (in_attack_range_players.contains(other->objectName())) // for DIY Skills
+    if (distance <= getAttackRange())
         return true;
-    return distanceTo(other) <= getAttackRange();
+    QStringList in_attack_range_players = property("in_my_attack_range").toString().split("+");
+    return in_attack_range_players.contains(other->objectName()); // for DIY Skills
+}
+
+QList<const Player *> Player::getPlayersInAttackRange() const
+{
+    QList<const Player *> players;
+    foreach (const Player *p, getAliveSiblings()) {
+        if (inMyAttackRange(p))
+            players << p;
+    }
+    return players;
+}
+
+QList<const Player *> Player::getPlayersWithinDistance(int distance) const
+{
+    QList<const Player *> players;
+    foreach (const Player *p, getAliveSiblings()) {
+        int d = distanceTo(p);
+        if (d != -1 && d <= distance)
+            players << p;
+    }
+    return players;
 }
 
 void Player::setFixedDistance(const Player *player, int distance)
@@ -315,13 +389,7 @@ void Player::setFixedDistance(const Player *player, int distance)
 
 int Player::originalRightDistanceTo(const Player *other) const
 {
-    int right = 0;
-    Player *next_p = parent()->findChild<Player *>(objectName());
-    while (next_p != other) {
-        next_p = next_p->getNextAlive();
-        right++;
-    }
-    return right;
+    return seatRing()->rightDistance(this, other);
 }
 
 int Player::distanceTo(const Player *other, int distance_fix) const
@@ -335,11 +403,19 @@ int Player::distanceTo(const Player *other, int distance_fix) const
     if (fixed_distance.contains(other))
         return fixed_distance.value(other);
 
-    int right = originalRightDistanceTo(other);
-    int left = aliveCount(false) - right;
-    int distance = qMin(left, right);
+    QSharedPointer<SeatRing> ring = seatRing();
+    bool cacheable = Sanguosha->isDistanceCacheable();
+    int distance = cacheable ? ring->cachedDistance(this, other) : SeatRing::Unknown;
+    if (distance == SeatRing::Unknown) {
+        int right = ring->rightDistance(this, other);
+        int left = ring->aliveCount(false) - right;
+        distance = qMin(left, right);
+
+        distance += Sanguosha->correctDistance(this, other);
+        if (cacheable)
+            ring->cacheDistance(this, other, distance);
+    }
 
-    distance += Sanguosha->correctDistance(this, other);
     distance += distance_fix;
 
     // keep the distance >=1
@@ -353,6 +429,7 @@ void Player::setGeneral(const General *new_general)
 {
     if (this->general != new_general) {
         this->general = new_general;
+        seat_epochs->touchDistances();
 
         if (new_general && kingdom.isEmpty())
             setKingdom(new_general->getKingdom());
@@ -381,6 +458,7 @@ void Player::setGeneral2Name(const QString &general_name)
     const General *new_general = Sanguosha->getGeneral(general_name);
     if (general2 != new_general) {
         general2 = new_general;
+        seat_epochs->touchDistances();
 
         emit general2_changed();
     }
@@ -429,6 +507,7 @@ void Player::setRole(const QString &role)
     if (role.isEmpty()) return;
     if (this->role != role) {
         this->role = role;
+        seat_epochs->touchDistances();
         emit role_changed(role);
         if (role == "careerist")
             emit kingdom_changed("careerist");
@@ -478,36 +557,44 @@ bool Player::isLord() const
 
 bool Player::hasSkill(const QString &skill_name, bool include_lose) const
 {
-    const TriggerSkill *trigger = Sanguosha->getTriggerSkill(skill_name);
-    if (trigger && trigger->isGlobal()) return true;
+    return hasSkillById(Sanguosha->getSkillId(skill_name), include_lose);
+}
 
-    const Skill *skill = Sanguosha->getSkill(skill_name);
+bool Player::hasSkill(const Skill *skill, bool include_lose) const
+{
+    int skill_id = skill->getId();
+    if (skill_id == -1)
+        skill_id = Sanguosha->getSkillId(skill->objectName());
+    return hasSkillById(skill_id, include_lose);
+}
+
+bool Player::hasSkillById(int skill_id, bool include_lose) const
+{
+    const Skill *skill = Sanguosha->getSkillById(skill_id);
     if (skill == NULL)
         return false;
 
-    if (!skill->isVisible()) {
-        const Skill *main_skill = Sanguosha->getMainSkill(skill_name);
-        if (main_skill != NULL)
-            return hasSkill(main_skill);
+    int traits = Sanguosha->getSkillTraits(skill_id);
+    if (traits & Engine::GlobalSkillTrait)
+        return true;
+
+    if (traits & Engine::HiddenSkillTrait) {
+        int main_id = Sanguosha->getMainSkillId(skill_id);
+        if (main_id != -1 && main_id != skill_id)
+            return hasSkillById(main_id);
     }
 
-    if (!include_lose && !hasEquipSkill(skill_name) && !getAcquiredSkills().contains(skill_name) && ownSkill(skill_name) && !canShowGeneral(inHeadSkills(skill_name) ? "h" : "d"))
+    int state = skillState(skill_id);
+    if (!include_lose && (state & (HeadOwned | DeputyOwned)) && !(state & (HeadAcquired | DeputyAcquired))
+        && !canShowGeneral((state & HeadOwned) ? "h" : "d") && !hasEquipSkill(skill->objectName()))
         return false;
-    QStringList InvalidSkill = property("invalid_skill_has").toString().split("+");
-    if (InvalidSkill.contains(skill_name))
+    if (state & InvalidHas)
         return false;
 
-    if (Sanguosha->ViewHas(this, skill_name, "skill")) return true;
-
-    return head_skills.value(skill_name, false)
-        || deputy_skills.value(skill_name, false)
-        || head_acquired_skills.contains(skill_name)
-        || deputy_acquired_skills.contains(skill_name);
-}
+    if (state & (HeadEnabled | DeputyEnabled | HeadAcquired | DeputyAcquired))
+        return true;
 
-bool Player::hasSkill(const Skill *skill, bool include_lose) const
-{
-    return hasSkill(skill->objectName(), include_lose);
+    return Sanguosha->ViewHas(this, skill->objectName(), "skill") != NULL;
 }
 
 bool Player::hasSkills(const QString &skill_name, bool include_lose) const
@@ -547,6 +634,8 @@ void Player::acquireSkill(const QString &skill_name, bool head)
 {
     QSet<QString> &skills = head ? head_acquired_skills : deputy_acquired_skills;
     skills.insert(skill_name);
+    updateSkillState(skill_name);
+    seat_epochs->touchDistances();
 }
 
 void Player::detachSkill(const QString &skill_name, bool head)
@@ -555,12 +644,16 @@ void Player::detachSkill(const QString &skill_name, bool head)
         head_acquired_skills.remove(skill_name);
     else
         deputy_acquired_skills.remove(skill_name);
+    updateSkillState(skill_name);
+    seat_epochs->touchDistances();
 }
 
 void Player::detachAllSkills()
 {
     head_acquired_skills.clear();
     deputy_acquired_skills.clear();
+    rebuildSkillStates();
+    seat_epochs->touchDistances();
 }
 
 void Player::addSkill(const QString &skill_name, bool head_skill)
@@ -571,6 +664,8 @@ void Player::addSkill(const QString &skill_name, bool head_skill)
         head_skills[skill_name] = !skill->canPreshow() || general1_showed;
     else
         deputy_skills[skill_name] = !skill->canPreshow() || general2_showed;
+    updateSkillState(skill_name);
+    seat_epochs->touchDistances();
 }
 
 void Player::loseSkill(const QString &skill_name, bool head)
@@ -579,6 +674,60 @@ void Player::loseSkill(const QString &skill_name, bool head)
         head_skills.remove(skill_name);
     else
         deputy_skills.remove(skill_name);
+    updateSkillState(skill_name);
+    seat_epochs->touchDistances();
+}
+
+void Player::updateSkillState(const QString &skill_name)
+{
+    int skill_id = Sanguosha->getSkillId(skill_name);
+    if (skill_id == -1)
+        return;
+    if (skill_id >= skill_state.size())
+        skill_state.resize(skill_id + 1);
+
+    quint8 state = skill_state.at(skill_id) & (InvalidHas | InvalidShown);
+    if (head_skills.contains(skill_name)) {
+        state |= HeadOwned;
+        if (head_skills.value(skill_name))
+            state |= HeadEnabled;
+    }
+    if (deputy_skills.contains(skill_name)) {
+        state |= DeputyOwned;
+        if (deputy_skills.value(skill_name))
+            state |= DeputyEnabled;
+    }
+    if (head_acquired_skills.contains(skill_name))
+        state |= HeadAcquired;
+    if (deputy_acquired_skills.contains(skill_name))
+        state |= DeputyAcquired;
+    skill_state[skill_id] = state;
+}
+
+void Player::rebuildSkillStates()
+{
+    for (int i = 0; i < skill_state.size(); ++i)
+        skill_state[i] &= (InvalidHas | InvalidShown);
+
+    foreach (const QString &skill_name, head_skills.keys() + deputy_skills.keys())
+        updateSkillState(skill_name);
+    foreach (const QString &skill_name, head_acquired_skills + deputy_acquired_skills)
+        updateSkillState(skill_name);
+}
+
+void Player::updateInvalidSkills(const char *property_name, quint8 flag)
+{
+    for (int i = 0; i < skill_state.size(); ++i)
+        skill_state[i] &= ~flag;
+
+    foreach (const QString &skill_name, property(property_name).toString().split("+")) {
+        int skill_id = Sanguosha->getSkillId(skill_name);
+        if (skill_id == -1)
+            continue;
+        if (skill_id >= skill_state.size())
+            skill_state.resize(skill_id + 1);
+        skill_state[skill_id] |= flag;
+    }
 }
 
 QString Player::getPhaseString() const
@@ -625,6 +774,7 @@ void Player::setEquip(WrappedCard *equip)
         case EquipCard::OffensiveHorseLocation: offensive_horse = equip; break;
         case EquipCard::TreasureLocation: treasure = equip; break;
     }
+    seat_epochs->touchDistances();
 }
 
 void Player::removeEquip(WrappedCard *equip)
@@ -638,6 +788,7 @@ void Player::removeEquip(WrappedCard *equip)
         case EquipCard::OffensiveHorseLocation: offensive_horse = NULL; break;
         case EquipCard::TreasureLocation: treasure = NULL; break;
     }
+    seat_epochs->touchDistances();
 }
 
 bool Player::hasEquip(const Card *card) const
@@ -729,7 +880,8 @@ const EquipCard *Player::getEquip(int index) const
 
 bool Player::hasWeapon(const QString &weapon_name) const
 {
-    if (!weapon || getMark("Equips_Nullified_to_Yourself") > 0) return false;
+    static const int equips_nullified = Sanguosha->getAtom("Equips_Nullified_to_Yourself");
+    if (!weapon || getMark(equips_nullified) > 0) return false;
     if (weapon->objectName() == weapon_name || weapon->isKindOf(weapon_name.toStdString().c_str())) return true;
     const Card *real_weapon = Sanguosha->getEngineCard(weapon->getEffectiveId());
     return real_weapon->objectName() == weapon_name || real_weapon->isKindOf(weapon_name.toStdString().c_str());
@@ -737,8 +889,10 @@ bool Player::hasWeapon(const QString &weapon_name) const
 
 bool Player::hasArmorEffect(const QString &armor_name) const
 {
-    if (!tag["Qinggang"].toStringList().isEmpty() || getMark("Armor_Nullified") > 0
-        || getMark("Equips_Nullified_to_Yourself") > 0)
+    static const int armor_nullified = Sanguosha->getAtom("Armor_Nullified");
+    static const int equips_nullified = Sanguosha->getAtom("Equips_Nullified_to_Yourself");
+    if (!tag["Qinggang"].toStringList().isEmpty() || getMark(armor_nullified) > 0
+        || getMark(equips_nullified) > 0)
         return false;
 
     if (Sanguosha->ViewHas(this, armor_name, "armor")) return true;
@@ -754,7 +908,8 @@ bool Player::hasArmorEffect(const QString &armor_name) const
 
 bool Player::hasTreasure(const QString &treasure_name) const
 {
-    if (!treasure || getMark("Equips_Nullified_to_Yourself") > 0) return false;
+    static const int equips_nullified = Sanguosha->getAtom("Equips_Nullified_to_Yourself");
+    if (!treasure || getMark(equips_nullified) > 0) return false;
     if (treasure->objectName() == treasure_name || treasure->isKindOf(treasure_name.toStdString().c_str())) return true;
     const Card *real_treasure = Sanguosha->getEngineCard(treasure->getEffectiveId());
     return real_treasure->objectName() == treasure_name || real_treasure->isKindOf(treasure_name.toStdString().c_str());
@@ -809,6 +964,7 @@ void Player::setKingdom(const QString &kingdom)
 {
     if (this->kingdom != kingdom) {
         this->kingdom = kingdom;
+        seat_epochs->touchDistances();
         if (role == "careerist") return;
         emit kingdom_changed(kingdom);
     }
@@ -1060,6 +1216,7 @@ void Player::setRemoved(bool removed)
 {
     if (this->removed != removed) {
         this->removed = removed;
+        seat_epochs->touch();
         emit removedChanged();
     }
 }
@@ -1076,14 +1233,14 @@ bool Player::isDuanchang(const bool head) const
 
 void Player::addMark(const QString &mark, int add_num)
 {
-    int value = marks.value(mark, 0);
+    int value = getMark(mark);
     value += add_num;
     setMark(mark, value);
 }
 
 void Player::removeMark(const QString &mark, int remove_num)
 {
-    int value = marks.value(mark, 0);
+    int value = getMark(mark);
     value -= remove_num;
     value = qMax(0, value);
     setMark(mark, value);
@@ -1091,13 +1248,20 @@ void Player::removeMark(const QString &mark, int remove_num)
 
 void Player::setMark(const QString &mark, int value)
 {
-    if (marks[mark] != value)
-        marks[mark] = value;
+    int atom = Sanguosha->getAtom(mark);
+    if (marks.insert(atom, value))
+        touchDistanceDependency(atom);
 }
 
 int Player::getMark(const QString &mark) const
 {
-    return marks.value(mark, 0);
+    int atom = Sanguosha->findAtom(mark);
+    return atom == -1 ? 0 : marks.value(atom);
+}
+
+int Player::getMark(int mark) const
+{
+    return marks.value(mark);
 }
 
 bool Player::canSlash(const Player *other, const Card *slash, bool distance_limit,
@@ -1106,10 +1270,9 @@ bool Player::canSlash(const Player *other, const Card *slash, bool distance_limi
     if (other == this || !other->isAlive())
         return false;
 
-    Slash *newslash = new Slash(Card::NoSuit, 0);
-    newslash->deleteLater();
+    Slash newslash(Card::NoSuit, 0);
 
-    if (isProhibited(other, slash == NULL ? newslash : slash, others))
+    if (isProhibited(other, slash == NULL ? &newslash : slash, others))
         return false;
 
     int distance = distanceTo(other, rangefix);
@@ -1117,7 +1280,7 @@ bool Player::canSlash(const Player *other, const Card *slash, bool distance_limi
         return false;
 
     if (distance_limit)
-        return distance <= getAttackRange() + Sanguosha->correctCardTarget(TargetModSkill::DistanceLimit, this, slash == NULL ? newslash : slash);
+        return distance <= getAttackRange() + Sanguosha->correctCardTarget(TargetModSkill::DistanceLimit, this, slash == NULL ? &newslash : slash);
     else
         return true;
 }
@@ -1199,35 +1362,48 @@ void Player::setPileOpen(const QString &pile_name, const QString &player)
 
 void Player::addHistory(const QString &name, int times)
 {
-    history[name] += times;
+    int atom = Sanguosha->getAtom(name);
+    history.insert(atom, history.value(atom) + times);
 }
 
 int Player::getSlashCount() const
 {
-    return history.value("Slash", 0)
-        + history.value("ThunderSlash", 0)
-        + history.value("FireSlash", 0);
+    static const int slash = Sanguosha->getAtom("Slash");
+    static const int thunder_slash = Sanguosha->getAtom("ThunderSlash");
+    static const int fire_slash = Sanguosha->getAtom("FireSlash");
+    return history.value(slash)
+        + history.value(thunder_slash)
+        + history.value(fire_slash);
 }
 
 void Player::clearHistory(const QString &name)
 {
     if (name.isEmpty()) {                                   //analeptic must be deleted manually
-        QHash<QString, int> history_copy = history;
-        foreach(const QString &key, history_copy.keys())
-            if (key != "Analeptic")
-                history.remove(key);
-    } else
-        history.remove(name);
+        static const int analeptic = Sanguosha->getAtom("Analeptic");
+        int analeptic_times = history.value(analeptic);
+        history.clear();
+        history.insert(analeptic, analeptic_times);
+    } else {
+        int atom = Sanguosha->findAtom(name);
+        if (atom != -1)
+            history.remove(atom);
+    }
 }
 
 bool Player::hasUsed(const QString &card_class) const
 {
-    return history.value(card_class, 0) > 0;
+    return usedTimes(card_class) > 0;
 }
 
 int Player::usedTimes(const QString &card_class) const
 {
-    return history.value(card_class, 0);
+    int atom = Sanguosha->findAtom(card_class);
+    return atom == -1 ? 0 : history.value(atom);
+}
+
+int Player::usedTimes(int card_class) const
+{
+    return history.value(card_class);
 }
 
 bool Player::hasEquipSkill(const QString &skill_name) const
@@ -1463,9 +1639,8 @@ bool Player::isProhibited(const Player *to, const Card *card, const QList<const
 
 bool Player::canSlashWithoutCrossbow(const Card *slash) const
 {
-    Slash *newslash = new Slash(Card::NoSuit, 0);
-    newslash->deleteLater();
-#define THIS_SLASH (slash == NULL ? newslash : slash)
+    Slash newslash(Card::NoSuit, 0);
+#define THIS_SLASH (slash == NULL ? &newslash : slash)
     int slash_count = getSlashCount();
     int valid_slash_count = 1;
     valid_slash_count += Sanguosha->correctCardTarget(TargetModSkill::Residue, this, THIS_SLASH);
@@ -1578,12 +1753,13 @@ void Player::copyFrom(Player *p)
     Player *b = this;
     Player *a = p;
 
-    b->marks = QMap<QString, int>(a->marks);
+    b->marks = a->marks;
     b->piles = QMap<QString, QList<int> >(a->piles);
     b->head_acquired_skills = QSet<QString>(a->head_acquired_skills);
     b->deputy_acquired_skills = QSet<QString>(a->deputy_acquired_skills);
-    b->flags = QSet<QString>(a->flags);
-    b->history = QHash<QString, int>(a->history);
+    b->rebuildSkillStates();
+    b->flags = a->flags;
+    b->history = a->history;
     b->m_gender = a->m_gender;
 
     b->hp = a->hp;
@@ -1592,6 +1768,7 @@ void Player::copyFrom(Player *p)
     b->role = a->role;
     b->seat = a->seat;
     b->alive = a->alive;
+    seat_epochs->touch();
 
     b->phase = a->phase;
     b->weapon = a->weapon;
@@ -1610,22 +1787,12 @@ void Player::copyFrom(Player *p)
 
 QList<const Player *> Player::getSiblings() const
 {
-    QList<const Player *> siblings;
-    if (parent()) {
-        siblings = parent()->findChildren<const Player *>();
-        siblings.removeOne(this);
-    }
-    return siblings;
+    return seatRing()->siblings(this, false);
 }
 
 QList<const Player *> Player::getAliveSiblings() const
 {
-    QList<const Player *> siblings = getSiblings();
-    foreach (const Player *p, siblings) {
-        if (!p->isAlive())
-            siblings.removeOne(p);
-    }
-    return siblings;
+    return seatRing()->siblings(this, true);
 }
 
 bool Player::hasShownSkill(const Skill *skill) const
@@ -1633,16 +1800,23 @@ bool Player::hasShownSkill(const Skill *skill) const
     if (skill == NULL)
         return false;
 
-    QStringList InvalidSkill = property("invalid_skill_shown").toString().split("+");
-    if (InvalidSkill.contains(skill->objectName())) return false;
+    int skill_id = skill->getId();
+    if (skill_id == -1)
+        skill_id = Sanguosha->getSkillId(skill->objectName());
+    int state = skillState(skill_id);
 
-    if (head_acquired_skills.contains(skill->objectName()) || deputy_acquired_skills.contains(skill->objectName()))
-        return true;
+    if (state & InvalidShown) return false;
 
-    if (skill->inherits("ArmorSkill") || skill->inherits("WeaponSkill") || skill->inherits("TreasureSkill"))
+    if (state & (HeadAcquired | DeputyAcquired))
         return true;
 
-    if (skill->inherits("TriggerSkill")) {
+    if (skill->getId() != -1) {
+        if (Sanguosha->getSkillTraits(skill_id) & (Engine::EquipSkillTrait | Engine::GlobalSkillTrait))
+            return true;
+    } else {
+        if (skill->inherits("ArmorSkill") || skill->inherits("WeaponSkill") || skill->inherits("TreasureSkill"))
+            return true;
+
         const TriggerSkill *tr_skill = qobject_cast<const TriggerSkill *>(skill);
         if (tr_skill && tr_skill->isGlobal())
             return true;
@@ -1650,15 +1824,15 @@ bool Player::hasShownSkill(const Skill *skill) const
 
     if (!skill->isVisible()) {
         const Skill *main_skill = Sanguosha->getMainSkill(skill->objectName());
-        if (main_skill != NULL)
+        if (main_skill != NULL && main_skill != skill)
             return hasShownSkill(main_skill);
         else
             return false;
     }
 
-    if (general1_showed && head_skills.contains(skill->objectName()))
+    if (general1_showed && (state & HeadOwned))
         return true;
-    else if (general2_showed && deputy_skills.contains(skill->objectName()))
+    else if (general2_showed && (state & DeputyOwned))
         return true;
 
     const ViewHasSkill *vhskill = Sanguosha->ViewHas(this, skill->objectName(), "skill");
@@ -1666,10 +1840,11 @@ bool Player::hasShownSkill(const Skill *skill) const
         if (vhskill->isGlobal())                                                                //isGlobal do not need to show general
             return true;
         else {
-            if (ownSkill(vhskill)) {
-                if (general1_showed && head_skills.contains(vhskill->objectName()))
+            int vh_state = skillState(vhskill->getId());
+            if (vh_state & (HeadOwned | DeputyOwned)) {
+                if (general1_showed && (vh_state & HeadOwned))
                     return true;
-                else if (general2_showed && deputy_skills.contains(vhskill->objectName()))
+                else if (general2_showed && (vh_state & DeputyOwned))
                     return true;
             } else
                 return hasShownOneGeneral();                                                    //if player doesnt own it, then must showOneGeneral
@@ -1717,6 +1892,8 @@ void Player::preshowSkill(const QString &skill_name)
         head_skills[skill_name] = !head_skills.value(skill_name);
     if (deputy_skills.contains(skill_name))
         deputy_skills[skill_name] = !deputy_skills.value(skill_name);
+    updateSkillState(skill_name);
+    seat_epochs->touchDistances();
 }
 
 bool Player::inHeadSkills(const QString &skill_name) const
@@ -1730,7 +1907,7 @@ bool Player::inHeadSkills(const QString &skill_name) const
         if (main_skill != NULL)
             return inHeadSkills(main_skill->objectName());
     }
-    return head_skills.contains(skill_name) || head_acquired_skills.contains(skill_name);
+    return skillState(skill->getId()) & (HeadOwned | HeadAcquired);
 }
 
 bool Player::inHeadSkills(const Skill *skill) const
@@ -1752,7 +1929,7 @@ bool Player::inDeputySkills(const QString &skill_name) const
         if (main_skill != NULL)
             return inDeputySkills(main_skill->objectName());
     }
-    return deputy_skills.contains(skill_name) || deputy_acquired_skills.contains(skill_name);
+    return skillState(skill->getId()) & (DeputyOwned | DeputyAcquired);
 }
 
 bool Player::inDeputySkills(const Skill *skill) const
@@ -1792,11 +1969,13 @@ QString Player::getActualGeneral2Name() const
 void Player::setActualGeneral1(const General *general)
 {
     actual_general1 = general;
+    seat_epochs->touchDistances();
 }
 
 void Player::setActualGeneral2(const General *general)
 {
     actual_general2 = general;
+    seat_epochs->touchDistances();
 }
 
 void Player::setActualGeneral1Name(const QString &name)
@@ -1836,21 +2015,31 @@ bool Player::hasShownAllGenerals() const
 void Player::setGeneral1Showed(bool showed)
 {
     this->general1_showed = showed;
+    seat_epochs->touchDistances();
     emit head_state_changed();
 }
 
 void Player::setGeneral2Showed(bool showed)
 {
     this->general2_showed = showed;
+    seat_epochs->touchDistances();
     emit deputy_state_changed();
 }
 
+void Player::setScenarioRoleShown(bool show)
+{
+    scenario_role_shown = show;
+    seat_epochs->touchDistances();
+}
+
 void Player::setSkillPreshowed(const QString &skill, bool preshowed, bool head)
 {
     if (head && head_skills.contains(skill))
         head_skills[skill] = preshowed;
     else if (!head && deputy_skills.contains(skill))
         deputy_skills[skill] = preshowed;
+    updateSkillState(skill);
+    seat_epochs->touchDistances();
 }
 
 void Player::setSkillsPreshowed(const QString &flags, bool preshowed)
@@ -1867,14 +2056,13 @@ void Player::setSkillsPreshowed(const QString &flags, bool preshowed)
             deputy_skills[skill] = preshowed;
         }
     }
+    rebuildSkillStates();
+    seat_epochs->touchDistances();
 }
 
 bool Player::hasPreshowedSkill(const QString &name, bool head) const
 {
-    if (head)
-        return head_skills.value(name, false);
-    else
-        return deputy_skills.value(name, false);
+    return skillState(Sanguosha->getSkillId(name)) & (head ? HeadEnabled : DeputyEnabled);
 }
 
 bool Player::hasPreshowedSkill(const Skill *skill, bool head) const
@@ -1898,12 +2086,14 @@ bool Player::isHidden(const bool &head_general) const
 
 bool Player::ownSkill(const QString &skill_name) const
 {
-    return head_skills.contains(skill_name) || deputy_skills.contains(skill_name);
+    return skillState(Sanguosha->getSkillId(skill_name)) & (HeadOwned | DeputyOwned);
 }
 
 bool Player::ownSkill(const Skill *skill) const
 {
-    return ownSkill(skill->objectName());
+    if (skill->getId() == -1)
+        return ownSkill(skill->objectName());
+    return skillState(skill->getId()) & (HeadOwned | DeputyOwned);
 }
 
 bool Player::isFriendWith(const Player *player) const
@@ -1951,7 +2141,7 @@ bool Player::willBeFriendWith(const Player *player) const
             }
         }
 
-        if (!has_lord && i > (parent()->findChildren<const Player *>().length() / 2))
+        if (!has_lord && i > (seatRing()->players().length() / 2))
             return false;
         else if (kingdom == player->getKingdom())
             return true;
@@ -1961,20 +2151,20 @@ bool Player::willBeFriendWith(const Player *player) const
 
 void Player::setNext(Player *next)
 {
-    this->next = next->objectName();
+    setNext(next->objectName());
 }
 
 void Player::setNext(const QString &next)
 {
-    this->next = next;
+    if (this->next != next) {
+        this->next = next;
+        seat_epochs->touch();
+    }
 }
 
 Player *Player::getNext(bool ignoreRemoved) const
 {
-    Player *next_p = parent()->findChild<Player *>(next);
-    if (ignoreRemoved && next_p->isRemoved())
-        return next_p->getNext(ignoreRemoved);
-    return next_p;
+    return seatRing()->next(this, ignoreRemoved);
 }
 
 QString Player::getNextName() const
@@ -1984,23 +2174,12 @@ QString Player::getNextName() const
 
 Player *Player::getLast(bool ignoreRemoved) const
 {
-    foreach (Player *p, parent()->findChildren<Player *>()) {
-        if (p->getNext(ignoreRemoved) == this)
-            return p;
-    }
-    return NULL;
+    return seatRing()->last(this, ignoreRemoved);
 }
 
 Player *Player::getNextAlive(int n, bool ignoreRemoved) const
 {
-    bool hasAlive = (aliveCount(!ignoreRemoved) > 0);
-    Player *next = parent()->findChild<Player *>(objectName());
-    if (!hasAlive) return next;
-    for (int i = 0; i < n; ++i) {
-        do next = next->getNext(ignoreRemoved);
-        while (next->isDead());
-    }
-    return next;
+    return seatRing()->nextAlive(this, n, ignoreRemoved);
 }
 
 Player *Player::getLastAlive(int n, bool ignoreRemoved) const
@@ -2008,6 +2187,43 @@ Player *Player::getLastAlive(int n, bool ignoreRemoved) const
     return getNextAlive(aliveCount(!ignoreRemoved) - n, ignoreRemoved);
 }
 
+QSharedPointer<SeatRing> Player::seatRing() const
+{
+    if (seat_ring.isNull() || !seat_ring->isValidFor(parent())) {
+        QSharedPointer<SeatRing> ring(new SeatRing(parent(), seat_epochs));
+        foreach (Player *p, ring->players())
+            p->seat_ring = ring;
+        seat_ring = ring;
+    }
+    return seat_ring;
+}
+
+void Player::touchDistanceDependency(const QString &name) const
+{
+    if (Sanguosha->isDistanceDependency(name))
+        seat_epochs->touchDistances();
+}
+
+void Player::touchDistanceDependency(int atom) const
+{
+    if (Sanguosha->isDistanceDependency(atom))
+        seat_epochs->touchDistances();
+}
+
+bool Player::event(QEvent *event)
+{
+    // dynamic properties such as "invalid_skill_has" change what hasSkill() answers
+    if (event->type() == QEvent::DynamicPropertyChange) {
+        QByteArray name = static_cast<QDynamicPropertyChangeEvent *>(event)->propertyName();
+        if (name == "invalid_skill_has")
+            updateInvalidSkills("invalid_skill_has", InvalidHas);
+        else if (name == "invalid_skill_shown")
+            updateInvalidSkills("invalid_skill_shown", InvalidShown);
+        seat_epochs->touchDistances();
+    }
+    return QObject::event(event);
+}
+
 QList<const Player *> Player::getFormation() const
 {
     QList<const Player *> teammates;
@@ -24,9 +24,12 @@
 #include "general.h"
 #include "wrappedcard.h"
 #include "namespace.h"
+#include "atommap.h"
 
 #include <QObject>
 #include <QTcpSocket>
+#include <QSharedPointer>
+#include <QVector>
 
 class EquipCard;
 class Weapon;
@@ -35,6 +38,8 @@ class Horse;
 class DelayedTrick;
 class DistanceSkill;
 class TriggerSkill;
+class SeatRing;
+class SeatEpochs;
 
 class Player : public QObject
 {
@@ -155,6 +160,8 @@ public:
 
     int getAttackRange(bool include_weapon = true) const;
     bool inMyAttackRange(const Player *other) const;
+    QList<const Player *> getPlayersInAttackRange() const;
+    QList<const Player *> getPlayersWithinDistance(int distance) const;
 
     bool isAlive() const;
     bool isDead() const;
@@ -165,6 +172,9 @@ public:
     virtual void setFlags(const QString &flag);
     bool hasFlag(const QString &flag) const;
     void clearFlags();
+    // atom based variants, see Engine::getAtom(); -1 (no atom yet) is never set
+    bool hasFlag(int flag) const;
+    void setFlag(int flag, bool set = true);
 
     bool faceUp() const;
     void setFaceUp(bool face_up);
@@ -185,6 +195,7 @@ public:
     virtual void loseSkill(const QString &skill_name, bool head = true);
     bool hasSkill(const QString &skill_name, bool include_lose = false) const;
     bool hasSkill(const Skill *skill, bool include_lose = false) const;
+    bool hasSkillById(int skill_id, bool include_lose = false) const;
     bool hasSkills(const QString &skill_name, bool include_lose = false) const;
     bool hasInnateSkill(const QString &skill_name) const;
     bool hasLordSkill(const QString &skill_name, bool include_lose = false) const;
@@ -233,6 +244,7 @@ public:
     void removeMark(const QString &mark, int remove_num = 1);
     virtual void setMark(const QString &mark, int value);
     int getMark(const QString &mark) const;
+    int getMark(int mark) const;
 
     void setChained(bool chained);
     bool isChained() const;
@@ -264,6 +276,7 @@ public:
     void clearHistory(const QString &name = QString());
     bool hasUsed(const QString &card_class) const;
     int usedTimes(const QString &card_class) const;
+    int usedTimes(int card_class) const;
     int getSlashCount() const;
 
     bool hasEquipSkill(const QString &skill_name) const;
@@ -345,10 +358,7 @@ public:
     {
         return scenario_role_shown;
     }
-    inline void setScenarioRoleShown(bool show)
-    {
-        scenario_role_shown = show;
-    }
+    void setScenarioRoleShown(bool show);
 
     bool ownSkill(const QString &skill_name) const;
     bool ownSkill(const Skill *skill) const;
@@ -376,18 +386,48 @@ public:
     QVariantMap tag;
 
 protected:
-    QMap<QString, int> marks;
+    AtomMap marks;
     QMap<QString, QList<int> > piles;
     QMap<QString, QStringList> pile_open;
     QSet<QString> head_acquired_skills, deputy_acquired_skills;
     QMap<QString, bool> head_skills;
     QMap<QString, bool> deputy_skills;
-    QSet<QString> flags;
-    QHash<QString, int> history;
+
+    // the skill containers above and the invalid_skill_* properties, folded
+    // into one byte per skill, indexed by Engine::getSkillId()
+    enum SkillState
+    {
+        HeadOwned = 0x01,
+        DeputyOwned = 0x02,
+        HeadEnabled = 0x04,
+        DeputyEnabled = 0x08,
+        HeadAcquired = 0x10,
+        DeputyAcquired = 0x20,
+        InvalidHas = 0x40,
+        InvalidShown = 0x80
+    };
+    QVector<quint8> skill_state;
+    inline int skillState(int skill_id) const
+    {
+        return skill_id >= 0 && skill_id < skill_state.size() ? skill_state.at(skill_id) : 0;
+    }
+    void updateSkillState(const QString &skill_name);
+    void rebuildSkillStates();
+    void updateInvalidSkills(const char *property_name, quint8 flag);
+    AtomMap flags;
+    AtomMap history;
 
     const General *general, *general2;
     int headSkinId, deputySkinId;
 
+    // shared by all siblings and rebuilt lazily after a seat topology change
+    QSharedPointer<SeatRing> seatRing() const;
+    // moves the distance epoch if a distance or attack range skill reads this mark, flag or pile
+    void touchDistanceDependency(const QString &name) const;
+    void touchDistanceDependency(int atom) const;
+
+    virtual bool event(QEvent *event);
+
 private:
     QString screen_name;
     bool owner;
@@ -412,6 +452,10 @@ private:
     QList<int> judging_area;
     QHash<const Player *, int> fixed_distance;
     QString next;
+    SeatEpochs *seat_epochs; // of the room or client this player belongs to
+    mutable QSharedPointer<SeatRing> seat_ring;
+
+    int computeAttackRange(bool include_weapon) const;
 
     QMap<Card::HandlingMethod, QStringList> card_limitation;
 
@@ -21,13 +21,289 @@
 #include "protocol.h"
 #include "json.h"
 
+#include <QtEndian>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
 using namespace QSanProtocol;
 
 unsigned int QSanProtocol::Packet::globalSerialSequence = 0;
-const int QSanProtocol::Packet::S_MAX_PACKET_SIZE = 65535;
+// newline framing still stops at 64 KB, see NativeClientSocket::send
+const int QSanProtocol::Packet::S_MAX_PACKET_SIZE = 16 * 1024 * 1024;
 const char *QSanProtocol::S_PLAYER_SELF_REFERENCE_ID = "MG_SELF";
 
 const int QSanProtocol::S_ALL_ALIVE_PLAYERS = 0;
+const char QSanProtocol::S_BINARY_PACKET_MARKER = '\x01';
+
+namespace
+{
+    enum BinaryValueTag
+    {
+        S_BINARY_NULL,
+        S_BINARY_FALSE,
+        S_BINARY_TRUE,
+        S_BINARY_INT,
+        S_BINARY_DOUBLE,
+        S_BINARY_STRING,
+        S_BINARY_SYMBOL,
+        S_BINARY_PLAYER,
+        S_BINARY_LIST,
+        S_BINARY_MAP
+    };
+
+    // the binary packet still travels as a single line, so '\n' has to be escaped
+    const char S_BINARY_ESCAPE = '\x1b';
+    const char S_BINARY_ESCAPED_NEWLINE = 'n';
+    const int S_BINARY_MAX_DEPTH = 64;
+
+    void writeVarint(QByteArray &out, quint64 value)
+    {
+        while (value >= 0x80) {
+            out.append(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.append(static_cast<char>(value));
+    }
+
+    bool readVarint(const QByteArray &in, int &pos, quint64 &value)
+    {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (pos >= in.length())
+                return false;
+            uchar byte = static_cast<uchar>(in.at(pos++));
+            value |= quint64(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return true;
+        }
+        return false;
+    }
+
+    void writeInt(QByteArray &out, qint64 value)
+    {
+        out.append(static_cast<char>(S_BINARY_INT));
+        writeVarint(out, (quint64(value) << 1) ^ quint64(value >> 63));
+    }
+
+    // object names of players are "sgs" followed by a serial number, see Room::generatePlayerName
+    bool isPlayerName(const QString &str, quint64 &number)
+    {
+        if (str.length() < 4 || str.length() > 13 || !str.startsWith("sgs") || str.at(3) == QChar('0'))
+            return false;
+
+        number = 0;
+        for (int i = 3; i < str.length(); ++i) {
+            ushort c = str.at(i).unicode();
+            if (c < '0' || c > '9')
+                return false;
+            number = number * 10 + (c - '0');
+        }
+        return true;
+    }
+
+    void writeString(QByteArray &out, const QString &str, const PacketSymbolTable *symbols)
+    {
+        int index = symbols ? symbols->indexOf(str) : -1;
+        quint64 number = 0;
+        if (index >= 0) {
+            out.append(static_cast<char>(S_BINARY_SYMBOL));
+            writeVarint(out, index);
+        } else if (isPlayerName(str, number)) {
+            out.append(static_cast<char>(S_BINARY_PLAYER));
+            writeVarint(out, number);
+        } else {
+            const QByteArray utf8 = str.toUtf8();
+            out.append(static_cast<char>(S_BINARY_STRING));
+            writeVarint(out, utf8.length());
+            out.append(utf8);
+        }
+    }
+
+    void writeValue(QByteArray &out, const QVariant &value, const PacketSymbolTable *symbols)
+    {
+        switch (value.userType()) {
+        case QMetaType::UnknownType:
+            out.append(static_cast<char>(S_BINARY_NULL));
+            break;
+        case QMetaType::Bool:
+            out.append(static_cast<char>(value.toBool() ? S_BINARY_TRUE : S_BINARY_FALSE));
+            break;
+        case QMetaType::Int:
+        case QMetaType::UInt:
+        case QMetaType::LongLong:
+        case QMetaType::ULongLong:
+            writeInt(out, value.toLongLong());
+            break;
+        case QMetaType::Float:
+        case QMetaType::Double: {
+            // JSON does not tell integers from doubles, so whole numbers take the short form
+            double number = value.toDouble();
+            if (number >= -9007199254740992.0 && number <= 9007199254740992.0 && number == std::floor(number)) {
+                writeInt(out, static_cast<qint64>(number));
+            } else {
+                quint64 bits;
+                memcpy(&bits, &number, sizeof(bits));
+                char data[sizeof(bits)];
+                qToLittleEndian(bits, reinterpret_cast<uchar *>(data));
+                out.append(static_cast<char>(S_BINARY_DOUBLE));
+                out.append(data, sizeof(data));
+            }
+            break;
+        }
+        case QMetaType::QString:
+            writeString(out, value.toString(), symbols);
+            break;
+        case QMetaType::QStringList: {
+            const QStringList list = value.toStringList();
+            out.append(static_cast<char>(S_BINARY_LIST));
+            writeVarint(out, list.length());
+            foreach (const QString &str, list)
+                writeString(out, str, symbols);
+            break;
+        }
+        case QMetaType::QVariantList: {
+            const JsonArray list = value.value<JsonArray>();
+            out.append(static_cast<char>(S_BINARY_LIST));
+            writeVarint(out, list.length());
+            foreach (const QVariant &item, list)
+                writeValue(out, item, symbols);
+            break;
+        }
+        case QMetaType::QVariantMap: {
+            const JsonObject map = value.value<JsonObject>();
+            out.append(static_cast<char>(S_BINARY_MAP));
+            writeVarint(out, map.size());
+            for (JsonObject::const_iterator it = map.constBegin(); it != map.constEnd(); ++it) {
+                writeString(out, it.key(), symbols);
+                writeValue(out, it.value(), symbols);
+            }
+            break;
+        }
+        default:
+            if (value.canConvert<QString>())
+                writeString(out, value.toString(), symbols);
+            else
+                out.append(static_cast<char>(S_BINARY_NULL));
+        }
+    }
+
+    bool readValue(const QByteArray &in, int &pos, QVariant &value, const PacketSymbolTable *symbols, int depth)
+    {
+        if (pos >= in.length() || depth > S_BINARY_MAX_DEPTH)
+            return false;
+
+        quint64 number = 0;
+        switch (static_cast<uchar>(in.at(pos++))) {
+        case S_BINARY_NULL:
+            value = QVariant();
+            return true;
+        case S_BINARY_FALSE:
+            value = false;
+            return true;
+        case S_BINARY_TRUE:
+            value = true;
+            return true;
+        case S_BINARY_INT: {
+            if (!readVarint(in, pos, number))
+                return false;
+            qint64 integer = static_cast<qint64>(number >> 1) ^ -static_cast<qint64>(number & 1);
+            if (integer >= INT_MIN && integer <= INT_MAX)
+                value = static_cast<int>(integer);
+            else
+                value = static_cast<double>(integer);
+            return true;
+        }
+        case S_BINARY_DOUBLE: {
+            if (pos + 8 > in.length())
+                return false;
+            quint64 bits = qFromLittleEndian<quint64>(reinterpret_cast<const uchar *>(in.constData() + pos));
+            double real;
+            memcpy(&real, &bits, sizeof(real));
+            pos += 8;
+            value = real;
+            return true;
+        }
+        case S_BINARY_STRING: {
+            if (!readVarint(in, pos, number) || number > quint64(in.length() - pos))
+                return false;
+            value = QString::fromUtf8(in.constData() + pos, static_cast<int>(number));
+            pos += static_cast<int>(number);
+            return true;
+        }
+        case S_BINARY_SYMBOL:
+            if (symbols == NULL || !readVarint(in, pos, number) || number >= quint64(symbols->count()))
+                return false;
+            value = symbols->symbolAt(static_cast<int>(number));
+            return true;
+        case S_BINARY_PLAYER:
+            if (!readVarint(in, pos, number))
+                return false;
+            value = QString("sgs%1").arg(number);
+            return true;
+        case S_BINARY_LIST: {
+            if (!readVarint(in, pos, number) || number > quint64(in.length() - pos))
+                return false;
+            JsonArray list;
+            list.reserve(static_cast<int>(number));
+            for (quint64 i = 0; i < number; ++i) {
+                QVariant item;
+                if (!readValue(in, pos, item, symbols, depth + 1))
+                    return false;
+                list << item;
+            }
+            value = list;
+            return true;
+        }
+        case S_BINARY_MAP: {
+            if (!readVarint(in, pos, number) || number > quint64(in.length() - pos))
+                return false;
+            JsonObject map;
+            for (quint64 i = 0; i < number; ++i) {
+                QVariant key, item;
+                if (!readValue(in, pos, key, symbols, depth + 1) || !JsonUtils::isString(key)
+                    || !readValue(in, pos, item, symbols, depth + 1))
+                    return false;
+                map.insert(key.toString(), item);
+            }
+            value = map;
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+}
+
+void QSanProtocol::PacketSymbolTable::addSymbol(const QString &symbol)
+{
+    if (symbol.isEmpty() || index.contains(symbol))
+        return;
+
+    index.insert(symbol, symbols.length());
+    symbols << symbol;
+}
+
+bool QSanProtocol::PacketSymbolTable::tryParse(const QVariant &var)
+{
+    QStringList list;
+    if (!JsonUtils::tryParse(var, list))
+        return false;
+
+    // keep the indices of the sender even if it has sent a duplicate
+    symbols = list;
+    index.clear();
+    for (int i = 0; i < symbols.length(); ++i) {
+        if (!index.contains(symbols.at(i)))
+            index.insert(symbols.at(i), i);
+    }
+    return true;
+}
+
+QVariant QSanProtocol::PacketSymbolTable::toVariant() const
+{
+    return JsonUtils::toJsonArray(symbols);
+}
 
 bool QSanProtocol::Countdown::tryParse(const QVariant &var)
 {
@@ -122,14 +398,107 @@ QByteArray QSanProtocol::Packet::toJson() const
     JsonDocument doc(result);
     const QByteArray &msg = doc.toJson();
 
-    //return an empty string here, for Packet::parse won't parse it (line 92)
+    //return an empty string here, for Packet::parse won't parse it
     if (msg.length() > S_MAX_PACKET_SIZE)
         return QByteArray();
 
     return msg;
 }
 
+bool QSanProtocol::Packet::parseBinary(const QByteArray &raw, const PacketSymbolTable *symbols)
+{
+    if (!isBinary(raw))
+        return false;
+
+    int end = raw.length();
+    if (raw.endsWith('\n'))
+        --end;
+
+    QByteArray data;
+    data.reserve(end);
+    for (int i = 1; i < end; ++i) {
+        char c = raw.at(i);
+        if (c == S_BINARY_ESCAPE) {
+            if (++i >= end)
+                return false;
+            c = raw.at(i);
+            if (c == S_BINARY_ESCAPED_NEWLINE)
+                c = '\n';
+            else if (c != S_BINARY_ESCAPE)
+                return false;
+        }
+        data.append(c);
+    }
+
+    int pos = 0;
+    quint64 header[4];
+    for (int i = 0; i < 4; ++i) {
+        if (!readVarint(data, pos, header[i]))
+            return false;
+    }
+
+    QVariant body;
+    if (pos < data.length() && (!readValue(data, pos, body, symbols, 0) || pos != data.length()))
+        return false;
+
+    globalSerial = static_cast<unsigned int>(header[0]);
+    localSerial = static_cast<unsigned int>(header[1]);
+    packetDescription = static_cast<PacketDescription>(header[2]);
+    command = static_cast<CommandType>(header[3]);
+    messageBody = body;
+    return true;
+}
+
+QByteArray QSanProtocol::Packet::toBinary(const PacketSymbolTable *symbols) const
+{
+    QByteArray data;
+    writeVarint(data, globalSerial);
+    writeVarint(data, localSerial);
+    writeVarint(data, packetDescription);
+    writeVarint(data, command);
+    if (!messageBody.isNull())
+        writeValue(data, messageBody, symbols);
+
+    QByteArray msg;
+    msg.reserve(data.length() + data.length() / 16 + 1);
+    msg.append(S_BINARY_PACKET_MARKER);
+    foreach (char c, data) {
+        if (c == '\n') {
+            msg.append(S_BINARY_ESCAPE);
+            msg.append(S_BINARY_ESCAPED_NEWLINE);
+        } else {
+            if (c == S_BINARY_ESCAPE)
+                msg.append(S_BINARY_ESCAPE);
+            msg.append(c);
+        }
+    }
+    return msg;
+}
+
 QString QSanProtocol::Packet::toString() const
 {
     return QString::fromUtf8(toJson());
 }
+
+QSanProtocol::SerializedPacket::SerializedPacket(const AbstractPacket *packet)
+    : packet(packet), hasJson(false), binarySymbols(NULL)
+{
+}
+
+const QByteArray &QSanProtocol::SerializedPacket::toJson()
+{
+    if (!hasJson) {
+        json = packet->toJson();
+        hasJson = true;
+    }
+    return json;
+}
+
+const QByteArray &QSanProtocol::SerializedPacket::toBinary(const PacketSymbolTable *symbols)
+{
+    if (binary.isEmpty() || binarySymbols != symbols) {
+        binary = packet->toBinary(symbols);
+        binarySymbols = symbols;
+    }
+    return binary;
+}
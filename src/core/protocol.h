@@ -23,6 +23,8 @@
 
 #include <QByteArray>
 #include <QVariant>
+#include <QStringList>
+#include <QHash>
 
 namespace QSanProtocol
 {
@@ -166,7 +168,8 @@ namespace QSanProtocol
         S_COMMAND_MIRROR_MOVECARDS_STEP,
         S_COMMAND_SET_VISIBLE_CARDS,
         S_COMMAND_SET_ACTULGENERAL,
-        S_COMMAND_GLOBAL_CHOOSECARD
+        S_COMMAND_GLOBAL_CHOOSECARD,
+        S_COMMAND_SETUP_SYMBOLS
     };
 
     enum GameEventType
@@ -227,6 +230,35 @@ namespace QSanProtocol
 
     extern const int S_ALL_ALIVE_PLAYERS;
 
+    // first byte of a packet in the compact binary encoding, never a valid start of a JSON text
+    extern const char S_BINARY_PACKET_MARKER;
+
+    // strings that are sent by index once the binary encoding has been negotiated.
+    // The server sends the whole table with S_COMMAND_SETUP_SYMBOLS right after signup.
+    class PacketSymbolTable
+    {
+    public:
+        void addSymbol(const QString &symbol);
+        inline int indexOf(const QString &symbol) const
+        {
+            return index.value(symbol, -1);
+        }
+        inline QString symbolAt(int i) const
+        {
+            return symbols.value(i);
+        }
+        inline int count() const
+        {
+            return symbols.length();
+        }
+        bool tryParse(const QVariant &var);
+        QVariant toVariant() const;
+
+    private:
+        QStringList symbols;
+        QHash<QString, int> index;
+    };
+
     class Countdown
     {
     public:
@@ -259,6 +291,7 @@ namespace QSanProtocol
     public:
         virtual bool parse(const QByteArray &) = 0;
         virtual QByteArray toJson() const = 0;
+        virtual QByteArray toBinary(const PacketSymbolTable *symbols) const = 0;
         virtual QString toString() const = 0;
         virtual PacketDescription getPacketDestination() const = 0;
         virtual PacketDescription getPacketSource() const = 0;
@@ -286,6 +319,13 @@ namespace QSanProtocol
         }
         virtual bool parse(const QByteArray &raw);
         virtual QByteArray toJson() const;
+        // binary encoding, escaped so that it still fits into one newline-terminated line
+        bool parseBinary(const QByteArray &raw, const PacketSymbolTable *symbols);
+        virtual QByteArray toBinary(const PacketSymbolTable *symbols) const;
+        static inline bool isBinary(const QByteArray &raw)
+        {
+            return !raw.isEmpty() && raw.at(0) == S_BINARY_PACKET_MARKER;
+        }
         virtual QString toString() const;
         virtual PacketDescription getPacketDestination() const
         {
@@ -317,7 +357,26 @@ namespace QSanProtocol
         //helper functions
         static const int S_MAX_PACKET_SIZE;
     };
+
+    // encodes a packet at most once per encoding, so that everyone receiving the same
+    // broadcast shares one (implicitly shared) buffer
+    class SerializedPacket
+    {
+    public:
+        explicit SerializedPacket(const AbstractPacket *packet);
+        const QByteArray &toJson();
+        const QByteArray &toBinary(const PacketSymbolTable *symbols);
+
+    private:
+        const AbstractPacket *packet;
+        QByteArray json;
+        QByteArray binary;
+        bool hasJson;
+        const PacketSymbolTable *binarySymbols;
+    };
 }
 
+Q_DECLARE_METATYPE(QSanProtocol::Packet)
+
 #endif
 
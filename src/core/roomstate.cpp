@@ -22,42 +22,68 @@
 #include "engine.h"
 #include "wrappedcard.h"
 
+QAtomicInt RoomState::liveTransientCards;
+
 RoomState::~RoomState()
 {
-    foreach (WrappedCard *card, m_cards) {
-        delete card;
-    }
+    releaseTransientCards();
+    qDeleteAll(m_cards);
     m_cards.clear();
 }
 
 Card *RoomState::getCard(int cardId) const
 {
-    if (!m_cards.contains(cardId))
+    if (cardId < 0 || cardId >= m_cards.size())
         return NULL;
-    return m_cards[cardId];
+    return m_cards.at(cardId);
 }
 
 void RoomState::resetCard(int cardId)
 {
+    if (cardId < 0 || cardId >= m_cards.size()) return;
     Card *newCard = Card::Clone(Sanguosha->getEngineCard(cardId));
     if (newCard == NULL) return;
-    newCard->setFlags(m_cards[cardId]->getFlags());
-    m_cards[cardId]->copyEverythingFrom(newCard);
+    WrappedCard *card = m_cards.at(cardId);
+    newCard->setFlags(card->getFlags());
+    card->copyEverythingFrom(newCard);
     newCard->clearFlags();
-    m_cards[cardId]->setModified(false);
+    card->setModified(false);
+}
+
+void RoomState::addTransientCard(Card *card)
+{
+    m_transientCards << card;
+    m_transientCardPeak = qMax(m_transientCardPeak, m_transientCards.length());
+    liveTransientCards.ref();
+}
+
+void RoomState::releaseTransientCards()
+{
+    if (m_transientCards.isEmpty())
+        return;
+
+    liveTransientCards.fetchAndAddRelaxed(-m_transientCards.length());
+    QList<QPointer<Card> > cards = m_transientCards;
+    m_transientCards.clear();
+    foreach (const QPointer<Card> &card, cards)
+        delete card.data();
+}
+
+int RoomState::getLiveTransientCardCount()
+{
+    return liveTransientCards.load();
 }
 
 // Reset all cards, generals' states of the room instance
 void RoomState::reset()
 {
-    foreach (WrappedCard *card, m_cards) {
-        delete card;
-    }
+    qDeleteAll(m_cards);
     m_cards.clear();
 
     int n = Sanguosha->getCardCount();
+    m_cards.reserve(n);
     for (int i = 0; i < n; i++) {
         Card *newCard = Card::Clone(Sanguosha->getEngineCard(i));
-        m_cards[i] = new WrappedCard(newCard);
+        m_cards << new WrappedCard(newCard);
     }
 }
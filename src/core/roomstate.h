@@ -24,6 +24,10 @@
 #include "player.h"
 #include "structs.h"
 #include "wrappedcard.h"
+#include "seatring.h"
+
+#include <QPointer>
+#include <QAtomicInt>
 
 // RoomState is a singleton that stores virtual generals, cards (versus factory loaded
 // generals, cards in the Engine). Each room or roomscene should have one and only one
@@ -36,6 +40,7 @@ public:
     inline RoomState(bool isClient)
     {
         m_isClient = isClient;
+        m_transientCardPeak = 0;
     }
     ~RoomState();
     inline bool isClient() const
@@ -88,13 +93,45 @@ public:
     // Reset all cards, generals' states of the room instance
     void reset();
 
+    // Transient cards (parsed cards, dummies, scratch virtual cards) of a server
+    // room, see Engine::autoReleaseCard(). A room thread runs no event loop, so
+    // deleteLater() would keep them alive until the game is over; instead the
+    // room thread releases them in bulk once a turn is over.
+    void addTransientCard(Card *card);
+    void releaseTransientCards();
+    inline int getTransientCardCount() const
+    {
+        return m_transientCards.length();
+    }
+    inline int getTransientCardPeak() const
+    {
+        return m_transientCardPeak;
+    }
+    // transient cards held by all the rooms of this process
+    static int getLiveTransientCardCount();
+
+    // the seat epochs of the players of this room, see SeatRing
+    inline SeatEpochs *getSeatEpochs()
+    {
+        return &m_seatEpochs;
+    }
+    inline const SeatEpochs *getSeatEpochs() const
+    {
+        return &m_seatEpochs;
+    }
+
 protected:
-    QHash<int, WrappedCard *> m_cards;
+    QVector<WrappedCard *> m_cards; // indexed by card id
     bool m_isClient;
     Player *m_currentPlayer;
     QString m_currentCardUsePattern;
     CardUseStruct::CardUseReason m_currentCardUseReason;
     QString m_currentCardResponsePrompt;
+    // cards may still be deleted by their users, so they are guarded
+    QList<QPointer<Card> > m_transientCards;
+    int m_transientCardPeak;
+    SeatEpochs m_seatEpochs;
+    static QAtomicInt liveTransientCards;
 };
 
 #endif
@@ -0,0 +1,269 @@
+/********************************************************************
+    Copyright (c) 2013-2015 - Mogara
+
+    This file is part of QSanguosha-Hegemony.
+
+    This game is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 3.0
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    See the LICENSE file for more details.
+
+    Mogara
+    *********************************************************************/
+
+#include "seatring.h"
+#include "player.h"
+
+void SeatEpochs::touch()
+{
+    m_topology.ref();
+    m_distances.ref();
+}
+
+SeatEpochs *SeatEpochs::detached()
+{
+    static SeatEpochs epochs;
+    return &epochs;
+}
+
+SeatRing::SeatRing(const QObject *owner, const SeatEpochs *epochs)
+    : m_owner(owner), m_epochs(epochs), m_childCount(0),
+    m_epoch(epochs->topology()), m_distanceEpoch(epochs->distances())
+{
+    m_aliveCount[0] = m_aliveCount[1] = 0;
+    if (owner == NULL)
+        return;
+
+    const QObjectList &children = owner->children();
+    m_childCount = children.length();
+    foreach (QObject *child, children) {
+        Player *player = qobject_cast<Player *>(child);
+        if (player)
+            m_players << player;
+    }
+
+    const int n = m_players.length();
+    m_alive.resize(n);
+    m_removed.resize(n);
+    m_next[0].resize(n);
+    for (int i = 0; i < n; ++i) {
+        const Player *player = m_players.at(i);
+        m_alive[i] = player->isAlive();
+        m_removed[i] = player->isRemoved();
+        m_next[0][i] = resolve(player->getNextName());
+    }
+
+    // skipping removed players never lands on a removed one unless all of them are
+    m_next[1] = m_next[0];
+    for (int i = 0; i < n; ++i) {
+        int j = m_next[0][i];
+        for (int steps = 0; j != -1 && m_removed[j] && steps < n; ++steps)
+            j = m_next[0][j];
+        if (j != -1 && !m_removed[j])
+            m_next[1][i] = j;
+    }
+
+    for (int r = 0; r < 2; ++r) {
+        m_last[r].fill(-1, n);
+        m_nextAlive[r].fill(-1, n);
+        m_cyclePos[r].fill(-1, n);
+
+        for (int i = 0; i < n; ++i) {
+            int j = m_next[r][i];
+            if (j != -1 && m_last[r][j] == -1)
+                m_last[r][j] = i;
+
+            for (int steps = 0; j != -1 && !m_alive[j] && steps < n; ++steps)
+                j = m_next[r][j];
+            if (j != -1 && m_alive[j])
+                m_nextAlive[r][i] = j;
+
+            if (m_alive[i] && (r == 0 || !m_removed[i]))
+                ++m_aliveCount[r];
+        }
+
+        int start = -1;
+        for (int i = 0; i < n && start == -1; ++i) {
+            if (m_alive[i] && (r == 0 || !m_removed[i]))
+                start = i;
+        }
+        if (start == -1)
+            continue;
+
+        int j = start;
+        do {
+            m_cyclePos[r][j] = m_cycle[r].size();
+            m_cycle[r] << j;
+            j = m_nextAlive[r][j];
+        } while (j != -1 && m_cyclePos[r][j] == -1);
+
+        // only trust positions when the links form one closed ring of the counted players
+        if (j != start || m_cycle[r].size() != m_aliveCount[r]) {
+            m_cycle[r].clear();
+            m_cyclePos[r].fill(-1);
+        }
+    }
+
+    m_distances.fill(Unknown, n * n);
+    m_attackRanges.fill(Unknown, n * 2);
+}
+
+bool SeatRing::isValidFor(const QObject *owner) const
+{
+    // a new player touches the epoch, so a deleted one is all the count has to catch
+    if (m_owner != owner || m_epoch != m_epochs->topology())
+        return false;
+    return owner == NULL || m_childCount == owner->children().length();
+}
+
+int SeatRing::indexOf(const Player *player) const
+{
+    return m_players.indexOf(const_cast<Player *>(player));
+}
+
+int SeatRing::aliveCount(bool includeRemoved) const
+{
+    return m_aliveCount[includeRemoved ? 0 : 1];
+}
+
+int SeatRing::resolve(const QString &name) const
+{
+    // an empty name matches any child, just like QObject::findChild()
+    if (name.isEmpty())
+        return m_players.isEmpty() ? -1 : 0;
+
+    for (int i = 0; i < m_players.length(); ++i) {
+        if (m_players.at(i)->objectName() == name)
+            return i;
+    }
+    return -1;
+}
+
+Player *SeatRing::next(const Player *player, bool ignoreRemoved) const
+{
+    int i = indexOf(player);
+    if (i == -1)
+        return NULL;
+    int j = m_next[ignoreRemoved ? 1 : 0].at(i);
+    return j == -1 ? NULL : m_players.at(j);
+}
+
+Player *SeatRing::last(const Player *player, bool ignoreRemoved) const
+{
+    int i = indexOf(player);
+    if (i == -1)
+        return NULL;
+    int j = m_last[ignoreRemoved ? 1 : 0].at(i);
+    return j == -1 ? NULL : m_players.at(j);
+}
+
+Player *SeatRing::nextAlive(const Player *player, int n, bool ignoreRemoved) const
+{
+    int i = indexOf(player);
+    if (i == -1)
+        return NULL;
+
+    const int r = ignoreRemoved ? 1 : 0;
+    if (m_aliveCount[r] == 0 || n <= 0)
+        return m_players.at(i);
+
+    const QVector<int> &cycle = m_cycle[r];
+    int pos = m_cyclePos[r].at(i);
+    if (pos != -1)
+        return m_players.at(cycle.at((pos + n) % cycle.size()));
+
+    for (int k = 0; k < n; ++k) {
+        i = m_nextAlive[r].at(i);
+        if (i == -1)
+            return NULL;
+    }
+    return m_players.at(i);
+}
+
+int SeatRing::rightDistance(const Player *from, const Player *to) const
+{
+    int i = indexOf(from);
+    int j = indexOf(to);
+    if (i == -1 || j == -1)
+        return 0;
+
+    const QVector<int> &cycle = m_cycle[1];
+    int a = m_cyclePos[1].at(i);
+    int b = m_cyclePos[1].at(j);
+    if (a != -1 && b != -1)
+        return (b - a + cycle.size()) % cycle.size();
+
+    int right = 0;
+    while (i != j && right < m_players.length()) {
+        i = m_nextAlive[1].at(i);
+        if (i == -1)
+            break;
+        ++right;
+    }
+    return right;
+}
+
+QList<const Player *> SeatRing::siblings(const Player *player, bool aliveOnly) const
+{
+    QList<const Player *> siblings;
+    for (int i = 0; i < m_players.length(); ++i) {
+        const Player *p = m_players.at(i);
+        if (p != player && (!aliveOnly || m_alive.at(i)))
+            siblings << p;
+    }
+    return siblings;
+}
+
+void SeatRing::syncDistances() const
+{
+    int current = m_epochs->distances();
+    if (m_distanceEpoch != current) {
+        m_distanceEpoch = current;
+        m_distances.fill(Unknown);
+        m_attackRanges.fill(Unknown);
+    }
+}
+
+int SeatRing::cachedDistance(const Player *from, const Player *to) const
+{
+    int i = indexOf(from);
+    int j = indexOf(to);
+    if (i == -1 || j == -1)
+        return Unknown;
+    syncDistances();
+    return m_distances.at(i * m_players.length() + j);
+}
+
+void SeatRing::cacheDistance(const Player *from, const Player *to, int distance) const
+{
+    int i = indexOf(from);
+    int j = indexOf(to);
+    // a value computed across an epoch change is stale already
+    if (i == -1 || j == -1 || m_distanceEpoch != m_epochs->distances())
+        return;
+    m_distances[i * m_players.length() + j] = distance;
+}
+
+int SeatRing::cachedAttackRange(const Player *player, bool includeWeapon) const
+{
+    int i = indexOf(player);
+    if (i == -1)
+        return Unknown;
+    syncDistances();
+    return m_attackRanges.at(i * 2 + (includeWeapon ? 1 : 0));
+}
+
+void SeatRing::cacheAttackRange(const Player *player, bool includeWeapon, int range) const
+{
+    int i = indexOf(player);
+    if (i == -1 || m_distanceEpoch != m_epochs->distances())
+        return;
+    m_attackRanges[i * 2 + (includeWeapon ? 1 : 0)] = range;
+}
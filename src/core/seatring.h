@@ -0,0 +1,137 @@
+/********************************************************************
+    Copyright (c) 2013-2015 - Mogara
+
+    This file is part of QSanguosha-Hegemony.
+
+    This game is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 3.0
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    See the LICENSE file for more details.
+
+    Mogara
+    *********************************************************************/
+
+#ifndef _SEATRING_H
+#define _SEATRING_H
+
+#include <QObject>
+#include <QList>
+#include <QVector>
+#include <QAtomicInt>
+
+class Player;
+
+// The topology and distance epochs of one owner (a room or the client).
+// Every owner keeps its own, so that a death or an equip change in one room
+// does not make the other rooms of the process drop their rings or their
+// cached distances.
+class SeatEpochs
+{
+public:
+    void touch();
+    inline void touchDistances()
+    {
+        m_distances.ref();
+    }
+    inline int topology() const
+    {
+        return m_topology.load();
+    }
+    inline int distances() const
+    {
+        return m_distances.load();
+    }
+
+    // for the players that belong to neither a room nor the client
+    static SeatEpochs *detached();
+
+private:
+    QAtomicInt m_topology;
+    QAtomicInt m_distances;
+};
+
+// Seat topology of the players sharing one parent (a room or the client).
+// The players are kept in contiguous arrays together with their alive and
+// removed masks, and every "next" / "last" / "next alive" link is resolved
+// once, so that distance and seat queries no longer walk the object tree.
+//
+// A ring is only rebuilt when the topology epoch of its owner moves, which
+// happens when a player dies, revives, is removed or restored, or changes
+// seat, or when a player is created under the owner, or when the number of
+// children of the owner changes.
+//
+// The ring also carries the lazily filled distance / attack range matrix of
+// its players. It is dropped whenever the distance epoch of the owner moves:
+// on every topology change, and on any change to equips, skills, generals,
+// kingdoms or dynamic properties, as well as to the marks, flags and piles
+// the distance and attack range skills declare they depend on.
+class SeatRing
+{
+public:
+    enum
+    {
+        Unknown = -0x7fffffff
+    };
+
+    SeatRing(const QObject *owner, const SeatEpochs *epochs);
+
+    bool isValidFor(const QObject *owner) const;
+
+    inline const QList<Player *> &players() const
+    {
+        return m_players;
+    }
+
+    int indexOf(const Player *player) const;
+    int aliveCount(bool includeRemoved) const;
+
+    Player *next(const Player *player, bool ignoreRemoved) const;
+    Player *last(const Player *player, bool ignoreRemoved) const;
+    Player *nextAlive(const Player *player, int n, bool ignoreRemoved) const;
+    int rightDistance(const Player *from, const Player *to) const;
+
+    QList<const Player *> siblings(const Player *player, bool aliveOnly) const;
+
+    // base distances before the per-query fix, and attack ranges; Unknown if not cached
+    int cachedDistance(const Player *from, const Player *to) const;
+    void cacheDistance(const Player *from, const Player *to, int distance) const;
+    int cachedAttackRange(const Player *player, bool includeWeapon) const;
+    void cacheAttackRange(const Player *player, bool includeWeapon, int range) const;
+
+private:
+    int resolve(const QString &name) const;
+    void syncDistances() const;
+
+    const QObject *m_owner;
+    const SeatEpochs *m_epochs;
+    int m_childCount;
+    int m_epoch;
+
+    QList<Player *> m_players;
+    QVector<bool> m_alive;
+    QVector<bool> m_removed;
+
+    // indexed by [ignoreRemoved][player index], -1 if unresolved
+    QVector<int> m_next[2];
+    QVector<int> m_last[2];
+    QVector<int> m_nextAlive[2];
+
+    // alive players in seat order starting from the first counted one,
+    // and each player's position in that cycle (-1 if not on it)
+    QVector<int> m_cycle[2];
+    QVector<int> m_cyclePos[2];
+    int m_aliveCount[2]; // [ignoreRemoved]
+
+    mutable int m_distanceEpoch;
+    mutable QVector<int> m_distances; // [from * n + to]
+    mutable QVector<int> m_attackRanges; // [index * 2 + includeWeapon]
+};
+
+#endif
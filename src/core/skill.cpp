@@ -30,9 +30,11 @@
 
 #include <QFile>
 #include <QDir>
+#include <QAtomicInt>
 
 Skill::Skill(const QString &name, Frequency frequency)
-    : frequency(frequency), limit_mark(QString()), relate_to_place(QString()), attached_lord_skill(false)
+    : frequency(frequency), limit_mark(QString()), relate_to_place(QString()), attached_lord_skill(false),
+    skill_id(-1)
 {
     static QChar lord_symbol('$');
 
@@ -452,8 +454,93 @@ double TriggerSkill::getDynamicPriority(TriggerEvent e) const
     If you use this kind of type, it means the skill's trigger order of targets should be according to the order you write, such as: "tieqi->sgs4+sgs8+sgs1+sgs2"
     \note must use a "->" to concatenate skill name to targets and "+" to concatenate targets' object names
     \endlist
+    TriggerSkill::triggerRecords decodes every item into a TriggerRecord, C++ skills with targets override it instead.
     */
 
+TriggerRecord::TriggerRecord(const TriggerSkill *skill)
+    : skill(skill)
+{
+}
+
+TriggerRecord::TriggerRecord(const TriggerSkill *skill, const QList<ServerPlayer *> &targets)
+    : skill(skill)
+{
+    foreach (ServerPlayer *target, targets)
+        this->targets << target->objectName();
+}
+
+TriggerRecord::TriggerRecord(const QString &str)
+    : skill(Sanguosha->getTriggerSkill(str)) // "yiji"
+{
+    if (skill != NULL)
+        return;
+
+    int split = str.indexOf('\'');
+    if (split != -1) { // "sgs1'songwei"
+        skill = Sanguosha->getTriggerSkill(str.mid(str.lastIndexOf('\'') + 1));
+        if (skill != NULL) {
+            owner = str.left(split);
+            return;
+        }
+    }
+
+    split = str.indexOf("->");
+    if (split != -1) { // "tieqi->sgs4+sgs8+sgs1+sgs2" or "left?tieqi->sgs4"
+        QString skill_name = str.left(split);
+        int question = skill_name.indexOf('?');
+        skill = Sanguosha->getTriggerSkill(skill_name.mid(question + 1));
+        if (skill != NULL) {
+            if (question != -1)
+                position = skill_name.left(question);
+            targets = str.mid(split + 2).split("+");
+        }
+    }
+}
+
+QString TriggerRecord::toString() const
+{
+    if (skill == NULL)
+        return QString();
+    if (!targets.isEmpty()) {
+        if (!position.isEmpty())
+            return QString("%1?%2->%3").arg(position).arg(skill->objectName()).arg(targets.join("+"));
+        return QString("%1->%2").arg(skill->objectName()).arg(targets.join("+"));
+    }
+    if (!owner.isEmpty())
+        return QString("%1'%2").arg(owner).arg(skill->objectName());
+    return skill->objectName();
+}
+
+TriggerRecordMap TriggerSkill::triggerRecords(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+{
+    TriggerRecordMap records;
+    TriggerList list = triggerable(triggerEvent, room, player, data);
+    TriggerList::const_iterator it;
+    for (it = list.constBegin(); it != list.constEnd(); ++it) {
+        foreach (const QString &skill_name, it.value()) {
+            // the skill itself needs no decoding
+            TriggerRecord record = skill_name == objectName() ? TriggerRecord(this) : TriggerRecord(skill_name);
+            if (record.isValid())
+                records[it.key()] << record;
+        }
+    }
+    return records;
+}
+
+TriggerList TriggerSkill::encodeTriggerRecords(const TriggerRecordMap &records)
+{
+    TriggerList list;
+    TriggerRecordMap::const_iterator it;
+    for (it = records.constBegin(); it != records.constEnd(); ++it) {
+        QStringList skill_list;
+        foreach (const TriggerRecord &record, it.value())
+            skill_list << record.toString();
+        if (!skill_list.isEmpty())
+            list.insert(it.key(), skill_list);
+    }
+    return list;
+}
+
 TriggerList TriggerSkill::triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
 {
     TriggerList skill_lists;
@@ -470,9 +557,17 @@ bool TriggerSkill::triggerable(const ServerPlayer *target) const
     return target != NULL && target->isAlive() && target->hasSkill(objectName());
 }
 
+static QAtomicInt TriggerSkillPriorityGeneration;
+
 void TriggerSkill::insertPriority(TriggerEvent e, double value)
 {
     priority.insert(e, value);
+    TriggerSkillPriorityGeneration.ref();
+}
+
+int TriggerSkill::getPriorityGeneration()
+{
+    return TriggerSkillPriorityGeneration.load();
 }
 
 void TriggerSkill::record(TriggerEvent, Room *, ServerPlayer *, QVariant &) const
@@ -674,7 +769,7 @@ ProhibitSkill::ProhibitSkill(const QString &name)
 }
 
 DistanceSkill::DistanceSkill(const QString &name)
-    : Skill(name, Skill::Compulsory)
+    : Skill(name, Skill::Compulsory), cacheable(true)
 {
     view_as_skill = new ShowDistanceSkill(objectName());
 }
@@ -684,6 +779,22 @@ const ViewAsSkill *DistanceSkill::getViewAsSkill() const
     return view_as_skill;
 }
 
+QStringList DistanceSkill::getDependencies() const
+{
+    return dependencies;
+}
+
+void DistanceSkill::setDependencies(const QString &names)
+{
+    dependencies = names.split("|", QString::SkipEmptyParts);
+    cacheable = true;
+}
+
+bool DistanceSkill::isCacheable() const
+{
+    return cacheable;
+}
+
 ShowDistanceSkill::ShowDistanceSkill(const QString &name)
     : ZeroCardViewAsSkill(name)
 {
@@ -749,9 +860,25 @@ int SlashNoDistanceLimitSkill::getDistanceLimit(const Player *from, const Card *
         return 0;
 }
 
-AttackRangeSkill::AttackRangeSkill(const QString &name) : Skill(name, Skill::Compulsory)
+AttackRangeSkill::AttackRangeSkill(const QString &name)
+    : Skill(name, Skill::Compulsory), cacheable(true)
 {
+}
 
+QStringList AttackRangeSkill::getDependencies() const
+{
+    return dependencies;
+}
+
+void AttackRangeSkill::setDependencies(const QString &names)
+{
+    dependencies = names.split("|", QString::SkipEmptyParts);
+    cacheable = true;
+}
+
+bool AttackRangeSkill::isCacheable() const
+{
+    return cacheable;
 }
 
 int AttackRangeSkill::getExtra(const Player *, bool) const
@@ -934,6 +1061,6 @@ FixCardSkill::FixCardSkill(const QString &name)
 }
 
 ViewHasSkill::ViewHasSkill(const QString &name)
-    : Skill(name, Skill::Compulsory), global(false)
+    : Skill(name, Skill::Compulsory), global(false), viewhas_any(false)
 {
 }
@@ -70,6 +70,12 @@ public:
     virtual bool canPreshow() const;
     virtual bool relateToPlace(bool head = true) const;
 
+    // assigned by Engine::addSkills(), -1 for a skill the engine does not know
+    inline int getId() const
+    {
+        return skill_id;
+    }
+
     //for LUA
     inline void setRelateToPlace(const char *rtp)
     {
@@ -83,9 +89,12 @@ protected:
     bool attached_lord_skill;
 
 private:
+    friend class Engine;
+
     bool lord_skill;
     QStringList sources;
     mutable QHash<const QString, QStringList> skinSourceHash;
+    int skill_id;
 };
 
 class ViewAsSkill : public Skill
@@ -162,6 +171,31 @@ public:
 
 typedef QMap<ServerPlayer *, QStringList> TriggerList;
 
+class TriggerSkill;
+class ServerPlayer;
+
+// a skill which can be triggered, with the targets it is triggered for in order, see TriggerSkill::triggerRecords
+struct TriggerRecord
+{
+    explicit TriggerRecord(const TriggerSkill *skill = NULL);
+    TriggerRecord(const TriggerSkill *skill, const QList<ServerPlayer *> &targets);
+    // decodes an item of TriggerList, see TriggerSkill::triggerable for the string forms
+    explicit TriggerRecord(const QString &str);
+
+    inline bool isValid() const
+    {
+        return skill != NULL;
+    }
+    QString toString() const;
+
+    const TriggerSkill *skill;
+    QString owner;          // "sgs1" of "sgs1'songwei"
+    QStringList targets;    // ["sgs4", "sgs8"] of "tieqi->sgs4+sgs8"
+    QString position;       // "left" of "left?tieqi->sgs4"
+};
+
+typedef QMap<ServerPlayer *, QList<TriggerRecord> > TriggerRecordMap;
+
 class TriggerSkill : public Skill
 {
     Q_OBJECT
@@ -183,12 +217,18 @@ public:
     //     }
 
     void insertPriority(TriggerEvent e, double value);
+    // changes whenever any dynamic priority is inserted, so cached trigger orders know when to be rebuilt
+    static int getPriorityGeneration();
 
     virtual bool triggerable(const ServerPlayer *target) const;
 
     virtual void record(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const;
 
     virtual QString getGuhuoBox() const;
+    // what RoomThread triggers from, skills with targets return their records directly by overriding it.
+    // By default it decodes triggerable(), whose string forms are kept for Lua skills. A skill that
+    // overrides it overrides triggerable() as well, by encoding its records, see encodeTriggerRecords()
+    virtual TriggerRecordMap triggerRecords(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const;
     virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const;
     virtual QStringList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data, ServerPlayer* &ask_who) const;
     virtual bool cost(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data, ServerPlayer *ask_who = NULL) const;
@@ -202,6 +242,9 @@ public:
     virtual ~TriggerSkill();
 
 protected:
+    // the string forms of triggerable() for the records of triggerRecords()
+    static TriggerList encodeTriggerRecords(const TriggerRecordMap &records);
+
     const ViewAsSkill *view_as_skill;
     QList<TriggerEvent> events;
     bool global;
@@ -321,8 +364,16 @@ public:
     virtual int getCorrect(const Player *from, const Player *to) const = 0;
     const ViewAsSkill *getViewAsSkill() const;
 
+    // marks, flags and piles getCorrect() reads, besides the equips, skills,
+    // generals and seats that always invalidate the cached distances
+    QStringList getDependencies() const;
+    void setDependencies(const QString &names);
+    bool isCacheable() const;
+
 protected:
     const ViewAsSkill *view_as_skill;
+    QStringList dependencies;
+    bool cacheable;
 };
 
 class ShowDistanceSkill : public ZeroCardViewAsSkill
@@ -394,6 +445,15 @@ public:
 
     virtual int getExtra(const Player *target, bool include_weapon) const;
     virtual int getFixed(const Player *target, bool include_weapon) const;
+
+    // see DistanceSkill::getDependencies()
+    QStringList getDependencies() const;
+    void setDependencies(const QString &names);
+    bool isCacheable() const;
+
+protected:
+    QStringList dependencies;
+    bool cacheable;
 };
 
 
@@ -485,9 +545,21 @@ public:
     {
         return global;
     }
+    // the skills ViewHas() may lend with the "skill" flag, a room keeps their triggers ready even if nobody owns them
+    inline QStringList getViewHasSkills() const
+    {
+        return viewhas_skills;
+    }
+    // true when the lent skills are not declared, so that any skill may be lent
+    inline bool canViewHasAnySkill() const
+    {
+        return viewhas_any;
+    }
 
 protected:
     bool global;
+    QStringList viewhas_skills;
+    bool viewhas_any;
 };
 
 #endif
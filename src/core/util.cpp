@@ -24,6 +24,10 @@
 #include <QVariant>
 #include <QStringList>
 #include <QMessageBox>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutex>
+#include <QHash>
 
 extern "C" {
     int luaopen_sgs(lua_State *);
@@ -81,18 +85,86 @@ QVariant GetValueFromLuaState(lua_State *L, const char *table_name, const char *
     return data;
 }
 
+namespace {
+    struct LuaBytecode
+    {
+        QDateTime modified;
+        qint64 size;
+        QByteArray code;
+    };
+
+    QMutex LuaBytecodeMutex;
+    QHash<QString, LuaBytecode> LuaBytecodeCache;
+
+    int WriteLuaBytecode(lua_State *, const void *p, size_t sz, void *ud)
+    {
+        static_cast<QByteArray *>(ud)->append(static_cast<const char *>(p), static_cast<int>(sz));
+        return 0;
+    }
+
+    // replaces the dofile of the base library, so that scripts loaded by scripts share the bytecode cache
+    int DoLuaFile(lua_State *L)
+    {
+        const char *script = luaL_checkstring(L, 1);
+        lua_settop(L, 1);
+        if (LoadLuaScript(L, script) != LUA_OK)
+            return lua_error(L);
+        lua_call(L, 0, LUA_MULTRET);
+        return lua_gettop(L) - 1;
+    }
+}
+
 lua_State *CreateLuaState()
 {
     lua_State *L = luaL_newstate();
     luaL_openlibs(L);
     luaopen_sgs(L);
+    lua_register(L, "dofile", DoLuaFile);
 
     return L;
 }
 
+int LoadLuaScript(lua_State *L, const char *script)
+{
+    QFileInfo info(QString::fromLocal8Bit(script));
+    if (!info.exists())
+        return luaL_loadfile(L, script); // let Lua report the error
+
+    const QString key = info.absoluteFilePath();
+    const QByteArray chunkname = QByteArray("@") + script;
+
+    LuaBytecodeMutex.lock();
+    QHash<QString, LuaBytecode>::const_iterator it = LuaBytecodeCache.constFind(key);
+    if (it != LuaBytecodeCache.constEnd() && it->modified == info.lastModified() && it->size == info.size()) {
+        QByteArray code = it->code;
+        LuaBytecodeMutex.unlock();
+        return luaL_loadbuffer(L, code.constData(), code.size(), chunkname.constData());
+    }
+    LuaBytecodeMutex.unlock();
+
+    int error = luaL_loadfile(L, script);
+    if (error != LUA_OK)
+        return error;
+
+    LuaBytecode bytecode;
+    bytecode.modified = info.lastModified();
+    bytecode.size = info.size();
+#if LUA_VERSION_NUM >= 503
+    lua_dump(L, WriteLuaBytecode, &bytecode.code, 0);
+#else
+    lua_dump(L, WriteLuaBytecode, &bytecode.code);
+#endif
+
+    LuaBytecodeMutex.lock();
+    LuaBytecodeCache.insert(key, bytecode);
+    LuaBytecodeMutex.unlock();
+
+    return LUA_OK;
+}
+
 void DoLuaScript(lua_State *L, const char *script)
 {
-    int error = luaL_dofile(L, script);
+    int error = LoadLuaScript(L, script) || lua_pcall(L, 0, LUA_MULTRET, 0);
     if (error) {
         QString error_msg = lua_tostring(L, -1);
         QMessageBox::critical(NULL, QObject::tr("Lua script error"), error_msg);
@@ -40,6 +40,9 @@ void qShuffle(QList<T> &list)
 
 // lua interpreter related
 lua_State *CreateLuaState();
+// pushes the script as a function like luaL_loadfile does, but every file is compiled only once,
+// until its size or modification time changes
+int LoadLuaScript(lua_State *L, const char *script);
 void DoLuaScript(lua_State *L, const char *script);
 
 QVariant GetValueFromLuaState(lua_State *L, const char *table_name, const char *key);
@@ -19,6 +19,8 @@
     *********************************************************************/
 
 #include "wrappedcard.h"
+#include "roomstate.h"
+#include "engine.h"
 
 WrappedCard::WrappedCard(Card *card)
     : Card(card->getSuit(), card->getNumber()), m_card(NULL), m_isModified(false)
@@ -48,6 +50,8 @@ void WrappedCard::takeOver(Card *card)
     setSuit(card->getSuit());
     setNumber(card->getNumber());
     m_skillName = card->getSkillName(false);
+    // a filtered equip may now be another weapon or horse
+    Sanguosha->currentRoomState()->getSeatEpochs()->touchDistances();
 }
 
 void WrappedCard::copyEverythingFrom(Card *card)
@@ -57,7 +61,7 @@ void WrappedCard::copyEverythingFrom(Card *card)
     Q_ASSERT(m_card != card);
     if (m_card != NULL) {
         m_isModified = true;
-        m_card->deleteLater();
+        Sanguosha->autoReleaseCard(m_card);
     }
     setObjectName(card->objectName());
     m_card = card;
@@ -66,6 +70,7 @@ void WrappedCard::copyEverythingFrom(Card *card)
     Card::setNumber(card->getNumber());
     flags = card->getFlags();
     m_skillName = card->getSkillName(false);
+    Sanguosha->currentRoomState()->getSeatEpochs()->touchDistances();
 }
 
 void WrappedCard::setFlags(const QString &flag) const
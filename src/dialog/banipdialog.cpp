@@ -167,6 +167,8 @@ void BanIpDialog::addPlayer(ServerPlayer *player)
     QString parsed_string = QString("%1::%2").arg(player->screenName(), player->getIp());
     left->addItem(parsed_string);
     connect(player, &ServerPlayer::disconnected, this, &BanIpDialog::removePlayer);
+    // rooms are deleted after their game, with all players still connected
+    connect(player, &ServerPlayer::destroyed, this, &BanIpDialog::forgetPlayer);
 }
 
 void BanIpDialog::removePlayer()
@@ -180,3 +182,12 @@ void BanIpDialog::removePlayer()
         }
     }
 }
+
+void BanIpDialog::forgetPlayer(QObject *player)
+{
+    int row = sp_list.indexOf(static_cast<ServerPlayer *>(player));
+    if (row != -1) {
+        delete left->takeItem(row);
+        sp_list.removeAt(row);
+    }
+}
@@ -47,6 +47,7 @@ private:
 private slots:
     void addPlayer(ServerPlayer *player);
     void removePlayer();
+    void forgetPlayer(QObject *player);
 
     void insertClicked();
     void removeClicked();
@@ -31,6 +31,7 @@
 #include <QMessageBox>
 
 #include "server.h"
+#include "simulator.h"
 #include "settings.h"
 #include "engine.h"
 #include "mainwindow.h"
@@ -71,7 +72,12 @@ static bool callback(const wchar_t *, const wchar_t *id, void *, EXCEPTION_POINT
 
 int main(int argc, char *argv[])
 {
-    bool noGui = argc > 1 && strcmp(argv[1], "-server") == 0;
+#ifdef QSAN_SIMULATOR
+    bool simulate = true;
+#else
+    bool simulate = argc > 1 && strcmp(argv[1], "-simulate") == 0;
+#endif
+    bool noGui = simulate || (argc > 1 && strcmp(argv[1], "-server") == 0);
 
     if (noGui)
         new QCoreApplication(argc, argv);
@@ -196,6 +202,26 @@ int main(int argc, char *argv[])
         return qApp->exec();
     }
 
+    if (simulate) {
+        // -games:N -jobs:N -mode:xxx
+        int games = 1, jobs = 0;
+        QString mode;
+        foreach (const QString &arg, qApp->arguments()) {
+            if (arg.startsWith("-games:"))
+                games = arg.mid(7).toInt();
+            else if (arg.startsWith("-jobs:"))
+                jobs = arg.mid(6).toInt();
+            else if (arg.startsWith("-mode:"))
+                mode = arg.mid(6);
+        }
+
+        Simulator *simulator = new Simulator(qApp, games, jobs, mode);
+        QObject::connect(simulator, &Simulator::simulation_finished, qApp, &QCoreApplication::quit);
+        simulator->start();
+
+        return qApp->exec();
+    }
+
     showSplashMessage(QSplashScreen::tr("Loading style sheet..."));
     QFile file("style-sheet/sanguosha.qss");
     QString styleSheet;
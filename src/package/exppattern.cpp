@@ -21,15 +21,27 @@
 #include "exppattern.h"
 #include "engine.h"
 
+#include <climits>
+
 ExpPattern::ExpPattern(const QString &exp)
 {
     this->exp = exp;
+    cardIds = false;
+    foreach (const QString &one_exp, exp.split("#")) {
+        Alternative alt = compile(one_exp);
+        foreach (const QList<NameTerm> &and_names, alt.names) {
+            foreach (const NameTerm &term, and_names)
+                cardIds = cardIds || term.isId;
+        }
+        alternatives << alt;
+    }
 }
 
 bool ExpPattern::match(const Player *player, const Card *card) const
 {
-    foreach (const QString &one_exp, this->exp.split("#"))
-        if (this->matchOne(player, card, one_exp)) return true;
+    int class_id = Sanguosha->getCardClassId(card);
+    foreach (const Alternative &alt, alternatives)
+        if (this->matchOne(player, card, class_id, alt)) return true;
 
     return false;
 }
@@ -40,102 +52,176 @@ bool ExpPattern::match(const Player *player, const Card *card) const
 // 2nd patt means the card suit, and ',' means more than one options.
 // 3rd part means the card number, and ',' means more than one options,
 // the number uses '~' to make a scale for valid expressions
-bool ExpPattern::matchOne(const Player *player, const Card *card, QString exp) const
+ExpPattern::Alternative ExpPattern::compile(const QString &exp)
 {
     QStringList factors = exp.split('|');
 
-    bool checkpoint = false;
-    QStringList card_types = factors.at(0).split(',');
-    foreach (const QString &or_name, card_types) {
-        checkpoint = false;
+    Alternative alt;
+    alt.factors = factors.size();
+    alt.suits = 0;
+    alt.anyPlace = false;
+
+    foreach (const QString &or_name, factors.at(0).split(',')) {
+        QList<NameTerm> and_names;
         foreach (const QString &_name, or_name.split('+')) {
             QString name = _name;
-            if (name == ".") {
-                checkpoint = true;
-            } else {
-                bool isInt = false;
-                bool positive = true;
-                if (name.startsWith('^')) {
-                    positive = false;
-                    name = name.mid(1);
-                }
-                if (card->isKindOf(name.toLocal8Bit().data())
-                    || ("%" + card->objectName() == name)
-                    || (card->getEffectiveId() == name.toInt(&isInt) && isInt))
-                    checkpoint = positive;
+            NameTerm term;
+            term.any = (name == ".");
+            term.positive = true;
+            if (name.startsWith('^')) {
+                term.positive = false;
+                name = name.mid(1);
+            }
+            term.className = name.toLocal8Bit();
+            // patterns of packages are built before the engine, they fall back to isKindOf()
+            if (Sanguosha != NULL)
+                term.kinds = Sanguosha->getCardKinds(term.className.constData());
+            if (name.startsWith('%'))
+                term.objectName = name.mid(1);
+            term.id = name.toInt(&term.isId);
+            and_names << term;
+        }
+        alt.names << and_names;
+    }
+
+    if (alt.factors >= 2) {
+        static const Card::Suit all_suits[] = {
+            Card::SuitToBeDecided, Card::Spade, Card::Club, Card::Heart, Card::Diamond,
+            Card::NoSuitBlack, Card::NoSuitRed, Card::NoSuit
+        };
+        const quint32 all_mask = (1 << 8) - 1;
+
+        foreach (const QString &_suit, factors.at(1).split(',')) {
+            QString suit = _suit;
+            if (suit == ".") {
+                alt.suits = all_mask;
+                break;
+            }
+            bool positive = true;
+            if (suit.startsWith('^')) {
+                positive = false;
+                suit = suit.mid(1);
+            }
+            quint32 mask = 0;
+            for (int i = 0; i < 8; ++i) {
+                Card::Suit s = all_suits[i];
+                bool black = (s == Card::Spade || s == Card::Club || s == Card::NoSuitBlack);
+                bool red = (s == Card::Heart || s == Card::Diamond || s == Card::NoSuitRed);
+                if (Card::Suit2String(s) == suit || (black && suit == "black") || (red && suit == "red"))
+                    mask |= 1 << (s + 1);
+            }
+            alt.suits |= positive ? mask : (~mask & all_mask);
+        }
+    }
+
+    if (alt.factors >= 3) {
+        foreach (const QString &number, factors.at(2).split(',')) {
+            if (number == ".") {
+                alt.numbers.clear();
+                alt.numbers << qMakePair(INT_MIN, INT_MAX);
+                break;
+            }
+
+            bool isInt = false;
+            int n = number.toInt(&isInt);
+            if (number.contains('~')) {
+                QStringList params = number.split('~');
+                int from, to;
+                if (!params.at(0).size())
+                    from = 1;
                 else
-                    checkpoint = !positive;
+                    from = params.at(0).toInt();
+                if (!params.at(1).size())
+                    to = 13;
+                else
+                    to = params.at(1).toInt();
+                alt.numbers << qMakePair(from, to);
+            } else if (isInt) {
+                alt.numbers << qMakePair(n, n);
+            } else if (number == "A") {
+                alt.numbers << qMakePair(1, 1);
+            } else if (number == "J") {
+                alt.numbers << qMakePair(11, 11);
+            } else if (number == "Q") {
+                alt.numbers << qMakePair(12, 12);
+            } else if (number == "K") {
+                alt.numbers << qMakePair(13, 13);
             }
-            if (!checkpoint) break;
         }
-        if (checkpoint) break;
     }
-    if (!checkpoint) return false;
-    if (factors.size() < 2) return true;
 
-    checkpoint = false;
-    QStringList card_suits = factors.at(1).split(',');
-    foreach (const QString &_suit, card_suits) {
-        QString suit = _suit;
-        if (suit == ".") {
-            checkpoint = true; break;
+    if (alt.factors >= 4) {
+        QString place = factors.at(3);
+        if (place == ".") {
+            alt.anyPlace = true;
+        } else {
+            foreach (const QString &_p, place.split(",")) {
+                QString p = _p;
+                PlaceTerm term;
+                if (p == "equipped") {
+                    term.kind = PlaceTerm::Equipped;
+                } else if (p == "hand") {
+                    term.kind = PlaceTerm::Hand;
+                } else {
+                    if (p.contains("$"))
+                        p.replace("$", "#");
+                    if (p.startsWith("%")) {
+                        term.kind = PlaceTerm::SiblingPile;
+                        term.pile = p.mid(1);
+                    } else {
+                        term.kind = PlaceTerm::Pile;
+                        term.pile = p;
+                    }
+                }
+                alt.places << term;
+            }
         }
-        bool positive = true;
-        if (suit.startsWith('^')) {
-            positive = false;
-            suit = suit.mid(1);
+    }
+
+    return alt;
+}
+
+bool ExpPattern::matchOne(const Player *player, const Card *card, int class_id, const Alternative &alt) const
+{
+    bool checkpoint = false;
+    foreach (const QList<NameTerm> &and_names, alt.names) {
+        checkpoint = false;
+        foreach (const NameTerm &term, and_names) {
+            if (term.any) {
+                checkpoint = true;
+            } else {
+                bool kind = class_id >= 0 && class_id < term.kinds.size() ? term.kinds.testBit(class_id)
+                    : card->isKindOf(term.className.constData());
+                if (kind || (!term.objectName.isNull() && card->objectName() == term.objectName)
+                    || (term.isId && card->getEffectiveId() == term.id))
+                    checkpoint = term.positive;
+                else
+                    checkpoint = !term.positive;
+            }
+            if (!checkpoint) break;
         }
-        if (card->getSuitString() == suit
-            || (card->isBlack() && suit == "black")
-            || (card->isRed() && suit == "red"))
-            checkpoint = positive;
-        else
-            checkpoint = !positive;
         if (checkpoint) break;
     }
     if (!checkpoint) return false;
-    if (factors.size() < 3) return true;
+    if (alt.factors < 2) return true;
+
+    if (!(alt.suits & (1 << (card->getSuit() + 1)))) return false;
+    if (alt.factors < 3) return true;
 
     checkpoint = false;
-    QStringList card_numbers = factors.at(2).split(',');
     int cdn = card->getNumber();
-
-    foreach (const QString &number, card_numbers) {
-        if (number == ".") {
+    typedef QPair<int, int> NumberRange;
+    foreach (const NumberRange &range, alt.numbers) {
+        if (range.first <= cdn && cdn <= range.second) {
             checkpoint = true;
             break;
         }
-
-        bool isInt = false;
-        if (number.contains('~')) {
-            QStringList params = number.split('~');
-            int from, to;
-            if (!params.at(0).size())
-                from = 1;
-            else
-                from = params.at(0).toInt();
-            if (!params.at(1).size())
-                to = 13;
-            else
-                to = params.at(1).toInt();
-
-            if (from <= cdn && cdn <= to) checkpoint = true;
-        } else if (number.toInt(&isInt) == cdn && isInt) {
-            checkpoint = true;
-        } else if ((number == "A" && cdn == 1)
-            || (number == "J" && cdn == 11)
-            || (number == "Q" && cdn == 12)
-            || (number == "K" && cdn == 13)) {
-            checkpoint = true;
-        }
-        if (checkpoint) break;
     }
     if (!checkpoint) return false;
-    if (factors.size() < 4) return true;
+    if (alt.factors < 4) return true;
 
     checkpoint = false;
-    QString place = factors.at(3);
-    if (!player || place == ".") checkpoint = true;
+    if (!player || alt.anyPlace) checkpoint = true;
     if (!checkpoint) {
         QList<int> ids;
         if (card->isVirtualCard())
@@ -146,31 +232,27 @@ bool ExpPattern::matchOne(const Player *player, const Card *card, QString exp) c
             foreach (int id, ids) {
                 checkpoint = false;
                 const Card *card = Sanguosha->getCard(id);
-                foreach (const QString &_p, place.split(",")) {
-                    QString p = _p;
-                    if (p == "equipped" && player->hasEquip(card)) {
-                        checkpoint = true;
-                    } else if (p == "hand" && card->getEffectiveId() >= 0) {
-                        foreach (const Card *c, player->getHandcards()) {
-                            if (c->getEffectiveId() == id) {
-                                checkpoint = true;
-                                break;
-                            }
-                        }
-                    } else {
-                        if (p.contains("$"))
-                            p.replace("$", "#");
-                        if (p.startsWith("%")) {
-                            p = p.mid(1);
-                            foreach (const Player *pl, player->getAliveSiblings()) {
-                                if (!pl->getPile(p).isEmpty() && pl->getPile(p).contains(id)) {
+                foreach (const PlaceTerm &p, alt.places) {
+                    if (p.kind == PlaceTerm::Equipped) {
+                        checkpoint = player->hasEquip(card);
+                    } else if (p.kind == PlaceTerm::Hand) {
+                        if (card->getEffectiveId() >= 0) {
+                            foreach (const Card *c, player->getHandcards()) {
+                                if (c->getEffectiveId() == id) {
                                     checkpoint = true;
                                     break;
                                 }
                             }
-                        } else if (!player->getPile(p).isEmpty() && player->getPile(p).contains(id)) {
-                            checkpoint = true;
                         }
+                    } else if (p.kind == PlaceTerm::SiblingPile) {
+                        foreach (const Player *pl, player->getAliveSiblings()) {
+                            if (pl->getPile(p.pile).contains(id)) {
+                                checkpoint = true;
+                                break;
+                            }
+                        }
+                    } else if (player->getPile(p.pile).contains(id)) {
+                        checkpoint = true;
                     }
                     if (checkpoint)
                         break;
@@ -182,4 +264,3 @@ bool ExpPattern::matchOne(const Player *player, const Card *card, QString exp) c
     }
     return checkpoint;
 }
-
@@ -25,6 +25,10 @@
 #include "card.h"
 #include "player.h"
 
+#include <QBitArray>
+
+// An ExpPattern is compiled once when it is constructed,
+// use Engine::getExpPattern() to share the compiled patterns instead of constructing new ones.
 class ExpPattern : public CardPattern
 {
 public:
@@ -34,9 +38,50 @@ public:
     {
         return exp;
     }
+    // card ids in a pattern mostly come from a single ask, Engine does not cache such patterns
+    inline bool hasCardIds() const
+    {
+        return cardIds;
+    }
+
 private:
+    struct NameTerm
+    {
+        bool any;
+        bool positive;
+        QByteArray className;
+        QBitArray kinds; // bit n is set if the card class n of Engine::getCardClassId() is a className
+        QString objectName; // "%slash" matches the object name
+        bool isId;
+        int id;
+    };
+
+    struct PlaceTerm
+    {
+        enum Kind
+        {
+            Equipped, Hand, Pile, SiblingPile
+        };
+        Kind kind;
+        QString pile;
+    };
+
+    struct Alternative
+    {
+        int factors;
+        QList<QList<NameTerm> > names; // ',' of '+'
+        quint32 suits;                 // bit (suit + 1) is set for every suit accepted
+        QList<QPair<int, int> > numbers;
+        bool anyPlace;
+        QList<PlaceTerm> places;
+    };
+
     QString exp;
-    bool matchOne(const Player *player, const Card *card, QString exp) const;
+    QList<Alternative> alternatives;
+    bool cardIds;
+
+    static Alternative compile(const QString &exp);
+    bool matchOne(const Player *player, const Card *card, int class_id, const Alternative &alt) const;
 };
 
 #endif
@@ -155,6 +155,7 @@ class TuntianDistance : public DistanceSkill
 public:
     TuntianDistance() : DistanceSkill("#tuntian-dist")
     {
+        dependencies << "field";
     }
 
     virtual int getCorrect(const Player *from, const Player *) const
@@ -434,6 +435,7 @@ public:
     FeiyingVH() : ViewHasSkill("feiyingVH")
     {
         global = true;
+        viewhas_skills << "feiying";
     }
 
     virtual bool ViewHas(const Player *player, const QString &skill_name, const QString &flag) const
@@ -525,6 +527,7 @@ public:
     {
         relate_to_place = "deputy";
         frequency = Compulsory;
+        viewhas_skills << "guanxing";
     }
     virtual bool ViewHas(const Player *player, const QString &skill_name, const QString &flag) const
     {
@@ -817,26 +820,31 @@ public:
         return false;
     }
 
-    virtual TriggerList triggerable(TriggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    virtual TriggerRecordMap triggerRecords(TriggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
     {
-        TriggerList skill_list;
+        TriggerRecordMap skill_list;
         CardUseStruct use = data.value<CardUseStruct>();
         QList<ServerPlayer *> skill_owners = room->findPlayersBySkillName(objectName());
         foreach (ServerPlayer *skill_owner, skill_owners) {
             if (BattleArraySkill::triggerable(skill_owner) && skill_owner->hasShownSkill(this)
                 && use.card != NULL && use.card->isKindOf("Slash")) {
-                QStringList targets;
+                QList<ServerPlayer *> targets;
                 foreach (ServerPlayer *to, use.to) {
                     if (player->inSiegeRelation(skill_owner, to))
-                        targets << to->objectName();
+                        targets << to;
                 }
                 if (!targets.isEmpty())
-                    skill_list.insert(skill_owner, QStringList(objectName() + "->" + targets.join("+")));
+                    skill_list[skill_owner] << TriggerRecord(this, targets);
             }
         }
         return skill_list;
     }
 
+    virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    {
+        return encodeTriggerRecords(triggerRecords(triggerEvent, room, player, data));
+    }
+
     virtual bool cost(TriggerEvent, Room *room, ServerPlayer *skill_target, QVariant &, ServerPlayer *ask_who) const
     {
         if (ask_who != NULL && ask_who->hasShownSkill(this)) {
@@ -1076,7 +1084,7 @@ public:
             if (player->isAlive())
                 room->damage(DamageStruct(objectName(), hetaihou, player));
         } else
-            analeptic->deleteLater();
+            Sanguosha->autoReleaseCard(analeptic);
 
         return false;
     }
@@ -1452,19 +1460,25 @@ public:
         events << TargetChosen;
     }
 
-    virtual QStringList triggerable(TriggerEvent, Room *, ServerPlayer *player, QVariant &data, ServerPlayer* &) const
+    virtual TriggerRecordMap triggerRecords(TriggerEvent, Room *, ServerPlayer *player, QVariant &data) const
     {
+        TriggerRecordMap records;
         CardUseStruct use = data.value<CardUseStruct>();
         if (WeaponSkill::triggerable(player) && use.card != NULL && use.card->isKindOf("Slash")) {
-            QStringList targets;
+            QList<ServerPlayer *> targets;
             foreach (ServerPlayer *to, use.to) {
                 if (player->canDiscard(to, "he"))
-                    targets << to->objectName();
+                    targets << to;
             }
             if (!targets.isEmpty())
-                return QStringList(objectName() + "->" + targets.join("+"));
+                records[player] << TriggerRecord(this, targets);
         }
-        return QStringList();
+        return records;
+    }
+
+    virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    {
+        return encodeTriggerRecords(triggerRecords(triggerEvent, room, player, data));
     }
 
     virtual bool cost(TriggerEvent, Room *room, ServerPlayer *player, QVariant &, ServerPlayer *ask_who) const
@@ -1227,26 +1227,31 @@ public:
         return false;
     }
 
-    virtual TriggerList triggerable(TriggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    virtual TriggerRecordMap triggerRecords(TriggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
     {
-        TriggerList skill_list;
+        TriggerRecordMap skill_list;
         CardUseStruct use = data.value<CardUseStruct>();
         QList<ServerPlayer *> skill_owners = room->findPlayersBySkillName(objectName());
         foreach (ServerPlayer *skill_owner, skill_owners) {
             if (BattleArraySkill::triggerable(skill_owner) && skill_owner->hasShownSkill(this)
                 && use.card != NULL && use.card->isKindOf("Slash")) {
-                QStringList targets;
+                QList<ServerPlayer *> targets;
                 foreach (ServerPlayer *to, use.to) {
                     if (player->inSiegeRelation(skill_owner, to) && to->canDiscard(to, "e"))
-                        targets << to->objectName();
+                        targets << to;
                 }
                 if (!targets.isEmpty())
-                    skill_list.insert(skill_owner, QStringList(objectName() + "->" + targets.join("+")));
+                    skill_list[skill_owner] << TriggerRecord(this, targets);
             }
         }
         return skill_list;
     }
 
+    virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    {
+        return encodeTriggerRecords(triggerRecords(triggerEvent, room, player, data));
+    }
+
     virtual bool cost(TriggerEvent, Room *room, ServerPlayer *skill_target, QVariant &, ServerPlayer *ask_who) const
     {
         if (ask_who != NULL && ask_who->hasShownSkill(this)) {
@@ -41,10 +41,9 @@ void Slash::setNature(DamageStruct::Nature nature)
 
 bool Slash::IsAvailable(const Player *player, const Card *slash, bool considerSpecificAssignee)
 {
-    Slash *newslash = new Slash(Card::NoSuit, 0);
-    newslash->setFlags("Global_SlashAvailabilityChecker");
-    newslash->deleteLater();
-#define THIS_SLASH (slash == NULL ? newslash : slash)
+    Slash newslash(Card::NoSuit, 0);
+    newslash.setFlags("Global_SlashAvailabilityChecker");
+#define THIS_SLASH (slash == NULL ? &newslash : slash)
     if (player->isCardLimited(THIS_SLASH, Card::MethodUse))
         return false;
 
@@ -521,9 +520,8 @@ QString Analeptic::getSubtype() const
 
 bool Analeptic::IsAvailable(const Player *player, const Card *analeptic)
 {
-    Analeptic *newanal = new Analeptic(Card::NoSuit, 0);
-    newanal->deleteLater();
-#define THIS_ANAL (analeptic == NULL ? newanal : analeptic)
+    Analeptic newanal(Card::NoSuit, 0);
+#define THIS_ANAL (analeptic == NULL ? &newanal : analeptic)
     if (player->isCardLimited(THIS_ANAL, Card::MethodUse) || player->isProhibited(player, THIS_ANAL))
         return false;
 
@@ -39,22 +39,28 @@ public:
         events << TargetChosen;
     }
 
-    virtual QStringList triggerable(TriggerEvent, Room *, ServerPlayer *player, QVariant &data, ServerPlayer* &) const
+    virtual TriggerRecordMap triggerRecords(TriggerEvent, Room *, ServerPlayer *player, QVariant &data) const
     {
+        TriggerRecordMap records;
         CardUseStruct use = data.value<CardUseStruct>();
         if (!WeaponSkill::triggerable(player))
-            return QStringList();
+            return records;
 
         if (use.card != NULL && use.card->isKindOf("Slash")) {
-            QStringList targets;
+            QList<ServerPlayer *> targets;
             foreach (ServerPlayer *to, use.to) {
                 if (genderDiff(player, to))
-                    targets << to->objectName();
+                    targets << to;
             }
             if (!targets.isEmpty())
-                return QStringList(objectName() + "->" + targets.join("+"));
+                records[player] << TriggerRecord(this, targets);
         }
-        return QStringList();
+        return records;
+    }
+
+    virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    {
+        return encodeTriggerRecords(triggerRecords(triggerEvent, room, player, data));
     }
 
     virtual bool cost(TriggerEvent, Room *room, ServerPlayer *skill_target, QVariant &, ServerPlayer *ask_who) const
@@ -103,20 +109,26 @@ public:
         frequency = Compulsory;
     }
 
-    virtual QStringList triggerable(TriggerEvent, Room *, ServerPlayer *player, QVariant &data, ServerPlayer* &) const
+    virtual TriggerRecordMap triggerRecords(TriggerEvent, Room *, ServerPlayer *player, QVariant &data) const
     {
+        TriggerRecordMap records;
         CardUseStruct use = data.value<CardUseStruct>();
         if (!WeaponSkill::triggerable(player))
-            return QStringList();
+            return records;
 
         if (use.card != NULL && use.card->isKindOf("Slash")) {
-            QStringList targets;
+            QList<ServerPlayer *> targets;
             foreach(ServerPlayer *to, use.to)
-                targets << to->objectName();
+                targets << to;
             if (!targets.isEmpty())
-                return QStringList(objectName() + "->" + targets.join("+"));
+                records[player] << TriggerRecord(this, targets);
         }
-        return QStringList();
+        return records;
+    }
+
+    virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    {
+        return encodeTriggerRecords(triggerRecords(triggerEvent, room, player, data));
     }
 
     virtual bool cost(TriggerEvent, Room *room, ServerPlayer *target, QVariant &, ServerPlayer *ask_who) const
@@ -483,6 +495,7 @@ class SixSwordsSkill : public AttackRangeSkill
 public:
     SixSwordsSkill() : AttackRangeSkill("SixSwords")
     {
+        dependencies << "Equips_Nullified_to_Yourself";
     }
 
     virtual int getExtra(const Player *target, bool) const
@@ -745,6 +758,7 @@ class HorseSkill : public DistanceSkill
 public:
     HorseSkill() :DistanceSkill("Horse")
     {
+        dependencies << "Equips_Nullified_to_Yourself";
     }
 
     virtual int getCorrect(const Player *from, const Player *to) const
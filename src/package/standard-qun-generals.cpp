@@ -105,27 +105,28 @@ public:
         frequency = Compulsory;
     }
 
-    virtual QStringList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data, ServerPlayer* &) const
+    virtual TriggerRecordMap triggerRecords(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
     {
+        TriggerRecordMap records;
         if (player == NULL)
-            return QStringList();
+            return records;
         CardUseStruct use = data.value<CardUseStruct>();
         if (triggerEvent == TargetChosen) {
             if (use.card && (use.card->isKindOf("Slash") || use.card->isKindOf("Duel"))) {
                 if (TriggerSkill::triggerable(player)) {
-                    QStringList targets;
+                    QList<ServerPlayer *> targets;
                     foreach(ServerPlayer *to, use.to)
-                        targets << to->objectName();
+                        targets << to;
                     if (!targets.isEmpty())
-                        return QStringList(objectName() + "->" + targets.join("+"));
+                        records[player] << TriggerRecord(this, targets);
                 }
             }
         } else if (triggerEvent == TargetConfirmed) {
             if (!use.to.contains(player))
-                return QStringList();
+                return records;
 
             if (use.card && use.card->isKindOf("Duel") && TriggerSkill::triggerable(player)) {
-                return QStringList(objectName() + "->" + use.from->objectName());
+                records[player] << TriggerRecord(this, QList<ServerPlayer *>() << use.from);
             }
         } else if (triggerEvent == CardFinished) {
             if (use.card->isKindOf("Duel")) {
@@ -134,9 +135,14 @@ public:
                         room->setPlayerMark(lvbu, "WushuangTarget", 0);
                 }
             }
-            return QStringList();
+            return records;
         }
-        return QStringList();
+        return records;
+    }
+
+    virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    {
+        return encodeTriggerRecords(triggerRecords(triggerEvent, room, player, data));
     }
 
     virtual bool cost(TriggerEvent, Room *room, ServerPlayer *target, QVariant &data, ServerPlayer *ask_who) const
@@ -183,7 +189,7 @@ bool LijianCard::targetFilter(const QList<const Player *> &targets, const Player
         return false;
 
     Duel *duel = new Duel(Card::NoSuit, 0);
-    duel->deleteLater();
+    Sanguosha->autoReleaseCard(duel);
 
     if (targets.length() == 1 && (to_select->isCardLimited(duel, Card::MethodUse) || to_select->isProhibited(targets.first(), duel)))
         return false;
@@ -131,7 +131,7 @@ public:
         if (Sanguosha->currentRoomState()->getCurrentCardUseReason() == CardUseStruct::CARD_USE_REASON_PLAY) {
             Slash *slash = new Slash(Card::SuitToBeDecided, -1);
             slash->addSubcard(card->getEffectiveId());
-            slash->deleteLater();
+            Sanguosha->autoReleaseCard(slash);
             return slash->isAvailable(Self);
         }
         return true;
@@ -181,25 +181,31 @@ public:
         return false;
     }
 
-    virtual QStringList triggerable(TriggerEvent, Room *room, ServerPlayer *player, QVariant &data, ServerPlayer* &) const
+    virtual TriggerRecordMap triggerRecords(TriggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
     {
+        TriggerRecordMap records;
         if (!player || !player->isAlive())
-            return QStringList();
+            return records;
 
         CardUseStruct use = data.value<CardUseStruct>();
         if (player->hasSkill("paoxiao")) {
             ServerPlayer *lord = room->getLord(player->getKingdom());
             if (lord != NULL && lord->hasLordSkill("shouyue") && lord->hasShownGeneral1()) {
                 if (use.card != NULL && use.card->isKindOf("Slash")) {
-                    QStringList targets;
+                    QList<ServerPlayer *> targets;
                     foreach(ServerPlayer *to, use.to)
-                        targets << to->objectName();
+                        targets << to;
                     if (!targets.isEmpty())
-                        return QStringList(objectName() + "->" + targets.join("+"));
+                        records[player] << TriggerRecord(this, targets);
                 }
             }
         }
-        return QStringList();
+        return records;
+    }
+
+    virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    {
+        return encodeTriggerRecords(triggerRecords(triggerEvent, room, player, data));
     }
 
     virtual bool cost(TriggerEvent, Room *, ServerPlayer *target, QVariant &data, ServerPlayer *ask_who) const
@@ -561,17 +567,23 @@ public:
         frequency = Frequent;
     }
 
-    virtual QStringList triggerable(TriggerEvent, Room *, ServerPlayer *player, QVariant &data, ServerPlayer* &) const
+    virtual TriggerRecordMap triggerRecords(TriggerEvent, Room *, ServerPlayer *player, QVariant &data) const
     {
+        TriggerRecordMap records;
         CardUseStruct use = data.value<CardUseStruct>();
         if (TriggerSkill::triggerable(player) && use.card != NULL && use.card->isKindOf("Slash")) {
-            QStringList targets;
+            QList<ServerPlayer *> targets;
             foreach(ServerPlayer *to, use.to)
-                targets << to->objectName();
+                targets << to;
             if (!targets.isEmpty())
-                return QStringList(objectName() + "->" + targets.join("+"));
+                records[player] << TriggerRecord(this, targets);
         }
-        return QStringList();
+        return records;
+    }
+
+    virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    {
+        return encodeTriggerRecords(triggerRecords(triggerEvent, room, player, data));
     }
 
     virtual bool cost(TriggerEvent, Room *room, ServerPlayer *skill_target, QVariant &, ServerPlayer *player) const
@@ -704,20 +716,26 @@ public:
         events << TargetChosen;
     }
 
-    virtual QStringList triggerable(TriggerEvent, Room *, ServerPlayer *player, QVariant &data, ServerPlayer* &) const
+    virtual TriggerRecordMap triggerRecords(TriggerEvent, Room *, ServerPlayer *player, QVariant &data) const
     {
+        TriggerRecordMap records;
         CardUseStruct use = data.value<CardUseStruct>();
         if (TriggerSkill::triggerable(player) && player->getPhase() == Player::Play && use.card != NULL && use.card->isKindOf("Slash")) {
-            QStringList targets;
+            QList<ServerPlayer *> targets;
             foreach (ServerPlayer *to, use.to) {
                 int handcard_num = to->getHandcardNum();
                 if (handcard_num >= player->getHp() || handcard_num <= player->getAttackRange())
-                    targets << to->objectName();
+                    targets << to;
             }
             if (!targets.isEmpty())
-                return QStringList(objectName() + "->" + targets.join("+"));
+                records[player] << TriggerRecord(this, targets);
         }
-        return QStringList();
+        return records;
+    }
+
+    virtual TriggerList triggerable(TriggerEvent triggerEvent, Room *room, ServerPlayer *player, QVariant &data) const
+    {
+        return encodeTriggerRecords(triggerRecords(triggerEvent, room, player, data));
     }
 
     virtual bool cost(TriggerEvent, Room *room, ServerPlayer *skill_target, QVariant &, ServerPlayer *player) const
@@ -627,7 +627,7 @@ bool ShensuCard::targetFilter(const QList<const Player *> &targets, const Player
 {
     Slash *slash = new Slash(NoSuit, 0);
     slash->setSkillName("shensu");
-    slash->deleteLater();
+    Sanguosha->autoReleaseCard(slash);
     return slash->targetFilter(targets, to_select, Self);
 }
 
@@ -507,7 +507,7 @@ public:
         } else if (triggerEvent == EventPhaseStart && player->getPhase() == Player::Play) {
             KnownBoth *kb = new KnownBoth(Card::NoSuit, 0);
             kb->setSkillName(objectName());
-            kb->deleteLater();
+            Sanguosha->autoReleaseCard(kb);
             if (kb->isAvailable(player))
                 return QStringList(objectName());
         }
@@ -93,7 +93,7 @@ bool QiceCard::targetFilter(const QList<const Player *> &targets, const Player *
     if (mutable_card) {
         mutable_card->addSubcards(subcards);
         mutable_card->setCanRecast(false);
-        mutable_card->deleteLater();
+        Sanguosha->autoReleaseCard(mutable_card);
     }
     if (targets.length() >= subcards.length() && !mutable_card->isKindOf("Collateral")) return false;
 
@@ -119,7 +119,7 @@ bool QiceCard::targetFixed() const
     if (mutable_card) {
         mutable_card->addSubcards(subcards);
         mutable_card->setCanRecast(false);
-        mutable_card->deleteLater();
+        Sanguosha->autoReleaseCard(mutable_card);
     }
     return mutable_card && mutable_card->targetFixed();
 }
@@ -130,7 +130,7 @@ bool QiceCard::targetsFeasible(const QList<const Player *> &targets, const Playe
     if (mutable_card) {
         mutable_card->addSubcards(subcards);
         mutable_card->setCanRecast(false);
-        mutable_card->deleteLater();
+        Sanguosha->autoReleaseCard(mutable_card);
     }
     if (mutable_card->isKindOf("Collateral")) {
         if (targets.length()/2 > subcards.length()) return false;
@@ -214,7 +214,7 @@ const Card *QiceCard::validate(CardUseStruct &card_use) const
             break;
         }
     available = available && use_card->isAvailable(source);
-    use_card->deleteLater();
+    Sanguosha->autoReleaseCard(use_card);
     if (!available) return NULL;
     return use_card;
 }
@@ -1977,6 +1977,7 @@ class FlameMapVH : public ViewHasSkill
 public:
     FlameMapVH() : ViewHasSkill("flamemap-viewhas")
     {
+        viewhas_skills << "yingzi" << "yingziextra" << "haoshi" << "gongxin" << "qianxun";
     }
     virtual bool ViewHas(const Player *player, const QString &skill_name, const QString &flag) const
     {
@@ -2124,6 +2125,7 @@ public:
     ZhihengVH() : ViewHasSkill("zhiheng-viewhas")
     {
         global = true;
+        viewhas_skills << "zhiheng";
     }
     virtual bool ViewHas(const Player *player, const QString &skill_name, const QString &flag) const
     {
@@ -29,7 +29,7 @@
 #include <lua.hpp>
 
 AI::AI(ServerPlayer *player)
-    : self(player)
+    : self(player), subscribed_events(NumOfEvents, true)
 {
     room = player->getRoom();
 }
@@ -120,6 +120,15 @@ void AI::filterEvent(TriggerEvent, ServerPlayer *, const QVariant &)
     // dummy
 }
 
+void AI::setSubscribedEvents(const QList<int> &events)
+{
+    subscribed_events.fill(false);
+    foreach (int triggerEvent, events) {
+        if (triggerEvent >= 0 && triggerEvent < NumOfEvents)
+            subscribed_events.setBit(triggerEvent);
+    }
+}
+
 TrustAI::TrustAI(ServerPlayer *player)
     : AI(player)
 {
@@ -35,6 +35,7 @@ typedef int LuaFunction;
 
 #include <QString>
 #include <QObject>
+#include <QBitArray>
 
 class AI : public QObject
 {
@@ -76,11 +77,18 @@ public:
     virtual ServerPlayer *askForYiji(const QList<int> &cards, const QString &reason, int &card_id) = 0;
     virtual void askForGuanxing(const QList<int> &cards, QList<int> &up, QList<int> &bottom, int guanxing_type) = 0;
     virtual void filterEvent(TriggerEvent triggerEvent, ServerPlayer *player, const QVariant &data);
+    // the room only calls filterEvent() for the subscribed events, which are all of them by default
+    inline bool isEventSubscribed(TriggerEvent triggerEvent) const
+    {
+        return subscribed_events.testBit(triggerEvent);
+    }
+    void setSubscribedEvents(const QList<int> &events);
 
     virtual QList<int> askForExchange(const QString &reason, const QString &pattern, int max_num, int min_num, const QString &expand_pile) = 0;
 protected:
     Room *room;
     ServerPlayer *self;
+    QBitArray subscribed_events;
 };
 
 class TrustAI : public AI
@@ -0,0 +1,133 @@
+/********************************************************************
+    Copyright (c) 2013-2015 - Mogara
+
+    This file is part of QSanguosha-Hegemony.
+
+    This game is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 3.0
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    See the LICENSE file for more details.
+
+    Mogara
+    *********************************************************************/
+
+#include "luastatepool.h"
+#include "settings.h"
+#include "engine.h"
+#include "util.h"
+#include "lua.hpp"
+
+#include <QFile>
+#include <QRunnable>
+
+class LuaStatePreparer : public QRunnable
+{
+public:
+    explicit LuaStatePreparer(LuaStatePool *pool)
+        : pool(pool)
+    {
+    }
+
+    virtual void run()
+    {
+        pool->prepare();
+    }
+
+private:
+    LuaStatePool *pool;
+};
+
+LuaStatePool *LuaStatePool::getInstance()
+{
+    static LuaStatePool pool;
+    return &pool;
+}
+
+LuaStatePool::LuaStatePool()
+    : pending(0)
+{
+    workers.setMaxThreadCount(1);
+}
+
+LuaStatePool::~LuaStatePool()
+{
+    workers.waitForDone();
+    foreach (lua_State *L, states)
+        lua_close(L);
+}
+
+const char *LuaStatePool::aiScript()
+{
+    return QFile::exists("lua/ai/private-smart-ai.lua") ?
+        "lua/ai/private-smart-ai.lua" : "lua/ai/smart-ai.lua";
+}
+
+lua_State *LuaStatePool::CreateRoomLuaState()
+{
+    lua_State *L = CreateLuaState();
+
+    // the extensions are registered by the engine's own state, which also runs their skills
+    Sanguosha->setRegistrationForbidden(true);
+    DoLuaScript(L, "lua/sanguosha.lua");
+    DoLuaScript(L, aiScript());
+    Sanguosha->setRegistrationForbidden(false);
+
+    return L;
+}
+
+lua_State *LuaStatePool::take()
+{
+    lua_State *L = NULL;
+
+    mutex.lock();
+    if (!states.isEmpty())
+        L = states.takeFirst();
+    mutex.unlock();
+
+    warmUp();
+
+    if (L == NULL)
+        L = CreateRoomLuaState();
+    return L;
+}
+
+void LuaStatePool::warmUp()
+{
+    const int size = Config.value("LuaStatePoolSize", 2).toInt();
+
+    QMutexLocker locker(&mutex);
+    while (states.length() + pending < size) {
+        ++pending;
+        workers.start(new LuaStatePreparer(this));
+    }
+}
+
+void LuaStatePool::prepare()
+{
+    // DoLuaScript shows a message box on errors, which cannot be done out of the main thread.
+    // A broken script is dropped here and reported when take() has to load it synchronously.
+    // Only Lua is initialized here, engine objects made on this thread would outlive it, see CreateRoomLuaState().
+    lua_State *L = CreateLuaState();
+    Sanguosha->setRegistrationForbidden(true);
+    bool ok = LoadLuaScript(L, "lua/sanguosha.lua") == LUA_OK && lua_pcall(L, 0, 0, 0) == LUA_OK
+        && LoadLuaScript(L, aiScript()) == LUA_OK && lua_pcall(L, 0, 0, 0) == LUA_OK;
+    Sanguosha->setRegistrationForbidden(false);
+
+    if (!ok) {
+        qWarning("%s", lua_tostring(L, -1));
+        lua_close(L);
+        L = NULL;
+    }
+
+    QMutexLocker locker(&mutex);
+    --pending;
+    if (L != NULL)
+        states << L;
+}
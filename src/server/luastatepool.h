@@ -0,0 +1,58 @@
+/********************************************************************
+    Copyright (c) 2013-2015 - Mogara
+
+    This file is part of QSanguosha-Hegemony.
+
+    This game is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 3.0
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    See the LICENSE file for more details.
+
+    Mogara
+    *********************************************************************/
+
+#ifndef _LUA_STATE_POOL_H
+#define _LUA_STATE_POOL_H
+
+struct lua_State;
+
+#include <QList>
+#include <QMutex>
+#include <QThreadPool>
+
+// Keeps a few Lua states with sanguosha.lua and the AI scripts already loaded,
+// prepared in the background so that creating a room does not have to parse them.
+class LuaStatePool
+{
+public:
+    static LuaStatePool *getInstance();
+    ~LuaStatePool();
+
+    // returns a ready state, or prepares one right now if none is left
+    lua_State *take();
+    // fills the pool up to the "LuaStatePoolSize" setting in the background
+    void warmUp();
+
+    static lua_State *CreateRoomLuaState();
+
+private:
+    LuaStatePool();
+    static const char *aiScript();
+    void prepare();
+
+    QMutex mutex;
+    QList<lua_State *> states;
+    int pending;
+    QThreadPool workers;
+
+    friend class LuaStatePreparer;
+};
+
+#endif
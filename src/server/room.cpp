@@ -33,12 +33,14 @@
 #include "json.h"
 #include "clientstruct.h"
 #include "roomthread.h"
+#include "luastatepool.h"
+#include "seatring.h"
+#include "roomscheduler.h"
 
 #include <lua.hpp>
 #include <QStringList>
 #include <QMessageBox>
 #include <QHostAddress>
-#include <QTimer>
 #include <QMetaEnum>
 #include <QTimerEvent>
 #include <QDateTime>
@@ -60,12 +62,13 @@ using namespace QSanProtocol;
 
 
 Room::Room(QObject *parent, const QString &mode)
-    : QThread(parent), mode(mode), current(NULL), pile1(Sanguosha->getRandomCards()),
+    : QThread(parent), mode(mode), current(NULL), m_seatViewStarter(NULL), m_seatViewEpoch(-1),
+    pile1(Sanguosha->getRandomCards()),
     m_drawPile(&pile1), m_discardPile(&pile2),
     game_started(false), game_finished(false), game_paused(false), L(NULL), thread(NULL),
-    _m_semRaceRequest(0), _m_semRoomMutex(1),
+    _m_semReplyReady(0), m_task(NULL),
     _m_isFirstSurrenderRequest(true),
-    _m_raceStarted(false), provided(NULL), has_provided(false),
+    _m_raceStarted(false), _m_AIraceRespondTime(-1), provided(NULL), has_provided(false),
     m_surrenderRequestReceived(false), _virtual(false), _m_roomState(false)
 {
     static int s_global_room_id = 0;
@@ -74,22 +77,62 @@ Room::Room(QObject *parent, const QString &mode)
     player_count = Sanguosha->getPlayerCount(mode);
     scenario = Sanguosha->getScenario(mode);
 
-    initCallbacks();
+    // unmapped cards used to report PlaceHand without an owner, keep it that way
+    int card_count = Sanguosha->getCardCount();
+    card_places.fill(Player::PlaceHand, card_count);
+    card_owners.fill(NULL, card_count);
+    card_slots.fill(-1, card_count);
 
-    L = CreateLuaState();
+    initCallbacks();
 
-    DoLuaScript(L, "lua/sanguosha.lua");
-    DoLuaScript(L, QFile::exists("lua/ai/private-smart-ai.lua") ?
-        "lua/ai/private-smart-ai.lua" : "lua/ai/smart-ai.lua");
+    L = LuaStatePool::getInstance()->take();
 
     m_generalSelector = GeneralSelector::getInstance();
+
+    // in KB, 0 means the default of the platform
+    const uint stack_size = Config.value("RoomStackSize", 0).toUInt();
+    if (stack_size > 0)
+        setStackSize(stack_size * 1024);
+
+    connect(this, &QThread::finished, this, &Room::run_finished);
 }
 
 Room::~Room()
 {
-    lua_close(L);
+    // the sockets post replies to this room from their own threads, cut them off first
+    foreach (ServerPlayer *player, findChildren<ServerPlayer *>())
+        player->setSocket(NULL);
+
+    // AIs made by the Lua function CloneAI are collected with the state
+    qDeleteAll(native_ais);
+    if (L != NULL)
+        lua_close(L);
+
     if (thread != NULL)
         delete thread;
+    RoomScheduler::release(m_task);
+}
+
+void Room::launch()
+{
+    RoomScheduler *scheduler = RoomScheduler::getInstance();
+    if (scheduler != NULL)
+        m_task = scheduler->schedule(this);
+    if (m_task == NULL)
+        start();
+}
+
+void Room::sampleMemoryUsage()
+{
+    memoryUsage = RoomMemoryUsage();
+    if (L != NULL)
+        memoryUsage.luaBytes = lua_gc(L, LUA_GCCOUNT, 0) * Q_INT64_C(1024) + lua_gc(L, LUA_GCCOUNTB, 0);
+
+    QList<ServerPlayer *> players = findChildren<ServerPlayer *>();
+    memoryUsage.players = players.length();
+    foreach (ServerPlayer *player, players)
+        memoryUsage.recordBytes += player->getRecordSize();
+    memoryUsage.transientCardPeak = _m_roomState.getTransientCardPeak();
 }
 
 void Room::initCallbacks()
@@ -190,26 +233,32 @@ QList<ServerPlayer *> Room::getPlayers() const
 
 QList<ServerPlayer *> Room::getAllPlayers(bool include_dead) const
 {
-    QList<ServerPlayer *> count_players = m_players;
     if (current == NULL)
-        return count_players;
-
-    ServerPlayer *starter = current;
-    int index = count_players.indexOf(starter);
-    if (index == -1)
-        return count_players;
-
-    QList<ServerPlayer *> all_players;
-    for (int i = index; i < count_players.length(); i++) {
-        if (include_dead || count_players[i]->isAlive())
-            all_players << count_players[i];
-    }
-
-    for (int i = 0; i < index; i++) {
-        if (include_dead || count_players[i]->isAlive())
-            all_players << count_players[i];
+        return m_players;
+
+    const int epoch = _m_roomState.getSeatEpochs()->topology();
+    if (m_seatViewStarter != current || m_seatViewEpoch != epoch
+        || m_seatViewPlayers != m_players) {
+        m_seatViewEpoch = epoch;
+        m_seatViewStarter = current;
+        m_seatViewPlayers = m_players;
+        m_seatViews[0].clear();
+        m_seatViews[1].clear();
+
+        int index = m_players.indexOf(current);
+        if (index == -1) {
+            m_seatViews[0] = m_seatViews[1] = m_players;
+        } else {
+            for (int i = 0; i < m_players.length(); i++) {
+                ServerPlayer *p = m_players.at((index + i) % m_players.length());
+                m_seatViews[1] << p;
+                if (p->isAlive())
+                    m_seatViews[0] << p;
+            }
+        }
     }
 
+    QList<ServerPlayer *> all_players = m_seatViews[include_dead ? 1 : 0];
     if (current->getPhase() == Player::NotActive && all_players.contains(current)) {
         all_players.removeOne(current);
         all_players.append(current);
@@ -592,6 +641,7 @@ void Room::slashResult(const SlashEffectStruct &effect, const Card *jink)
 void Room::attachSkillToPlayer(ServerPlayer *player, const QString &skill_name)
 {
     player->acquireSkill(skill_name);
+    if (thread) thread->addPlayerSkill(skill_name);
     doNotify(player, S_COMMAND_ATTACH_SKILL, skill_name);
 }
 
@@ -688,6 +738,7 @@ void Room::handleAcquireDetachSkills(ServerPlayer *player, const QStringList &sk
             if (!skill) continue;
             if (player->getAcquiredSkills().contains(skill_name)) continue;
             player->acquireSkill(skill_name, head);
+            if (thread) thread->addPlayerSkill(skill_name);
 
             if (skill->getFrequency() == Skill::Limited && !skill->getLimitMark().isEmpty())
                 setPlayerMark(player, skill->getLimitMark(), 1);
@@ -729,19 +780,14 @@ bool Room::doRequest(ServerPlayer *player, QSanProtocol::CommandType command, co
 {
     Packet packet(S_SRC_ROOM | S_TYPE_REQUEST | S_DEST_CLIENT, command);
     packet.setMessageBody(arg);
-    player->acquireLock(ServerPlayer::SEMA_MUTEX);
-    player->m_isClientResponseReady = false;
-    player->drainLock(ServerPlayer::SEMA_COMMAND_INTERACTIVE);
-    player->setClientReply(QVariant());
-    player->m_isWaitingReply = true;
-    player->m_expectedReplySerial = packet.createGlobalSerial();
-    if (m_requestResponsePair.contains(command))
-        player->m_expectedReplyCommand = m_requestResponsePair[command];
-    else
-        player->m_expectedReplyCommand = command;
+    unsigned int serial = packet.createGlobalSerial();
+    CommandType expected = m_requestResponsePair.value(command, command);
+    // wake-ups posted for the previous request must not end this one
+    _processClientReplies();
+    // the request is open before the packet leaves, so even the quickest reply finds it
+    player->getRequest().open(expected, serial, Config.OperationNoLimit ? -1 : timeOut);
 
     player->unicast(&packet);
-    player->releaseLock(ServerPlayer::SEMA_MUTEX);
     if (wait) return getResult(player, timeOut);
     else return true;
 }
@@ -757,26 +803,19 @@ bool Room::doBroadcastRequest(QList<ServerPlayer *> &players, QSanProtocol::Comm
     foreach (ServerPlayer *player, players)
         doRequest(player, command, player->m_commandArgs, timeOut, false);
 
-    QTime timer;
-    time_t remainTime = timeOut;
-    timer.start();
-    foreach (ServerPlayer *player, players) {
-        remainTime = timeOut - timer.elapsed();
-        if (remainTime < 0) remainTime = 0;
-        getResult(player, remainTime);
-    }
+    // all the requests are waited for at once, until the last reply or the deadline
+    _waitForReplies(players);
+
+    foreach (ServerPlayer *player, players)
+        player->getRequest().close();
     return true;
 }
 
 ServerPlayer *Room::doBroadcastRaceRequest(QList<ServerPlayer *> &players, QSanProtocol::CommandType command,
     time_t timeOut, ResponseVerifyFunction validateFunc, void *funcArg)
 {
-    _m_semRoomMutex.acquire();
     _m_raceStarted = true;
-    _m_raceWinner = NULL;
-    while (_m_semRaceRequest.tryAcquire(1)) {
-    } //drain lock
-    _m_semRoomMutex.release();
+    _m_raceRepliers.clear();
     Countdown countdown;
     countdown.max = timeOut;
     countdown.type = Countdown::S_COUNTDOWN_USE_SPECIFIED;
@@ -786,96 +825,65 @@ ServerPlayer *Room::doBroadcastRaceRequest(QList<ServerPlayer *> &players, QSanP
     foreach (ServerPlayer *player, players)
         doRequest(player, command, player->m_commandArgs, timeOut, false);
 
-    QThread* thread = new QThread(this);
-    thread->start();
-    QTimer *timer = new QTimer(0);
-    timer->setSingleShot(true);
+    // the AI answers by a deadline which getRaceResult() waits for along with the players
+    _m_AIraceRespondTime = -1;
     if (_m_AIraceWinner != NULL) {
         int time = timeOut - 2800;
         if (Config.OperationNoLimit)
             time = 5000 - 800;
-        int AIraceRespondTime = 800 + qrand() % time;
-        timer->start(AIraceRespondTime);
+        _m_AIraceRespondTime = 800 + qrand() % time;
     }
-    connect(timer, &QTimer::timeout, this, &Room::endaskfornull, Qt::DirectConnection);
-    timer->moveToThread(thread);
-
-    ServerPlayer *winner = getRaceResult(players, command, timeOut, validateFunc, funcArg);
 
-    thread->quit();
-    timer->deleteLater();
-    thread->deleteLater();
-
-    return winner;
+    return getRaceResult(players, command, timeOut, validateFunc, funcArg);
 }
 
 ServerPlayer *Room::getRaceResult(QList<ServerPlayer *> &players, QSanProtocol::CommandType, time_t timeOut,
     ResponseVerifyFunction validateFunc, void *funcArg)
 {
-
     QTime timer;
     timer.start();
 
-    bool validResult = false;
-    for (int i = 0; i < players.size(); i++) {
-        time_t timeRemain = timeOut - timer.elapsed();
-
-        if (timeRemain < 0) timeRemain = 0;
-        bool tryAcquireResult = true;
-        if (Config.OperationNoLimit)
-            _m_semRaceRequest.acquire();
-        else
-            tryAcquireResult = _m_semRaceRequest.tryAcquire(1, timeRemain);
-
-        if (!tryAcquireResult)
-            _m_semRoomMutex.tryAcquire(1);
-        // So that processResponse cannot update raceWinner when we are reading it.
-
-        if (_m_raceWinner == NULL) {
-            _m_semRoomMutex.release();
-            continue;
+    ServerPlayer *winner = NULL;
+    int replies = 0;
+    while (winner == NULL && replies < players.size()) {
+        // the replies are validated in the order they arrived, the first valid one wins
+        _processClientReplies();
+        while (winner == NULL && !_m_raceRepliers.isEmpty()) {
+            ServerPlayer *player = _m_raceRepliers.takeFirst();
+            ++replies;
+            if (validateFunc == NULL
+                || (player->getRequest().hasReply()
+                && (this->*validateFunc)(player, player->getClientReply(), funcArg)))
+                winner = player;
+            else
+                player->getRequest().close(); // Don't give this player any more chance for this race
         }
-
-        if (validateFunc == NULL
-            || (_m_raceWinner->m_isClientResponseReady
-            && (this->*validateFunc)(_m_raceWinner, _m_raceWinner->getClientReply(), funcArg))) {
-            validResult = true;
+        if (winner != NULL || replies >= players.size())
             break;
 
-        } else if (_m_raceWinner == _m_AIraceWinner) {
-            validResult = true;
+        time_t timeRemain = timeOut - timer.elapsed();
+        if (timeRemain < 0) timeRemain = 0;
+        time_t AIRemain = _m_AIraceRespondTime - timer.elapsed();
+        if (AIRemain < 0) AIRemain = 0;
+        if (_m_AIraceRespondTime >= 0 && (Config.OperationNoLimit || AIRemain < timeRemain)) {
+            // nobody has been faster than the AI, so it answers now like a player would
+            if (!_waitForWakeUp(AIRemain))
+                winner = _m_AIraceWinner;
+        } else if (Config.OperationNoLimit) {
+            _waitForWakeUp();
+        } else if (!_waitForWakeUp(timeRemain)) {
             break;
-
-        } else {
-            // Don't give this player any more chance for this race
-            _m_raceWinner->m_isWaitingReply = false;
-            _m_raceWinner = NULL;
-            _m_semRoomMutex.release();
         }
     }
 
-    if (!validResult) _m_semRoomMutex.acquire();
     _m_raceStarted = false;
+    _m_raceRepliers.clear();
+    _m_AIraceRespondTime = -1;
 
-    foreach (ServerPlayer *player, players) {
-        player->acquireLock(ServerPlayer::SEMA_MUTEX);
-        player->m_expectedReplyCommand = S_COMMAND_UNKNOWN;
-        player->m_isWaitingReply = false;
-        player->m_expectedReplySerial = -1;
-        player->releaseLock(ServerPlayer::SEMA_MUTEX);
-    }
-    _m_semRoomMutex.release();
-
-    return _m_raceWinner;
-}
+    foreach (ServerPlayer *player, players)
+        player->getRequest().close();
 
-void Room::endaskfornull()
-{
-    if (_m_raceWinner == NULL && _m_AIraceWinner != NULL && _m_raceStarted) {
-        _m_raceStarted = false;
-        _m_semRaceRequest.release();
-        _m_raceWinner = _m_AIraceWinner;
-    }
+    return winner;
 }
 
 bool Room::doNotify(ServerPlayer *player, QSanProtocol::CommandType command, const QVariant &arg)
@@ -888,8 +896,12 @@ bool Room::doNotify(ServerPlayer *player, QSanProtocol::CommandType command, con
 
 bool Room::doBroadcastNotify(const QList<ServerPlayer *> &players, QSanProtocol::CommandType command, const QVariant &arg)
 {
+    Packet packet(S_SRC_ROOM | S_TYPE_NOTIFICATION | S_DEST_CLIENT, command);
+    packet.setMessageBody(arg);
+
+    SerializedPacket serialized(&packet);
     foreach (ServerPlayer *player, players)
-        doNotify(player, command, arg);
+        player->unicast(serialized);
     return true;
 }
 
@@ -898,10 +910,10 @@ bool Room::doBroadcastNotify(QSanProtocol::CommandType command, const QVariant &
     Packet packet(S_SRC_ROOM | S_TYPE_NOTIFICATION | S_DEST_CLIENT, command);
     packet.setMessageBody(arg);
 
+    SerializedPacket serialized(&packet);
     foreach (ServerPlayer *player, m_players) {
-        if (player != except) {
-            player->unicast(&packet);
-        }
+        if (player != except)
+            player->unicast(serialized);
     }
     return true;
 }
@@ -922,9 +934,13 @@ bool Room::doNotify(ServerPlayer *player, int command, const char *arg)
 
 bool Room::doBroadcastNotify(const QList<ServerPlayer *> &players, int command, const char *arg)
 {
-    foreach (ServerPlayer *player, players)
-        doNotify(player, command, arg);
-    return true;
+    JsonDocument doc = JsonDocument::fromJson(arg);
+    if (!doc.isValid()) {
+        output(QString("Fail to parse the Json Value %1").arg(arg));
+        return true;
+    }
+
+    return doBroadcastNotify(players, (QSanProtocol::CommandType)command, doc.toVariant());
 }
 
 bool Room::doBroadcastNotify(int command, const char *arg)
@@ -942,9 +958,7 @@ bool Room::doNotify(ServerPlayer *player, int command, const QVariant &arg)
 
 bool Room::doBroadcastNotify(const QList<ServerPlayer *> &players, int command, const QVariant &arg)
 {
-    foreach (ServerPlayer *player, players)
-        doNotify(player, command, arg);
-    return true;
+    return doBroadcastNotify(players, (QSanProtocol::CommandType)command, arg);
 }
 
 bool Room::doBroadcastNotify(int command, const QVariant &arg)
@@ -956,37 +970,128 @@ bool Room::doBroadcastNotify(int command, const QVariant &arg)
 
 void Room::broadcast(const QSanProtocol::AbstractPacket *packet, ServerPlayer *except)
 {
-    broadcast(packet->toJson(), except);
+    SerializedPacket serialized(packet);
+    foreach (ServerPlayer *player, m_players) {
+        if (player != except)
+            player->unicast(serialized);
+    }
 }
 
-bool Room::getResult(ServerPlayer *player, time_t timeOut)
+void Room::_releaseReply(ServerPlayer *player)
 {
-    Q_ASSERT(player->m_isWaitingReply);
-    bool validResult = false;
-    player->acquireLock(ServerPlayer::SEMA_MUTEX);
+    // the request belongs to the room thread, which ends the wait if it is still pending
+    m_replyMutex.lock();
+    m_releaseQueue << player;
+    m_replyMutex.unlock();
+    _wakeUp();
+}
 
-    if (player->isOnline()) {
-        player->releaseLock(ServerPlayer::SEMA_MUTEX);
+void Room::postClientReply(ServerPlayer *player, const Packet &packet)
+{
+    m_replyMutex.lock();
+    m_replyQueue << qMakePair(QPointer<ServerPlayer>(player), packet);
+    m_replyMutex.unlock();
+    _wakeUp();
+}
 
-        if (Config.OperationNoLimit)
-            player->acquireLock(ServerPlayer::SEMA_COMMAND_INTERACTIVE);
-        else
-            player->tryAcquireLock(ServerPlayer::SEMA_COMMAND_INTERACTIVE, timeOut);
-
-        // Note that we rely on processResponse to filter out all unrelevant packet.
-        // By the time the lock is released, m_clientResponse must be the right message
-        // assuming the client side is not tampered.
-
-        // Also note that lock can be released when a player switch to trust or offline status.
-        // It is ensured by trustCommand and reportDisconnection that the player reports these status
-        // is the player waiting the lock. In these cases, the serial number and command type doesn't matter.
-        player->acquireLock(ServerPlayer::SEMA_MUTEX);
-        validResult = player->m_isClientResponseReady;
-    }
-    player->m_expectedReplyCommand = S_COMMAND_UNKNOWN;
-    player->m_isWaitingReply = false;
-    player->m_expectedReplySerial = -1;
-    player->releaseLock(ServerPlayer::SEMA_MUTEX);
+void Room::_wakeUp()
+{
+    if (m_task != NULL)
+        RoomScheduler::wake(m_task);
+    else
+        _m_semReplyReady.release();
+}
+
+bool Room::_waitForWakeUp(qint64 msecs)
+{
+    if (m_task != NULL) {
+        Q_ASSERT(RoomScheduler::currentTask() == m_task);
+        return RoomScheduler::park(msecs);
+    }
+
+    if (msecs < 0) {
+        _m_semReplyReady.acquire();
+        return true;
+    }
+    return _m_semReplyReady.tryAcquire(1, msecs);
+}
+
+void Room::_forgetWakeUps()
+{
+    if (m_task != NULL)
+        RoomScheduler::forgetWakeUps(m_task);
+    else
+        _m_semReplyReady.tryAcquire(_m_semReplyReady.available());
+}
+
+void Room::_processClientReplies()
+{
+    typedef QPair<QPointer<ServerPlayer>, Packet> ClientReply;
+    m_replyMutex.lock();
+    QList<ClientReply> replies = m_replyQueue;
+    QList<QPointer<ServerPlayer> > releases = m_releaseQueue;
+    m_replyQueue.clear();
+    m_releaseQueue.clear();
+    m_replyMutex.unlock();
+
+    foreach (const ClientReply &reply, replies) {
+        if (reply.first != NULL)
+            processClientReply(reply.first, reply.second);
+    }
+    foreach (const QPointer<ServerPlayer> &player, releases) {
+        if (player != NULL)
+            player->getRequest().release();
+    }
+}
+
+void Room::_waitForReplies(const QList<ServerPlayer *> &players, time_t timeOut)
+{
+    QElapsedTimer timer;
+    timer.start();
+    _forgetWakeUps(); // the queues are processed below
+    forever {
+        _processClientReplies();
+
+        // sleep until the latest deadline of the requests still pending, any reply wakes us up earlier
+        qint64 wait = -2;
+        foreach (ServerPlayer *player, players) {
+            const ClientRequest &request = player->getRequest();
+            if (!player->isOnline() || !request.isWaiting() || request.isDone())
+                continue;
+            qint64 remain = request.remainingTime();
+            if (remain == 0)
+                continue;
+            if (remain == -1 || wait == -1)
+                wait = -1;
+            else
+                wait = qMax(wait, remain);
+        }
+        if (wait == -2)
+            return;
+
+        if (timeOut >= 0) {
+            qint64 remain = timeOut - timer.elapsed();
+            if (remain <= 0)
+                return;
+            wait = (wait == -1) ? remain : qMin(wait, remain);
+        }
+
+        _waitForWakeUp(wait);
+    }
+}
+
+bool Room::getResult(ServerPlayer *player, time_t timeOut)
+{
+    ClientRequest &request = player->getRequest();
+    Q_ASSERT(request.isWaiting());
+    // a player who is offline or trusted ends the wait by a release, see _releaseReply()
+    if (player->isOnline())
+        _waitForReplies(QList<ServerPlayer *>() << player, Config.OperationNoLimit ? -1 : timeOut);
+    else
+        _processClientReplies();
+
+    bool validResult = request.hasReply();
+    request.close();
     return validResult;
 }
 
@@ -1020,9 +1125,10 @@ bool Room::notifyMoveFocus(const QList<ServerPlayer *> &focuses, const Countdown
     //============================================
     //for protecting anjiang
     //============================================
+    static const int ask_for_skill_cost = Sanguosha->getAtom("Global_askForSkillCost");
     bool verify = false;
     foreach (ServerPlayer *focus, focuses) {
-        if (focus->hasFlag("Global_askForSkillCost")) {
+        if (focus->hasFlag(ask_for_skill_cost)) {
             verify = true;
             break;
         }
@@ -2499,6 +2605,9 @@ ServerPlayer *Room::addSocket(ClientSocket *socket)
 
     connect(player, &ServerPlayer::disconnected, this, &Room::reportDisconnection);
     connect(player, &ServerPlayer::roomPacketReceived, this, &Room::processClientPacket);
+    // replies are queued for the room thread right in the thread of the socket,
+    // without a detour through the main event loop
+    connect(player, &ServerPlayer::roomReplyReceived, this, &Room::postClientReply, Qt::DirectConnection);
     connect(player, &ServerPlayer::invalidPacketReceived, this, &Room::reportInvalidPacket);
 
     return player;
@@ -2530,8 +2639,16 @@ void Room::tryPause()
 {
     if (!canPause(getOwner())) return;
     QMutexLocker locker(&m_mutex);
-    while (game_paused)
-        m_waitCond.wait(locker.mutex());
+    while (game_paused) {
+        if (m_task == NULL) {
+            m_waitCond.wait(locker.mutex());
+        } else {
+            // a parked task leaves its worker to the other rooms, pauseCommand() wakes it up
+            locker.unlock();
+            RoomScheduler::park(-1);
+            locker.relock();
+        }
+    }
 }
 
 int Room::getLack() const
@@ -2654,7 +2771,9 @@ void Room::resetAI(ServerPlayer *player)
     if (smart_ai) {
         index = ais.indexOf(smart_ai);
         ais.removeOne(smart_ai);
-        smart_ai->deleteLater();
+        // AIs made by CloneAI are owned by the Lua state, which collects them itself
+        if (native_ais.remove(smart_ai))
+            smart_ai->deleteLater();
     }
     AI *new_ai = cloneAI(player);
     player->setAI(new_ai);
@@ -3021,8 +3140,8 @@ void Room::reportDisconnection()
         }
     } else {
         // Game is started, do not remove it just set its state as offline
-        if (player->m_isWaitingReply)
-            player->releaseLock(ServerPlayer::SEMA_COMMAND_INTERACTIVE);
+        if (player->getRequest().isWaiting())
+            _releaseReply(player);
         setPlayerProperty(player, "state", "offline");
 
         bool someone_is_online = false;
@@ -3058,17 +3177,13 @@ void Room::reportDisconnection()
 
 void Room::trustCommand(ServerPlayer *player, const QVariant &)
 {
-    player->acquireLock(ServerPlayer::SEMA_MUTEX);
     if (player->isOnline()) {
         player->setState("trust");
-        if (player->m_isWaitingReply) {
-            player->releaseLock(ServerPlayer::SEMA_MUTEX);
-            player->releaseLock(ServerPlayer::SEMA_COMMAND_INTERACTIVE);
-        }
+        if (player->getRequest().isWaiting())
+            _releaseReply(player);
     } else
         player->setState("online");
 
-    player->releaseLock(ServerPlayer::SEMA_MUTEX);
     broadcastProperty(player, "state");
 }
 
@@ -3085,8 +3200,11 @@ void Room::pauseCommand(ServerPlayer *player, const QVariant &arg)
         doNotify(player, S_COMMAND_LOG_EVENT, arg);
 
         game_paused = pause;
-        if (!game_paused)
+        if (!game_paused) {
             m_waitCond.wakeAll();
+            if (m_task != NULL)
+                RoomScheduler::wake(m_task);
+        }
     }
 }
 
@@ -3099,7 +3217,7 @@ void Room::processRequestCheat(ServerPlayer *player, const QVariant &arg)
 
     //@todo: synchronize this
     player->m_cheatArgs = arg;
-    player->releaseLock(ServerPlayer::SEMA_COMMAND_INTERACTIVE);
+    _releaseReply(player);
 }
 
 bool Room::makeSurrender(ServerPlayer *initiator)
@@ -3119,7 +3237,7 @@ bool Room::makeSurrender(ServerPlayer *initiator)
     // collect polls
     foreach (ServerPlayer *player, playersAlive) {
         bool result = false;
-        if (!player->m_isClientResponseReady || !JsonUtils::isBool(player->getClientReply()))
+        if (!player->getRequest().hasReply() || !JsonUtils::isBool(player->getClientReply()))
             result = !player->isOnline();
         else
             result = player->getClientReply().toBool();
@@ -3141,7 +3259,7 @@ void Room::processRequestSurrender(ServerPlayer *player, const QVariant &)
 {
     //@todo: Strictly speaking, the client must be in the PLAY phase
     //@todo: return false for 3v3 and 1v1!!!
-    if (player == NULL || !player->m_isWaitingReply)
+    if (player == NULL || !player->getRequest().isWaiting())
         return;
     if (!_m_isFirstSurrenderRequest
         && _m_timeSinceLastSurrenderRequest.elapsed() <= Config.S_SURRENDER_REQUEST_MIN_INTERVAL)
@@ -3150,7 +3268,7 @@ void Room::processRequestSurrender(ServerPlayer *player, const QVariant &)
     _m_isFirstSurrenderRequest = false;
     _m_timeSinceLastSurrenderRequest.restart();
     m_surrenderRequestReceived = true;
-    player->releaseLock(ServerPlayer::SEMA_COMMAND_INTERACTIVE);
+    _releaseReply(player);
 }
 
 void Room::processRequestPreshow(ServerPlayer *player, const QVariant &arg)
@@ -3160,14 +3278,12 @@ void Room::processRequestPreshow(ServerPlayer *player, const QVariant &arg)
 
     JsonArray args = arg.value<JsonArray>();
     if (args.size() != 3 || !JsonUtils::isString(args[0]) || !JsonUtils::isBool(args[1]) || !JsonUtils::isBool(args[2])) return;
-    player->acquireLock(ServerPlayer::SEMA_MUTEX);
+    QMutexLocker locker(player->getMutex());
 
     const QString skill_name = args[0].toString();
     const bool isPreshowed = args[1].toBool();
     const bool head = args[2].toBool();
     player->setSkillPreshowed(skill_name, isPreshowed, head);
-
-    player->releaseLock(ServerPlayer::SEMA_MUTEX);
 }
 
 void Room::processClientPacket(const QSanProtocol::Packet &packet)
@@ -3175,7 +3291,7 @@ void Room::processClientPacket(const QSanProtocol::Packet &packet)
     ServerPlayer *player = qobject_cast<ServerPlayer *>(sender());
     if (packet.getPacketType() == S_TYPE_REPLY) {
         if (player == NULL) return;
-        processClientReply(player, packet);
+        postClientReply(player, packet);
     } else if (packet.getPacketType() == S_TYPE_REQUEST) {
         Callback callback = interactions[packet.getCommandType()];
         if (!callback) return;
@@ -3309,7 +3425,7 @@ ServerPlayer *Room::getOwner() const
 void Room::toggleReadyCommand(ServerPlayer *, const QVariant &)
 {
     if (!game_started && isFull())
-        start();
+        launch();
 }
 
 void Room::signup(ServerPlayer *player, const QString &screen_name, const QString &avatar, bool is_robot)
@@ -3391,7 +3507,7 @@ void Room::chooseGenerals(QList<ServerPlayer *> &to_assign, bool has_assign, boo
     foreach (ServerPlayer *player, to_assign) {
         if (player->getGeneral() != NULL) continue;
         const QVariant &generalName = player->getClientReply();
-        if (!player->m_isClientResponseReady || !JsonUtils::isString(generalName)) {
+        if (!player->getRequest().hasReply() || !JsonUtils::isString(generalName)) {
             QStringList default_generals = _chooseDefaultGenerals(player);
             _setPlayerGeneral(player, default_generals.first(), true);
             _setPlayerGeneral(player, default_generals.last(), false);
@@ -3449,12 +3565,6 @@ void Room::run()
     qsrand(QTime(0, 0, 0).secsTo(QTime::currentTime()));
     Config.AIDelay = Config.OriginAIDelay;
 
-    foreach (ServerPlayer *player, m_players) {
-        //Ensure that the game starts with all player's mutex locked
-        player->drainAllLocks();
-        player->releaseLock(ServerPlayer::SEMA_MUTEX);
-    }
-
     prepareForStart();
 
     bool using_countdown = true;
@@ -3468,7 +3578,7 @@ void Room::run()
     if (using_countdown) {
         for (int i = Config.CountDownSeconds; i >= 0; i--) {
             doBroadcastNotify(S_COMMAND_START_IN_X_SECONDS, QVariant(i));
-            sleep(1);
+            RoomScheduler::sleep(1000);
         }
     } else
         doBroadcastNotify(S_COMMAND_START_IN_X_SECONDS, QVariant(0));
@@ -3518,6 +3628,16 @@ void Room::run()
         chooseGenerals(m_players);
         startGame();
     }
+
+    // the game loop goes on with the thread which has prepared the game,
+    // so that a room never holds more than one thread
+    if (!_virtual) {
+        emit game_start();
+        thread->runGame();
+    }
+
+    // the Lua state belongs to this thread, so look at it before the room is handed back
+    sampleMemoryUsage();
 }
 
 void Room::assignRoles()
@@ -3788,48 +3908,25 @@ void Room::resume(ServerPlayer *player, const QVariant &)
 
 void Room::processClientReply(ServerPlayer *player, const Packet &packet)
 {
-    player->acquireLock(ServerPlayer::SEMA_MUTEX);
-    bool success = false;
-    if (player == NULL)
+    // only the room thread gets here, so neither the request nor the racers need any locking
+    if (player == NULL) {
         emit room_message(tr("Unable to parse player"));
-    else if (!player->m_isWaitingReply || player->m_isClientResponseReady)
+        return;
+    }
+
+    ClientRequest &request = player->getRequest();
+    if (!request.isWaiting() || request.isDone())
         emit room_message(tr("Server is not waiting for reply from %1").arg(player->objectName()));
-    else if (packet.getCommandType() != player->m_expectedReplyCommand)
+    else if (packet.getCommandType() != request.getExpectedCommand())
         emit room_message(tr("Reply command should be %1 instead of %2")
-        .arg(player->m_expectedReplyCommand).arg(packet.getCommandType()));
-    else if (packet.localSerial != player->m_expectedReplySerial)
+        .arg(request.getExpectedCommand()).arg(packet.getCommandType()));
+    else if (packet.localSerial != request.getSerial())
         emit room_message(tr("Reply serial should be %1 instead of %2")
-        .arg(player->m_expectedReplySerial).arg(packet.localSerial));
-    else
-        success = true;
-
-    if (!success) {
-        player->releaseLock(ServerPlayer::SEMA_MUTEX);
-        return;
-    } else {
-        _m_semRoomMutex.acquire();
-        if (_m_raceStarted) {
-            player->setClientReply(packet.getMessageBody());
-            player->m_isClientResponseReady = true;
-            // Warning: the statement below must be the last one before releasing the lock!!!
-            // Any statement after this statement will totally compromise the synchronization
-            // because getRaceResult will then be able to acquire the lock, reading a non-null
-            // raceWinner and proceed with partial data. The current implementation is based on
-            // the assumption that the following line is ATOMIC!!!
-            // @todo: Find a Qt atomic semantic or use _asm to ensure the following line is atomic
-            // on a multi-core machine. This is the core to the whole synchornization mechanism for
-            // broadcastRaceRequest.
-            _m_raceWinner = player;
-            // the _m_semRoomMutex.release() signal is in getRaceResult();
-            _m_semRaceRequest.release();
-        } else {
-            _m_semRoomMutex.release();
-            player->setClientReply(packet.getMessageBody());
-            player->m_isClientResponseReady = true;
-            player->releaseLock(ServerPlayer::SEMA_COMMAND_INTERACTIVE);
-        }
-
-        player->releaseLock(ServerPlayer::SEMA_MUTEX);
+        .arg(request.getSerial()).arg(packet.localSerial));
+    else {
+        request.complete(packet.getMessageBody());
+        if (_m_raceStarted)
+            _m_raceRepliers << player;
     }
 }
 
@@ -3949,9 +4046,9 @@ bool Room::useCard(const CardUseStruct &use, bool add_history)
                 }
             }
 
+            foreach (int id, getCardIdsInPlace(Player::PlaceTable) + getCardIdsInPlace(Player::PlaceJudge))
+                moveCardTo(Sanguosha->getCard(id), NULL, Player::DiscardPile, true);
             foreach (int id, Sanguosha->getRandomCards()) {
-                if (getCardPlace(id) == Player::PlaceTable || getCardPlace(id) == Player::PlaceJudge)
-                    moveCardTo(Sanguosha->getCard(id), NULL, Player::DiscardPile, true);
                 if (Sanguosha->getCard(id)->hasFlag("using"))
                     setCardFlag(id, "-using");
             }
@@ -4375,7 +4472,7 @@ void Room::startGame()
 
     current = m_players.first();
 
-    // initialize the place_map and owner_map;
+    // initialize the card places and owners
     foreach (int card_id, *m_drawPile)
         setCardMapping(card_id, NULL, Player::DrawPile);
     doBroadcastNotify(S_COMMAND_UPDATE_PILE, m_drawPile->length());
@@ -4383,9 +4480,6 @@ void Room::startGame()
     _m_roomState.reset();
 
     thread = new RoomThread(this);
-    connect(thread, &RoomThread::started, this, &Room::game_start);
-
-    if (!_virtual) thread->start();
 }
 
 bool Room::notifyProperty(ServerPlayer *playerToNotify, const ServerPlayer *propertyOwner, const char *propertyName, QString value)
@@ -4746,25 +4840,54 @@ void Room::moveCardsAtomic(CardsMoveStruct cards_move, bool forceMoveVisible)
     moveCardsAtomic(cards_moves, forceMoveVisible);
 }
 
-void Room::moveCardsAtomic(QList<CardsMoveStruct> cards_moves, bool forceMoveVisible)
+static inline bool isEmptyMove(const QVariant &data)
 {
-    cards_moves = _breakDownCardMoves(cards_moves);
+    // peek at the payload in place instead of copying it out of the variant
+    if (data.userType() == qMetaTypeId<CardsMoveOneTimeStruct>())
+        return static_cast<const CardsMoveOneTimeStruct *>(data.constData())->card_ids.isEmpty();
+    return data.value<CardsMoveOneTimeStruct>().card_ids.isEmpty();
+}
+
+void Room::_triggerMoveEvent(TriggerEvent triggerEvent, QList<CardsMoveOneTimeStruct> &moveOneTimes)
+{
+    // every move is wrapped once. BeforeCardsMove hands the same variant to each player in turn,
+    // so that changes made for one player are seen by the next without a round trip.
+    // The other events give each player a copy of the pristine move, which is shared until a skill writes to it.
+    const bool chained = triggerEvent == BeforeCardsMove;
+    QList<QVariant> datas;
+    foreach (const CardsMoveOneTimeStruct &moveOneTime, moveOneTimes)
+        datas << (moveOneTime.card_ids.isEmpty() ? QVariant() : QVariant::fromValue(moveOneTime));
 
-    QList<CardsMoveOneTimeStruct> moveOneTimes = _mergeMoves(cards_moves);
     foreach (ServerPlayer *player, getAllPlayers()) {
-        int i = 0;
-        foreach (const CardsMoveOneTimeStruct &moveOneTime, moveOneTimes) {
-            if (moveOneTime.card_ids.size() == 0) {
-                i++;
-                continue;
+        for (int i = 0; i < datas.length(); i++) {
+            if (chained) {
+                QVariant &data = datas[i];
+                if (!data.isValid() || isEmptyMove(data))
+                    continue;
+                thread->trigger(triggerEvent, this, player, data);
+            } else {
+                if (!datas.at(i).isValid())
+                    continue;
+                QVariant data = datas.at(i);
+                thread->trigger(triggerEvent, this, player, data);
             }
-            QVariant data = QVariant::fromValue(moveOneTime);
-            thread->trigger(BeforeCardsMove, this, player, data);
-            CardsMoveOneTimeStruct moveOneTime2 = data.value<CardsMoveOneTimeStruct>();
-            moveOneTimes[i] = moveOneTime2;
-            i++;
         }
     }
+
+    if (!chained)
+        return;
+    for (int i = 0; i < datas.length(); i++) {
+        if (datas.at(i).isValid())
+            moveOneTimes[i] = datas.at(i).value<CardsMoveOneTimeStruct>();
+    }
+}
+
+void Room::moveCardsAtomic(QList<CardsMoveStruct> cards_moves, bool forceMoveVisible)
+{
+    cards_moves = _breakDownCardMoves(cards_moves);
+
+    QList<CardsMoveOneTimeStruct> moveOneTimes = _mergeMoves(cards_moves);
+    _triggerMoveEvent(BeforeCardsMove, moveOneTimes);
     cards_moves = _separateMoves(moveOneTimes);
 
     notifyMoveCards(true, cards_moves, forceMoveVisible);
@@ -4847,13 +4970,7 @@ void Room::moveCardsAtomic(QList<CardsMoveStruct> cards_moves, bool forceMoveVis
 
     //trigger event
     moveOneTimes = _mergeMoves(cards_moves);
-    foreach (ServerPlayer *player, getAllPlayers()) {
-        foreach (const CardsMoveOneTimeStruct &moveOneTime, moveOneTimes) {
-            if (moveOneTime.card_ids.size() == 0) continue;
-            QVariant data = QVariant::fromValue(moveOneTime);
-            thread->trigger(CardsMoveOneTime, this, player, data);
-        }
-    }
+    _triggerMoveEvent(CardsMoveOneTime, moveOneTimes);
 }
 
 QList<CardsMoveStruct> Room::_breakDownCardMoves(QList<CardsMoveStruct> &cards_moves)
@@ -4894,32 +5011,22 @@ void Room::_moveCards(QList<CardsMoveStruct> cards_moves, bool forceMoveVisible,
     // First, process remove card
 
     QList<CardsMoveOneTimeStruct> moveOneTimes = _mergeMoves(cards_moves);
-    foreach (ServerPlayer *player, getAllPlayers()) {
-        int i = 0;
-        foreach (const CardsMoveOneTimeStruct &_moveOneTime, moveOneTimes) {
-            if (_moveOneTime.card_ids.size() == 0) {
-                i++;
-                continue;
-            }
-            Player *origin_to = _moveOneTime.to;
-            Player::Place origin_place = _moveOneTime.to_place;
-            Player *origin_from = _moveOneTime.from;
-            QList<Player::Place> origin_from_places = _moveOneTime.from_places;
-            CardsMoveOneTimeStruct moveOneTime = _moveOneTime;
-            moveOneTime.origin_to_place = origin_place;
-            moveOneTime.origin_to = origin_to;
-            moveOneTime.to = NULL;
-            moveOneTime.to_place = Player::PlaceTable;
-            QVariant data = QVariant::fromValue(moveOneTime);
-            thread->trigger(BeforeCardsMove, this, player, data);
-            moveOneTime = data.value<CardsMoveOneTimeStruct>();
-            moveOneTime.origin_from_places = origin_from_places;
-            moveOneTime.origin_from = origin_from;
-            moveOneTime.to = origin_to;
-            moveOneTime.to_place = origin_place;
-            moveOneTimes[i] = moveOneTime;
-            i++;
-        }
+    QList<CardsMoveOneTimeStruct> origin_moves = moveOneTimes;
+    for (int i = 0; i < moveOneTimes.length(); i++) {
+        CardsMoveOneTimeStruct &moveOneTime = moveOneTimes[i];
+        moveOneTime.origin_to_place = moveOneTime.to_place;
+        moveOneTime.origin_to = moveOneTime.to;
+        moveOneTime.to = NULL;
+        moveOneTime.to_place = Player::PlaceTable;
+    }
+    _triggerMoveEvent(BeforeCardsMove, moveOneTimes);
+    for (int i = 0; i < moveOneTimes.length(); i++) {
+        CardsMoveOneTimeStruct &moveOneTime = moveOneTimes[i];
+        const CardsMoveOneTimeStruct &origin_move = origin_moves.at(i);
+        moveOneTime.origin_from_places = origin_move.from_places;
+        moveOneTime.origin_from = origin_move.from;
+        moveOneTime.to = origin_move.to;
+        moveOneTime.to_place = origin_move.to_place;
     }
 
     cards_moves = _separateMoves(moveOneTimes);
@@ -4977,13 +5084,7 @@ void Room::_moveCards(QList<CardsMoveStruct> cards_moves, bool forceMoveVisible,
 
     //trigger event
     moveOneTimes = _mergeMoves(cards_moves);
-    foreach (ServerPlayer *player, getAllPlayers()) {
-        foreach (const CardsMoveOneTimeStruct &moveOneTime, moveOneTimes) {
-            if (moveOneTime.card_ids.size() == 0) continue;
-            QVariant data = QVariant::fromValue(moveOneTime);
-            thread->trigger(CardsMoveOneTime, this, player, data);
-        }
-    }
+    _triggerMoveEvent(CardsMoveOneTime, moveOneTimes);
 
     for (int i = 0; i < cards_moves.size(); i++) {
         CardsMoveStruct &cards_move = cards_moves[i];
@@ -5007,20 +5108,7 @@ void Room::_moveCards(QList<CardsMoveStruct> cards_moves, bool forceMoveVisible,
     }
 
     moveOneTimes = _mergeMoves(cards_moves);
-    foreach (ServerPlayer *player, getAllPlayers()) {
-        int i = 0;
-        foreach (const CardsMoveOneTimeStruct &moveOneTime, moveOneTimes) {
-            if (moveOneTime.card_ids.size() == 0) {
-                i++;
-                continue;
-            }
-            QVariant data = QVariant::fromValue(moveOneTime);
-            thread->trigger(BeforeCardsMove, this, player, data);
-            CardsMoveOneTimeStruct moveOneTime2 = data.value<CardsMoveOneTimeStruct>();
-            moveOneTimes[i] = moveOneTime2;
-            i++;
-        }
-    }
+    _triggerMoveEvent(BeforeCardsMove, moveOneTimes);
     cards_moves = _separateMoves(moveOneTimes);
 
     // Now, process add cards
@@ -5088,13 +5176,7 @@ void Room::_moveCards(QList<CardsMoveStruct> cards_moves, bool forceMoveVisible,
 
     //trigger event
     moveOneTimes = _mergeMoves(cards_moves);
-    foreach (ServerPlayer *player, getAllPlayers()) {
-        foreach (const CardsMoveOneTimeStruct &moveOneTime, moveOneTimes) {
-            if (moveOneTime.card_ids.size() == 0) continue;
-            QVariant data = QVariant::fromValue(moveOneTime);
-            thread->trigger(CardsMoveOneTime, this, player, data);
-        }
-    }
+    _triggerMoveEvent(CardsMoveOneTime, moveOneTimes);
 }
 
 void Room::updateCardsOnLose(const CardsMoveStruct &move)
@@ -5152,14 +5234,27 @@ bool Room::notifyMoveCards(bool isLostPhase, QList<CardsMoveStruct> cards_moves,
     else
         moveId = --_m_lastMovementId;
     Q_ASSERT(_m_lastMovementId >= 0);
+
+    // a move is sent either with or without its card ids, so prepare both forms once
+    int move_num = cards_moves.size();
+    JsonArray open_moves, hidden_moves;
+    for (int i = 0; i < move_num; i++) {
+        CardsMoveStruct &cards_move = cards_moves[i];
+        cards_move.open = true;
+        open_moves << cards_move.toVariant();
+        cards_move.open = false;
+        hidden_moves << cards_move.toVariant();
+    }
+
+    // players who see the same cards share one serialized packet
+    QList<QByteArray> visibilities;
+    QHash<QByteArray, QList<ServerPlayer *> > recipients;
     foreach (ServerPlayer *player, players) {
         if (player->isOffline()) continue;
-        JsonArray arg;
-        arg << moveId;
-        int move_num = cards_moves.size();
+        QByteArray visibility(move_num, '0');
         for (int i = 0; i < move_num; i++) {
             CardsMoveStruct &cards_move = cards_moves[i];
-            cards_move.open = forceVisible || cards_move.isRelevant(player)
+            bool open = forceVisible || cards_move.isRelevant(player)
                 // forceVisible will override cards to be visible
                 || cards_move.to_place == Player::PlaceEquip
                 || cards_move.from_place == Player::PlaceEquip
@@ -5175,9 +5270,25 @@ bool Room::notifyMoveCards(bool isLostPhase, QList<CardsMoveStruct> cards_moves,
                 || player->hasFlag("Global_GongxinOperator")
                 || (!cards_move.to_pile_name.isEmpty() && cards_move.to && cards_move.to->pileOpen(cards_move.to_pile_name, player->objectName()));
             // the player put someone's cards to the drawpile
-            arg << cards_move.toVariant();
+            if (open)
+                visibility[i] = '1';
         }
-        doNotify(player, isLostPhase ? S_COMMAND_LOSE_CARD : S_COMMAND_GET_CARD, arg);
+        if (!recipients.contains(visibility))
+            visibilities << visibility;
+        recipients[visibility] << player;
+    }
+
+    foreach (const QByteArray &visibility, visibilities) {
+        JsonArray arg;
+        arg << moveId;
+        for (int i = 0; i < move_num; i++)
+            arg << (visibility.at(i) == '1' ? open_moves.at(i) : hidden_moves.at(i));
+
+        Packet packet(S_SRC_ROOM | S_TYPE_NOTIFICATION | S_DEST_CLIENT, isLostPhase ? S_COMMAND_LOSE_CARD : S_COMMAND_GET_CARD);
+        packet.setMessageBody(arg);
+        SerializedPacket serialized(&packet);
+        foreach (ServerPlayer *player, recipients.value(visibility))
+            player->unicast(serialized);
     }
     return true;
 }
@@ -5439,6 +5550,7 @@ void Room::acquireSkill(ServerPlayer *player, const Skill *skill, bool open, boo
     if (player->getAcquiredSkills().contains(skill_name))
         return;
     player->acquireSkill(skill_name, head);
+    if (thread) thread->addPlayerSkill(skill_name);
 
     if (skill->getFrequency() == Skill::Limited && !skill->getLimitMark().isEmpty())
         setPlayerMark(player, skill->getLimitMark(), 1);
@@ -5578,7 +5690,7 @@ void Room::askForLuckCard()
         QList<ServerPlayer *> used;
         foreach (ServerPlayer *player, players) {
             const QVariant &clientReply = player->getClientReply();
-            if (!player->m_isClientResponseReady || !JsonUtils::isBool(clientReply) || !clientReply.toBool()) {
+            if (!player->getRequest().hasReply() || !JsonUtils::isBool(clientReply) || !clientReply.toBool()) {
                 players.removeOne(player);
                 continue;
             }
@@ -5723,7 +5835,7 @@ bool Room::askForDiscard(ServerPlayer *player, const QString &reason, int discar
 
     if (!optional) {
         DummyCard *dummy = new DummyCard;
-        dummy->deleteLater();
+        Sanguosha->autoReleaseCard(dummy);
         QList<int> jilei_list;
         QList<const Card *> handcards = player->getHandcards();
         foreach (const Card *card, handcards) {
@@ -5900,19 +6012,58 @@ QList<int> Room::askForExchange(ServerPlayer *player, const QString &reason, int
 
 void Room::setCardMapping(int card_id, ServerPlayer *owner, Player::Place place)
 {
-    owner_map.insert(card_id, owner);
-    place_map.insert(card_id, place == Player::DrawPileBottom ? Player::DrawPile : place);
+    if (card_id < 0 || card_id >= card_places.size()) return;
+    if (place == Player::DrawPileBottom)
+        place = Player::DrawPile;
+
+    card_owners[card_id] = owner;
+    int slot = card_slots.at(card_id);
+    if (slot != -1) {
+        Player::Place old_place = card_places.at(card_id);
+        if (old_place == place)
+            return;
+        // swap the last card of the old place into the freed slot
+        QVector<int> &old_cards = place_cards[old_place];
+        int last = old_cards.last();
+        old_cards[slot] = last;
+        card_slots[last] = slot;
+        old_cards.removeLast();
+    }
+
+    card_places[card_id] = place;
+    card_slots[card_id] = place_cards[place].length();
+    place_cards[place] << card_id;
 }
 
 ServerPlayer *Room::getCardOwner(int card_id) const
 {
-    return owner_map.value(card_id);
+    if (card_id < 0 || card_id >= card_owners.size()) return NULL;
+    return card_owners.at(card_id);
 }
 
 Player::Place Room::getCardPlace(int card_id) const
 {
-    if (card_id < 0) return Player::PlaceUnknown;
-    return place_map.value(card_id);
+    if (card_id < 0 || card_id >= card_places.size()) return Player::PlaceUnknown;
+    return card_places.at(card_id);
+}
+
+QList<int> Room::getCardIdsInPlace(Player::Place place, const ServerPlayer *owner) const
+{
+    if (place == Player::DrawPileBottom)
+        place = Player::DrawPile;
+    if (place < 0 || place >= Player::DrawPileBottom)
+        return QList<int>();
+
+    const QVector<int> &cards = place_cards[place];
+    if (owner == NULL)
+        return cards.toList();
+
+    QList<int> card_ids;
+    foreach (int card_id, cards) {
+        if (card_owners.at(card_id) == owner)
+            card_ids << card_id;
+    }
+    return card_ids;
 }
 
 QList<int> Room::getCardIdsOnTable(const Card *virtual_card) const
@@ -6516,7 +6667,7 @@ QList<const Card *> Room::askForPindianRace(ServerPlayer *from,const QList<Serve
     foreach (ServerPlayer *player, players) {
         const Card *c = NULL;
         JsonArray clientReply = player->getClientReply().value<JsonArray>();
-        if (!player->m_isClientResponseReady || clientReply.isEmpty() || !JsonUtils::isString(clientReply[0])) {
+        if (!player->getRequest().hasReply() || clientReply.isEmpty() || !JsonUtils::isString(clientReply[0])) {
             int card_id = player->getRandomHandCardId();
             c = Sanguosha->getCard(card_id);
         } else {
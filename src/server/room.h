@@ -27,6 +27,7 @@ class Scenario;
 class TrickCard;
 class GeneralSelector;
 class RoomThread;
+struct RoomTask;
 
 struct lua_State;
 struct LogMessage;
@@ -36,14 +37,36 @@ struct LogMessage;
 #include "roomstate.h"
 
 #include <QMutex>
+#include <QPointer>
+#include <QSemaphore>
+#include <QSet>
 #include <QStack>
 #include <QWaitCondition>
 #include <QThread>
+#include <QVector>
 
 typedef QMap<const ServerPlayer *, QStringList> SPlayerDataMap;
 
 typedef int LuaFunction;
 
+// what a room holds on to, sampled by the room thread when its game is over
+struct RoomMemoryUsage
+{
+    inline RoomMemoryUsage()
+        : luaBytes(0), recordBytes(0), players(0), transientCardPeak(0)
+    {
+    }
+    inline qint64 total() const
+    {
+        return luaBytes + recordBytes;
+    }
+
+    qint64 luaBytes;
+    qint64 recordBytes;
+    int players;
+    int transientCardPeak; // most transient cards held within one turn
+};
+
 class Room : public QThread
 {
     Q_OBJECT
@@ -62,12 +85,15 @@ public:
     };
 
     friend class RoomThread;
+    friend class RoomWorker;
 
     typedef void (Room::*Callback)(ServerPlayer *, const QVariant &);
     typedef bool (Room::*ResponseVerifyFunction)(ServerPlayer *, const QVariant &, void *);
 
     explicit Room(QObject *parent, const QString &mode);
     ~Room();
+    // starts the game on a worker of the RoomScheduler, or on the thread of the room
+    void launch();
     ServerPlayer *addSocket(ClientSocket *socket);
     inline int getId() const
     {
@@ -81,6 +107,10 @@ public:
     QString getMode() const;
     const Scenario *getScenario() const;
     RoomThread *getThread() const;
+    inline RoomMemoryUsage getMemoryUsage() const
+    {
+        return memoryUsage;
+    }
     ServerPlayer *getCurrent() const;
     void setCurrent(ServerPlayer *current);
     int alivePlayerCount() const;
@@ -174,7 +204,7 @@ public:
     bool doRequest(ServerPlayer *player, QSanProtocol::CommandType command, const QVariant &arg, bool wait);
 
     // Broadcast a request to a list of players and get the client responses. Call is blocking until all client
-    // replies or server times out, whichever is earlier. Check each player's m_isClientResponseReady to see if a valid
+    // replies or server times out, whichever is earlier. Check each player's getRequest().hasReply() to see if a valid
     // result has been received. The client response can be accessed by calling each player's getClientReply() function.
     // @param players
     //        The list of server players to carry out the command.
@@ -217,8 +247,8 @@ public:
     bool doBroadcastNotify(int command, const QVariant &arg);
     bool doBroadcastNotify(const QList<ServerPlayer *> &players, int command, const QVariant &arg);
 
-    // Ask a server player to wait for the client response. Call is blocking until client replies or server times out,
-    // whichever is earlier.
+    // Ask a server player to wait for the client response. Call is blocking until client replies, the request is
+    // released (offline, trust, cheat or surrender) or server times out, whichever is earlier.
     // @param player
     //        The server player to retrieve the client response.
     // @param timeOut
@@ -341,6 +371,8 @@ public:
     QList<int> getCardIdsOnTable(const QList<int> &card_ids) const;
     ServerPlayer *getCardOwner(int card_id) const;
     void setCardMapping(int card_id, ServerPlayer *owner, Player::Place place);
+    // unordered, owner NULL means the cards of every owner
+    QList<int> getCardIdsInPlace(Player::Place place, const ServerPlayer *owner = NULL) const;
 
     void drawCards(ServerPlayer *player, int n, const QString &reason = QString());
     void drawCards(QList<ServerPlayer *> players, int n, const QString &reason = QString());
@@ -436,6 +468,8 @@ public:
     void changeSkinCommand(ServerPlayer *player, const QVariant &arg);
 
     void processClientReply(ServerPlayer *player, const QSanProtocol::Packet &packet);
+    // may be called in any thread, the reply is processed by the room thread while it waits for replies
+    void postClientReply(ServerPlayer *player, const QSanProtocol::Packet &packet);
 
     //cheat commands executed via speakCommand
     QHash<QString, Callback> cheatCommands;
@@ -572,6 +606,8 @@ private:
     void _fillMoveInfo(CardsMoveStruct &moves, int card_index) const;
     QList<CardsMoveOneTimeStruct> _mergeMoves(QList<CardsMoveStruct> cards_moves);
     QList<CardsMoveStruct> _separateMoves(QList<CardsMoveOneTimeStruct> moveOneTimes);
+    void _triggerMoveEvent(TriggerEvent triggerEvent, QList<CardsMoveOneTimeStruct> &moveOneTimes);
+    void _releaseReply(ServerPlayer *player);
     void _moveCards(QList<CardsMoveStruct> cards_moves, bool forceMoveVisible, bool ignoreChanges);
     QStringList _chooseDefaultGenerals(ServerPlayer *player) const;
     bool _setPlayerGeneral(ServerPlayer *player, const QString &generalName, bool isFirst);
@@ -580,6 +616,13 @@ private:
     QStringList used_general;
     int player_count;
     ServerPlayer *current;
+
+    // seat order rotated to start from the current player, indexed by include_dead;
+    // kept until the seat topology, the player list or the current player changes
+    mutable QList<ServerPlayer *> m_seatViews[2];
+    mutable QList<ServerPlayer *> m_seatViewPlayers;
+    mutable ServerPlayer *m_seatViewStarter;
+    mutable int m_seatViewEpoch;
     QList<int> pile1, pile2;
     QList<int> table_cards;
     QList<int> *m_drawPile, *m_discardPile;
@@ -591,10 +634,28 @@ private:
     mutable QMutex m_mutex;
     lua_State *L;
     QList<AI *> ais;
+    QSet<AI *> native_ais; // made by cloneAI() itself rather than by the Lua state, so they are ours to delete
+    RoomMemoryUsage memoryUsage;
+    void sampleMemoryUsage();
 
     RoomThread *thread;
-    QSemaphore _m_semRaceRequest; // When race starts, server waits on his semaphore for the first replier
-    QSemaphore _m_semRoomMutex; // Provide per-room  (rather than per-player) level protection of any shared variables
+    QSemaphore _m_semReplyReady; // Released for every posted reply and release, the room thread waits on it
+    RoomTask *m_task; // the game runs as this task instead of the thread if the RoomScheduler is on
+
+    // wait for the next reply or release, on the task or on the semaphore, see _m_semReplyReady
+    void _wakeUp();
+    bool _waitForWakeUp(qint64 msecs = -1);
+    void _forgetWakeUps();
+
+    // replies posted by the socket threads and releases posted by the main thread,
+    // only the room thread applies them to the requests, see ClientRequest
+    QMutex m_replyMutex;
+    QList<QPair<QPointer<ServerPlayer>, QSanProtocol::Packet> > m_replyQueue;
+    QList<QPointer<ServerPlayer> > m_releaseQueue;
+    void _processClientReplies();
+    // waits on the requests of all the players at once, until each is done or past its deadline,
+    // or until timeOut milliseconds (-1 for no limit) have passed
+    void _waitForReplies(const QList<ServerPlayer *> &players, time_t timeOut = -1);
 
 
     QHash<QSanProtocol::CommandType, Callback> interactions;
@@ -607,11 +668,15 @@ private:
 
     //helper variables for race request function
     bool _m_raceStarted;
-    ServerPlayer *_m_raceWinner;
+    QList<ServerPlayer *> _m_raceRepliers; // players who replied to the race, in order
     ServerPlayer *_m_AIraceWinner;
+    int _m_AIraceRespondTime; // msecs after the race starts when _m_AIraceWinner answers, -1 if it does not
 
-    QMap<int, Player::Place> place_map;
-    QMap<int, ServerPlayer *> owner_map;
+    // where every card is, indexed by card id, see setCardMapping()
+    QVector<Player::Place> card_places;
+    QVector<ServerPlayer *> card_owners;
+    QVector<int> card_slots; // index of the card in place_cards, -1 if unmapped
+    QVector<int> place_cards[Player::DrawPileBottom];
 
     const Card *provided;
     bool has_provided;
@@ -656,7 +721,6 @@ private:
     QList<CardsMoveStruct> _breakDownCardMoves(QList<CardsMoveStruct> &cards_moves);
 
 private slots:
-    void endaskfornull();
     void reportDisconnection();
     void processClientPacket(const QSanProtocol::Packet &packet);
     void reportInvalidPacket(const QByteArray &message);
@@ -668,6 +732,8 @@ signals:
     void room_message(const QString &msg);
     void game_start();
     void game_over(const QString &winner);
+    // run() has returned, whether on the thread or as a task
+    void run_finished();
 };
 
 typedef Room *RoomStar;
@@ -0,0 +1,411 @@
+// ucontext is only declared by the X/Open headers of macOS
+#if defined(__APPLE__) && !defined(_XOPEN_SOURCE)
+#define _XOPEN_SOURCE 600
+#endif
+
+/********************************************************************
+    Copyright (c) 2013-2015 - Mogara
+
+    This file is part of QSanguosha-Hegemony.
+
+    This game is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 3.0
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    See the LICENSE file for more details.
+
+    Mogara
+    *********************************************************************/
+
+#include "roomscheduler.h"
+#include "room.h"
+#include "engine.h"
+#include "settings.h"
+#include "compiler-specific.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QThread>
+#include <QWaitCondition>
+
+#ifdef QSAN_ROOM_TASKS
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <ucontext.h>
+#endif
+
+struct RoomTask
+{
+    enum State
+    {
+        Ready, Running, Parked, Done
+    };
+
+    Room *room;
+    RoomWorker *worker;
+    State state;
+    int wakeUps;
+    bool sleeping; // parked by sleep(), which only its deadline ends
+    qint64 deadline; // on the clock of the worker, -1 for none
+#ifdef Q_OS_WIN
+    LPVOID fiber;
+#else
+    ucontext_t context;
+    char *stack;
+#endif
+};
+
+static QSAN_THREAD_LOCAL RoomTask *CurrentTask = NULL;
+
+class RoomWorker : public QThread
+{
+public:
+    RoomWorker()
+        : stopping(false)
+    {
+        clock.start();
+    }
+
+    void post(RoomTask *task)
+    {
+        QMutexLocker locker(&mutex);
+        ready << task;
+        cond.wakeOne();
+    }
+
+    void stop()
+    {
+        mutex.lock();
+        stopping = true;
+        cond.wakeOne();
+        mutex.unlock();
+        wait();
+    }
+
+    void wake(RoomTask *task)
+    {
+        QMutexLocker locker(&mutex);
+        ++task->wakeUps;
+        if (task->state == RoomTask::Parked && !task->sleeping)
+            resume(task);
+    }
+
+    // runs on the task itself, only this worker resumes it, so a wake-up between
+    // the unlock and the switch just finds it in the ready list afterwards
+    bool park(RoomTask *task, qint64 msecs, bool sleeping)
+    {
+        mutex.lock();
+        if (!sleeping && task->wakeUps > 0) {
+            --task->wakeUps;
+            mutex.unlock();
+            return true;
+        }
+        if (msecs == 0) {
+            mutex.unlock();
+            return false;
+        }
+        task->state = RoomTask::Parked;
+        task->sleeping = sleeping;
+        task->deadline = msecs < 0 ? -1 : clock.elapsed() + msecs;
+        parked << task;
+        mutex.unlock();
+
+#ifdef Q_OS_WIN
+        SwitchToFiber(context);
+#else
+        swapcontext(&task->context, &context);
+#endif
+
+        if (sleeping)
+            return false;
+        QMutexLocker locker(&mutex);
+        if (task->wakeUps == 0)
+            return false;
+        --task->wakeUps;
+        return true;
+    }
+
+    void forgetWakeUps(RoomTask *task)
+    {
+        QMutexLocker locker(&mutex);
+        task->wakeUps = 0;
+    }
+
+protected:
+    virtual void run()
+    {
+#ifdef Q_OS_WIN
+        context = ConvertThreadToFiber(NULL);
+#endif
+        forever {
+            RoomTask *task = next();
+            if (task == NULL)
+                break;
+
+            CurrentTask = task;
+            Sanguosha->registerRoom(task->room);
+#ifdef Q_OS_WIN
+            SwitchToFiber(task->fiber);
+#else
+            swapcontext(&context, &task->context);
+#endif
+            Sanguosha->unregisterRoom();
+            CurrentTask = NULL;
+
+            if (task->state == RoomTask::Done) {
+#ifdef Q_OS_WIN
+                DeleteFiber(task->fiber);
+                task->fiber = NULL;
+#else
+                delete[] task->stack;
+                task->stack = NULL;
+#endif
+                // what the game has left to deleteLater() goes with the task, as it would with its thread
+                QCoreApplication::sendPostedEvents(NULL, QEvent::DeferredDelete);
+                // the room may be deleted from now on, which releases the task
+                emit task->room->run_finished();
+            }
+        }
+#ifdef Q_OS_WIN
+        ConvertFiberToThread();
+#endif
+    }
+
+private:
+    // under the mutex
+    void resume(RoomTask *task)
+    {
+        parked.removeOne(task);
+        task->state = RoomTask::Ready;
+        ready << task;
+        cond.wakeOne();
+    }
+
+    // waits for a task to run, parked tasks come back once their deadline has passed
+    RoomTask *next()
+    {
+        QMutexLocker locker(&mutex);
+        forever {
+            if (stopping)
+                return NULL;
+
+            qint64 now = clock.elapsed();
+            qint64 nearest = -1;
+            foreach (RoomTask *task, parked) {
+                if (task->deadline < 0)
+                    continue;
+                if (task->deadline <= now)
+                    resume(task);
+                else if (nearest < 0 || task->deadline < nearest)
+                    nearest = task->deadline;
+            }
+
+            if (!ready.isEmpty()) {
+                RoomTask *task = ready.takeFirst();
+                task->state = RoomTask::Running;
+                return task;
+            }
+
+            if (nearest < 0)
+                cond.wait(&mutex);
+            else
+                cond.wait(&mutex, nearest - now);
+        }
+    }
+
+#ifdef Q_OS_WIN
+    static VOID CALLBACK runTask(LPVOID)
+#else
+    static void runTask()
+#endif
+    {
+        RoomTask *task = CurrentTask;
+        task->room->run();
+
+        RoomWorker *worker = task->worker;
+        worker->mutex.lock();
+        task->state = RoomTask::Done;
+        worker->mutex.unlock();
+
+        // a fiber must never return, and uc_link is not trusted to restore the worker either
+#ifdef Q_OS_WIN
+        SwitchToFiber(worker->context);
+#else
+        setcontext(&worker->context);
+#endif
+    }
+
+    QMutex mutex;
+    QWaitCondition cond;
+    QList<RoomTask *> ready;
+    QList<RoomTask *> parked;
+    QElapsedTimer clock;
+    bool stopping;
+#ifdef Q_OS_WIN
+    LPVOID context;
+#else
+    ucontext_t context;
+#endif
+
+    friend class RoomScheduler;
+};
+
+RoomScheduler *RoomScheduler::getInstance()
+{
+    static const int count = Config.value("RoomWorkers", 0).toInt();
+    if (count <= 0)
+        return NULL;
+
+    // in KB, the tasks need as much stack as a room thread of the platform would have
+    static const uint stack_size = Config.value("RoomStackSize", 0).toUInt();
+    static RoomScheduler scheduler(count, stack_size > 0 ? stack_size : 8192);
+    return &scheduler;
+}
+
+RoomScheduler::RoomScheduler(int workerCount, uint stackSize)
+    : next(0), stackSize(stackSize * 1024)
+{
+    for (int i = 0; i < workerCount; i++) {
+        RoomWorker *worker = new RoomWorker;
+        workers << worker;
+        worker->start();
+    }
+}
+
+RoomScheduler::~RoomScheduler()
+{
+    // tasks still parked are abandoned with the process
+    foreach (RoomWorker *worker, workers) {
+        worker->stop();
+        delete worker;
+    }
+}
+
+RoomTask *RoomScheduler::schedule(Room *room)
+{
+    RoomTask *task = new RoomTask;
+    task->room = room;
+    task->worker = workers.at(next);
+    task->state = RoomTask::Ready;
+    task->wakeUps = 0;
+    task->sleeping = false;
+    task->deadline = -1;
+
+#ifdef Q_OS_WIN
+    task->fiber = CreateFiberEx(0, stackSize, FIBER_FLAG_FLOAT_SWITCH, &RoomWorker::runTask, NULL);
+    if (task->fiber == NULL) {
+        delete task;
+        return NULL;
+    }
+#else
+    task->stack = new char[stackSize];
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = stackSize;
+    task->context.uc_link = NULL;
+    makecontext(&task->context, &RoomWorker::runTask, 0);
+#endif
+
+    next = (next + 1) % workers.length();
+    task->worker->post(task);
+    return task;
+}
+
+void RoomScheduler::release(RoomTask *task)
+{
+    if (task == NULL)
+        return;
+
+    Q_ASSERT(task->state == RoomTask::Done);
+    delete task;
+}
+
+RoomTask *RoomScheduler::currentTask()
+{
+    return CurrentTask;
+}
+
+void RoomScheduler::wake(RoomTask *task)
+{
+    task->worker->wake(task);
+}
+
+bool RoomScheduler::park(qint64 msecs)
+{
+    RoomTask *task = CurrentTask;
+    Q_ASSERT(task != NULL);
+    return task->worker->park(task, msecs, false);
+}
+
+void RoomScheduler::forgetWakeUps(RoomTask *task)
+{
+    task->worker->forgetWakeUps(task);
+}
+
+void RoomScheduler::sleep(qint64 msecs)
+{
+    RoomTask *task = CurrentTask;
+    if (task == NULL)
+        QThread::msleep(msecs);
+    else if (msecs > 0)
+        task->worker->park(task, msecs, true);
+}
+
+#else
+
+RoomScheduler *RoomScheduler::getInstance()
+{
+    return NULL;
+}
+
+RoomScheduler::RoomScheduler(int, uint)
+    : next(0), stackSize(0)
+{
+}
+
+RoomScheduler::~RoomScheduler()
+{
+}
+
+RoomTask *RoomScheduler::schedule(Room *)
+{
+    return NULL;
+}
+
+void RoomScheduler::release(RoomTask *)
+{
+}
+
+RoomTask *RoomScheduler::currentTask()
+{
+    return NULL;
+}
+
+void RoomScheduler::wake(RoomTask *)
+{
+}
+
+bool RoomScheduler::park(qint64)
+{
+    return false;
+}
+
+void RoomScheduler::forgetWakeUps(RoomTask *)
+{
+}
+
+void RoomScheduler::sleep(qint64 msecs)
+{
+    QThread::msleep(msecs);
+}
+
+#endif
@@ -0,0 +1,74 @@
+/********************************************************************
+    Copyright (c) 2013-2015 - Mogara
+
+    This file is part of QSanguosha-Hegemony.
+
+    This game is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 3.0
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    See the LICENSE file for more details.
+
+    Mogara
+    *********************************************************************/
+
+#ifndef _ROOM_SCHEDULER_H
+#define _ROOM_SCHEDULER_H
+
+class Room;
+class RoomWorker;
+struct RoomTask;
+
+#include <QList>
+#include <QtGlobal>
+
+// fibers are made with the Win32 fiber API or with ucontext, which Android lacks
+#if defined(Q_OS_WIN) || ((defined(Q_OS_LINUX) || defined(Q_OS_MAC)) && !defined(Q_OS_ANDROID))
+#define QSAN_ROOM_TASKS
+#endif
+
+// Runs the game loops of rooms as tasks on a fixed pool of worker threads,
+// instead of one thread per room. Each task has a stack of its own (a fiber)
+// and stays on the worker it was given. Where a room waits for its clients
+// or delays, the task is parked and its worker goes on with another room.
+//
+// It is enabled by the "RoomWorkers" setting, the number of workers. With 0,
+// or on a platform without fibers, every room runs on its own thread.
+class RoomScheduler
+{
+public:
+    // NULL when the rooms run on their own threads
+    static RoomScheduler *getInstance();
+
+    // runs Room::run() as a task, the room emits run_finished() once it returns
+    RoomTask *schedule(Room *room);
+    // frees what is left of a finished task
+    static void release(RoomTask *task);
+
+    // the task which the current thread runs, NULL outside of any task
+    static RoomTask *currentTask();
+    // from any thread: counts a wake-up for the task, and resumes it if it is parked
+    static void wake(RoomTask *task);
+    // from the task: parks it until a wake-up comes or msecs (-1 for no limit) pass.
+    // Returns true if it was woken up, like QSemaphore::tryAcquire()
+    static bool park(qint64 msecs);
+    static void forgetWakeUps(RoomTask *task);
+    // sleeps without holding up the worker when called from a task
+    static void sleep(qint64 msecs);
+
+private:
+    RoomScheduler(int workerCount, uint stackSize);
+    ~RoomScheduler();
+
+    QList<RoomWorker *> workers;
+    int next;
+    uint stackSize; // in bytes
+};
+
+#endif
@@ -29,8 +29,10 @@
 #include "standard.h"
 #include "json.h"
 #include "structs.h"
+#include "roomscheduler.h"
 
 #include <QTime>
+#include <QThread>
 
 #ifdef QSAN_UI_LIBRARY_AVAILABLE
 #pragma message WARN("UI elements detected in server side!!!")
@@ -74,8 +76,27 @@ QString HegemonyMode::GetMappedKingdom(const QString &role)
     return kingdoms[role];
 }
 
+RoomProfile::RoomProfile()
+    : turns(0)
+{
+    for (int i = 0; i <= Player::PhaseNone; i++) {
+        phaseCount[i] = 0;
+        phaseNsecs[i] = 0;
+    }
+}
+
+void RoomProfile::merge(const RoomProfile &other)
+{
+    turns += other.turns;
+    for (int i = 0; i <= Player::PhaseNone; i++) {
+        phaseCount[i] += other.phaseCount[i];
+        phaseNsecs[i] += other.phaseNsecs[i];
+    }
+}
+
 RoomThread::RoomThread(Room *room)
-    : room(room)
+    : room(room), priority_generation(TriggerSkill::getPriorityGeneration()), trigger_table_constructed(false),
+    profiling(room->property("profile").toBool())
 {
     //Create GameRule inside the thread where RoomThread exists
     game_rule = new GameRule(this);
@@ -86,6 +107,9 @@ void RoomThread::addPlayerSkills(ServerPlayer *player, bool invoke_game_start)
     QVariant void_data;
     bool invoke_verify = false;
 
+    foreach (const Skill *skill, player->getSkillList(false, false))
+        addPlayerSkill(skill->objectName());
+
     foreach (const TriggerSkill *skill, player->getTriggerSkills()) {
 
         if (invoke_game_start && skill->getTriggerEvents().contains(GameStart))
@@ -99,19 +123,53 @@ void RoomThread::addPlayerSkills(ServerPlayer *player, bool invoke_game_start)
 
 void RoomThread::constructTriggerTable()
 {
+    // most skills of the engine come with generals who are not in this room, so they are left out
+    // until somebody gets them. A ViewHasSkill which does not tell what it lends may lend any of them.
+    bool include_general_skills = false;
+    foreach (const ViewHasSkill *skill, Sanguosha->getViewHasSkills()) {
+        if (skill->canViewHasAnySkill()) {
+            include_general_skills = true;
+            break;
+        }
+    }
+
     foreach (QString skill_name, Sanguosha->getSkillNames()) {
         const TriggerSkill *skill = Sanguosha->getTriggerSkill(skill_name);
-        if (skill) addTriggerSkill(skill);
+        if (skill == NULL)
+            continue;
+        if (!include_general_skills && (Sanguosha->getSkillTraits(skill->getId()) & Engine::GeneralSkillTrait))
+            continue;
+        addTriggerSkill(skill);
+    }
+
+    trigger_table_constructed = true;
+    foreach (const ViewHasSkill *skill, Sanguosha->getViewHasSkills()) {
+        foreach (const QString &skill_name, skill->getViewHasSkills())
+            addPlayerSkill(skill_name);
     }
     foreach(ServerPlayer *player, room->getPlayers())
         addPlayerSkills(player, true);
 }
 
+void RoomThread::addPlayerSkill(const QString &skill_name)
+{
+    // the skills the players have when the game starts are added by constructTriggerTable()
+    if (!trigger_table_constructed)
+        return;
+
+    addTriggerSkill(Sanguosha->getTriggerSkill(skill_name));
+    foreach (const Skill *skill, Sanguosha->getRelatedSkills(skill_name))
+        addTriggerSkill(qobject_cast<const TriggerSkill *>(skill));
+}
+
 void RoomThread::actionNormal(GameRule *game_rule)
 {
     try {
         forever{
+            if (profiling) profile.turns++;
             trigger(TurnStart, room, room->getCurrent());
+            // nothing is on the event stack between turns
+            room->getRoomState()->releaseTransientCards();
             if (room->isFinished()) break;
             ServerPlayer *regular_next = qobject_cast<ServerPlayer *>(room->getCurrent()->getNextAlive(1, false));
             while (!room->getTag("ExtraTurnList").isNull()) {
@@ -121,7 +179,9 @@ void RoomThread::actionNormal(GameRule *game_rule)
                     room->setTag("ExtraTurnList", QVariant::fromValue(extraTurnList));
                     ServerPlayer *next = room->findPlayer(extraTurnPlayer);
                     room->setCurrent(next);
+                    if (profiling) profile.turns++;
                     trigger(TurnStart, room, next);
+                    room->getRoomState()->releaseTransientCards();
                     if (room->isFinished()) break;
                 } else
                     room->removeTag("ExtraTurnList");
@@ -161,7 +221,7 @@ void RoomThread::_handleTurnBrokenNormal(GameRule *game_rule)
     }
 }
 
-void RoomThread::run()
+void RoomThread::runGame()
 {
     qsrand(QTime(0, 0, 0).secsTo(QTime::currentTime()));
     Sanguosha->registerRoom(room);
@@ -182,7 +242,6 @@ void RoomThread::run()
         }
         catch (TriggerEvent triggerEvent) {
             if (triggerEvent == GameFinished) {
-                terminate();
                 Sanguosha->unregisterRoom();
                 return;
             } else
@@ -206,11 +265,6 @@ void RoomThread::run()
     }
 }
 
-// static bool compareByPriority(const TriggerSkill *a, const TriggerSkill *b)
-// {
-//     return a->getCurrentPriority() > b->getCurrentPriority();
-// }
-
 bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *target, QVariant &data)
 {
     // push it to event stack
@@ -218,90 +272,64 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
     event_stack.push_back(triplet);
 
     bool broken = false;
-    QList<const TriggerSkill *> will_trigger;
+    bool will_trigger = false;
     QSet<const TriggerSkill *> triggerable_tested;
-    QList<const TriggerSkill *> rules; // we can't get a GameRule with Engine::getTriggerSkill() :(
-    TriggerList trigger_who;
+    TriggerRecordMap trigger_who;
+    static const int ask_for_skill_cost = Sanguosha->getAtom("Global_askForSkillCost");
+
+    if (priority_generation != TriggerSkill::getPriorityGeneration())
+        rebuildTriggerTables();
 
     try {
         QList<const TriggerSkill *> triggered;
-        QList<const TriggerSkill *> &skills = skill_table[triggerEvent];
-        //         foreach (const TriggerSkill *skill,skills){
-        //             skill->setCurrentPriority(skill->getDynamicPriority(triggerEvent));
-        //         }
-
-        qStableSort(skills.begin(), skills.end(), [triggerEvent](const TriggerSkill *a, const TriggerSkill *b) {return a->getDynamicPriority(triggerEvent) > b->getDynamicPriority(triggerEvent); });
+        double triggered_priority = 0;
+        int same_priority_count = 0; // the skills at the head of "triggered" which share triggered_priority
 
         do {
             trigger_who.clear();
-            foreach (const TriggerSkill *skill, skills) {
-                if (!triggered.contains(skill)) {
+            // the buckets are sorted by priority, so only the first one which has any untested skill is collected,
+            // and a bucket is done as soon as something in it can be triggered
+            foreach (const TriggerBucket &bucket, trigger_table[triggerEvent]) {
+                foreach (const TriggerSkill *skill, bucket.skills) {
+                    if (triggerable_tested.contains(skill))
+                        continue;
+
+                    room->tryPause();
                     if (skill->objectName() == "game_rule" || (room->getScenario()
                         && room->getScenario()->objectName() == skill->objectName())) {
-                        room->tryPause();
-                        if (will_trigger.isEmpty()
-                            || skill->getDynamicPriority(triggerEvent) == will_trigger.last()->getDynamicPriority(triggerEvent)) {
-                            will_trigger.append(skill);
-                            trigger_who[NULL].append(skill->objectName());// Don't assign game rule to some player.
-                            rules.append(skill);
-                        } else if (skill->getDynamicPriority(triggerEvent) != will_trigger.last()->getDynamicPriority(triggerEvent))
-                            break;
-                        triggered.prepend(skill);
+                        will_trigger = true;
+                        trigger_who[NULL] << TriggerRecord(skill);// Don't assign game rule to some player.
                     } else {
-                        room->tryPause();
-                        if (will_trigger.isEmpty()
-                            || skill->getDynamicPriority(triggerEvent) == will_trigger.last()->getDynamicPriority(triggerEvent)) {
-                            skill->record(triggerEvent, room, target, data); //to record something for next.
-                            TriggerList triggerSkillList = skill->triggerable(triggerEvent, room, target, data);
-                            foreach (ServerPlayer *p, room->getPlayers()) {
-                                if (triggerSkillList.contains(p) && !triggerSkillList.value(p).isEmpty()) {
-                                    foreach (const QString &skill_name, triggerSkillList.value(p)) {
-                                        const TriggerSkill *trskill = Sanguosha->getTriggerSkill(skill_name);
-                                        if (trskill) { // "yiji"
-                                            will_trigger.append(trskill);
-                                            trigger_who[p].append(skill_name);
-
-                                        } else {
-                                            trskill = Sanguosha->getTriggerSkill(skill_name.split("'").last());
-                                            if (trskill) { // "sgs1'songwei"
-                                                will_trigger.append(trskill);
-                                                trigger_who[p].append(skill_name);
-                                            } else {
-                                                trskill = Sanguosha->getTriggerSkill(skill_name.split("->").first());
-                                                if (trskill) { // "tieqi->sgs4+sgs8+sgs1+sgs2"
-                                                    will_trigger.append(trskill);
-                                                    trigger_who[p].append(skill_name);
-                                                }
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        } else if (skill->getDynamicPriority(triggerEvent) != will_trigger.last()->getDynamicPriority(triggerEvent))
-                            break;
+                        skill->record(triggerEvent, room, target, data); //to record something for next.
+                        if (collectTriggerRecords(trigger_who, skill->triggerRecords(triggerEvent, room, target, data), room->getPlayers()))
+                            will_trigger = true;
+                    }
 
-                        triggered.prepend(skill);
+                    triggered.prepend(skill);
+                    if (same_priority_count > 0 && triggered_priority == bucket.priority) {
+                        ++same_priority_count;
+                    } else {
+                        triggered_priority = bucket.priority;
+                        same_priority_count = 1;
                     }
+                    triggerable_tested << skill;
                 }
-                triggerable_tested << skill;
+                if (will_trigger)
+                    break;
             }
-            if (!will_trigger.isEmpty()) {
-                will_trigger.clear();
+            if (will_trigger) {
+                will_trigger = false;
                 //foreach (ServerPlayer *p, room->getPlayers()) {
                 foreach (ServerPlayer *p, room->getAllPlayers(true)) {
                     if (!trigger_who.contains(p)) continue;
                     QStringList already_triggered;
                     forever{
-                        QStringList who_skills = trigger_who.value(p);
+                        QList<TriggerRecord> who_skills = trigger_who.value(p);
                         if (who_skills.isEmpty()) break;
                         bool has_compulsory = false;
-                        foreach (const QString &skill, who_skills) {
-                            const TriggerSkill *trskill = Sanguosha->getTriggerSkill(skill); // "yiji"
-                            if (!trskill)
-                                trskill = Sanguosha->getTriggerSkill(skill.split("'").last()); // "sgs1'songwei"
-                            if (!trskill)
-                                trskill = Sanguosha->getTriggerSkill(skill.split("->").first()); // "tieqi->sgs4+sgs8+sgs1+sgs2"
-                            if (trskill && (p->hasShownSkill(trskill) || trskill->isGlobal())
+                        foreach (const TriggerRecord &record, who_skills) {
+                            const TriggerSkill *trskill = record.skill;
+                            if ((p->hasShownSkill(trskill) || trskill->isGlobal())
                                 && (trskill->getFrequency() == Skill::Compulsory
                                 //|| trskill->getFrequency() == Skill::NotCompulsory //for Paoxia, Anjian, etc.
                                 || trskill->getFrequency() == Skill::Wake)) {
@@ -309,26 +337,22 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
                                 break;
                             }
                         }
-                        will_trigger.clear();
                         QStringList names, back_up;
-                        foreach (const QString &skill_name, who_skills) {
-                            if (skill_name.contains("->")) { // "tieqi->sgs4+sgs8+sgs1+sgs2"
-                                QString realSkillName = skill_name.split("->").first().split("?").last(); // "tieqi"
-                                QString skill_position;
-                                if (skill_name.contains("?")) skill_position = skill_name.split("?").first();
-                                QStringList targets = skill_name.split("->").last().split("+"); // ["sgs4", "sgs8", "sgs1", "sgs2"]
+                        foreach (const TriggerRecord &record, who_skills) {
+                            if (!record.targets.isEmpty()) { // "tieqi->sgs4+sgs8+sgs1+sgs2"
+                                const TriggerSkill *trskill = record.skill;
+                                const QString realSkillName = trskill->objectName(); // "tieqi"
                                 int index = 1; // this index is for UI only
                                 bool cannotSkip = false;
-                                const TriggerSkill *trskill = Sanguosha->getTriggerSkill(realSkillName);
-                                if (trskill && p->hasShownSkill(trskill)
+                                if (p->hasShownSkill(trskill)
                                     && (trskill->getFrequency() == Skill::Compulsory
                                     //|| trskill->getFrequency() == Skill::NotCompulsory //for Paoxia, Anjian, etc.
                                     || trskill->getFrequency() == Skill::Wake))
                                     cannotSkip = true;
-                                foreach (const QString &target, targets) {
+                                foreach (const QString &target, record.targets) {
                                     QString name;
-                                    if (!skill_position.isEmpty())
-                                        name = QString("%1?%2->%3&%4").arg(skill_position).arg(realSkillName).arg(target).arg(index);
+                                    if (!record.position.isEmpty())
+                                        name = QString("%1?%2->%3&%4").arg(record.position).arg(realSkillName).arg(target).arg(index);
                                     else
                                         name = QString("%1->%2&%3").arg(realSkillName).arg(target).arg(index);
                                     if (names.contains(name))
@@ -340,6 +364,7 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
                                     ++index;
                                 }
                             } else {
+                                const QString skill_name = record.toString();
                                 if (names.contains(skill_name))
                                     back_up << skill_name;
                                 else
@@ -360,7 +385,7 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
                         }
                         if (name.isEmpty()) {
                             if (p && !p->hasShownAllGenerals())
-                                p->setFlags("Global_askForSkillCost");           // TriggerOrder need protect
+                                p->setFlag(ask_for_skill_cost);           // TriggerOrder need protect
                             if (names.length() == 1 && back_up.isEmpty() && names.first().contains("AskForGeneralShow") && p != NULL) {
                                 // users should be able to cancel if it triggers someskill 100 times.
                                 //name = names.first();                                                       //edit for both generals have the same skill, it must be check
@@ -392,8 +417,8 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
                                 name = room->askForTriggerOrder(p, reason, map, !has_compulsory, data);
                             } else
                                 name = names.last();
-                            if (p && p->hasFlag("Global_askForSkillCost"))
-                                p->setFlags("-Global_askForSkillCost");
+                            if (p)
+                                p->setFlag(ask_for_skill_cost, false);
                         }
 
                         if (name == "cancel") break;
@@ -434,7 +459,7 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
 
                         //----------------------------------------------- TriggerSkill::cost
                         if (p && !p->hasShownSkill(result_skill))
-                            p->setFlags("Global_askForSkillCost");           // SkillCost need protect
+                            p->setFlag(ask_for_skill_cost);           // SkillCost need protect
                         already_triggered.append(name);
                         bool do_effect = false;
                         if (result_skill->cost(triggerEvent, room, skill_target, data, p)) {
@@ -448,8 +473,8 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
                             }
                         }
 
-                        if (p && p->hasFlag("Global_askForSkillCost"))          // for next time
-                            p->setFlags("-Global_askForSkillCost");
+                        if (p)                                                  // for next time
+                            p->setFlag(ask_for_skill_cost, false);
                         //-----------------------------------------------
 
                         //----------------------------------------------- TriggerSkill::effect
@@ -478,38 +503,14 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
                         p->tag.remove("JustShownSkill");
 
                         trigger_who.clear();
-                        foreach (const TriggerSkill *skill, triggered) {
+                        for (int i = 0; i < same_priority_count; ++i) {
+                            const TriggerSkill *skill = triggered.at(i);
+                            room->tryPause();
                             if (skill->objectName() == "game_rule" || (room->getScenario()
-                                && room->getScenario()->objectName() == skill->objectName())) {
-                                room->tryPause();
+                                && room->getScenario()->objectName() == skill->objectName()))
                                 continue; // dont assign them to some person.
-                            } else {
-                                room->tryPause();
-                                if (skill->getDynamicPriority(triggerEvent) == triggered.first()->getDynamicPriority(triggerEvent)) {
-                                    TriggerList triggerSkillList = skill->triggerable(triggerEvent, room, target, data);
-                                    foreach (ServerPlayer *player, room->getAllPlayers(true)) {
-                                        if (triggerSkillList.contains(player) && !triggerSkillList.value(player).isEmpty()) {
-                                            foreach (const QString &skill_name, triggerSkillList.value(player)) {
-                                                const TriggerSkill *trskill = Sanguosha->getTriggerSkill(skill_name);
-                                                if (trskill) // "yiji"
-                                                    trigger_who[player].append(skill_name);
-                                                else {
-                                                    trskill = Sanguosha->getTriggerSkill(skill_name.split("'").last());
-                                                    if (trskill) // "sgs1'songwei"
-                                                        trigger_who[player].append(skill_name);
-                                                    else {
-                                                        trskill = Sanguosha->getTriggerSkill(skill_name.split("->").first());
-                                                        if (trskill) { // "tieqi->sgs4+sgs8+sgs1+sgs2"
-                                                            trigger_who[player].append(skill_name);
-                                                        }
-                                                    }
-                                                }
-                                            }
-                                        }
-                                    }
-                                } else
-                                    break;
-                            }
+
+                            collectTriggerRecords(trigger_who, skill->triggerRecords(triggerEvent, room, target, data), room->getAllPlayers(true));
                         }
 
                         foreach (const QString &s, already_triggered) {
@@ -517,48 +518,40 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
                                 // s is "skillName->targetObjectName&number"
                                 QString skillName_copy = s.split("->").first();
                                 QString triggered_target = s.split("->").last().split("&").first();
-                                foreach (const QString &skill, trigger_who[p]) {
-                                    if (skill.contains("->")) { // "tieqi->sgs4+sgs8+sgs1+sgs2"
-                                        if (skill.split("->").first().split("?").last() == skillName_copy) { // check skill
-                                            QStringList targets = skill.split("->").last().split("+");
-                                            if (!targets.contains(triggered_target)) {
-                                                // here may cause a bug, if the first triggerlist contains "triggered_target"
-                                                // but this triggerlist doesn't contain "triggered_target". @todo_Slob
-                                                continue;
-                                            } else {
-                                                int n = targets.indexOf(triggered_target);
-                                                if (n == targets.length() - 1)
-                                                    trigger_who[p].removeOne(skill); // triggered_target is the last one.
-                                                else {
-                                                    QStringList targets_after = targets.mid(n + 1);
-                                                    // remove the targets before triggered_target
-                                                    QString skill_after;
-                                                    if (!skill_position.isEmpty())                           //it has triggered already and wont check which general to invoke again. by weidouncle
-                                                        skill_after = QString("%1?%2->%3").arg(skill_position).arg(skillName_copy).arg(targets_after.join("+"));
-                                                    else
-                                                        skill_after = QString("%1->%2").arg(skillName_copy).arg(targets_after.join("+"));
-                                                    trigger_who[p].replaceInStrings(skill, skill_after);
-                                                }
-                                            }
-                                        } else
-                                            continue;
+                                QList<TriggerRecord> &records = trigger_who[p];
+                                for (int i = records.length() - 1; i >= 0; --i) {
+                                    TriggerRecord &record = records[i];
+                                    if (record.targets.isEmpty() || record.skill->objectName() != skillName_copy) // check skill
+                                        continue;
+                                    int n = record.targets.indexOf(triggered_target);
+                                    if (n == -1) {
+                                        // here may cause a bug, if the first triggerlist contains "triggered_target"
+                                        // but this triggerlist doesn't contain "triggered_target". @todo_Slob
+                                        continue;
+                                    } else if (n == record.targets.length() - 1) {
+                                        records.removeAt(i); // triggered_target is the last one.
+                                    } else {
+                                        // remove the targets before triggered_target
+                                        record.targets = record.targets.mid(n + 1);
+                                        record.position = skill_position; //it has triggered already and wont check which general to invoke again. by weidouncle
                                     }
                                 }
                             } else { // "sgs1'songwei" or "yiji"
-                                if (trigger_who[p].contains(s))
-                                    trigger_who[p].removeOne(s);
+                                QList<TriggerRecord> &records = trigger_who[p];
+                                for (int i = 0; i < records.length(); ++i) {
+                                    if (records.at(i).toString() == s) {
+                                        records.removeAt(i);
+                                        break;
+                                    }
+                                }
                             }
                         }
 
                         if (has_compulsory) {
                             has_compulsory = false;
-                            foreach (const QString &skillName, trigger_who[p]) {
-                                const TriggerSkill *s = Sanguosha->getTriggerSkill(skillName); // "yiji"
-                                if (!s)
-                                    s = Sanguosha->getTriggerSkill(skillName.split("'").last()); // "sgs1'songwei"
-                                if (!s)
-                                    s = Sanguosha->getTriggerSkill(skillName.split("->").first()); // "tieqi->sgs4+sgs8+sgs1+sgs2"
-                                if (s && p->hasShownSkill(s)
+                            foreach (const TriggerRecord &record, trigger_who[p]) {
+                                const TriggerSkill *s = record.skill;
+                                if (p->hasShownSkill(s)
                                     && (s->getFrequency() == Skill::Compulsory
                                     //|| s->getFrequency() == Skill::NotCompulsory // for Paoxiao, Anjian, etc.
                                     || s->getFrequency() == Skill::Wake)) {
@@ -574,15 +567,8 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
                 // @todo_Slob: for drawing cards when game starts -- stupid design of triggering no player!
                 if (!broken) {
                     if (!trigger_who[NULL].isEmpty()) {
-                        foreach (QString skill_name, trigger_who[NULL]) {
-                            const TriggerSkill *skill = NULL;
-                            foreach (const TriggerSkill *rule, rules) { // because we cannot get a GameRule with Engine::getTriggerSkill()
-                                if (rule->objectName() == skill_name) {
-                                    skill = rule;
-                                    break;
-                                }
-                            }
-                            Q_ASSERT(skill != NULL);
+                        foreach (const TriggerRecord &record, trigger_who[NULL]) {
+                            const TriggerSkill *skill = record.skill; // we can't get a GameRule with Engine::getTriggerSkill() :(
                             if (skill->cost(triggerEvent, room, target, data, NULL)) {
                                 broken = skill->effect(triggerEvent, room, target, data, NULL);
                                 if (broken)
@@ -595,11 +581,13 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
 
             if (broken)
                 break;
-        } while (skills.length() != triggerable_tested.size());
+        } while (skill_table[triggerEvent].length() != triggerable_tested.size());
 
         if (target) {
-            foreach(AI *ai, room->ais)
-                ai->filterEvent(triggerEvent, target, data);
+            foreach(AI *ai, room->ais) {
+                if (ai->isEventSubscribed(triggerEvent))
+                    ai->filterEvent(triggerEvent, target, data);
+            }
         }
 
         // pop event stack
@@ -607,8 +595,10 @@ bool RoomThread::trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *ta
     }
     catch (TriggerEvent throwed_event) {
         if (target) {
-            foreach(AI *ai, room->ais)
-                ai->filterEvent(triggerEvent, target, data);
+            foreach(AI *ai, room->ais) {
+                if (ai->isEventSubscribed(triggerEvent))
+                    ai->filterEvent(triggerEvent, target, data);
+            }
         }
 
         // pop event stack
@@ -641,9 +631,8 @@ void RoomThread::addTriggerSkill(const TriggerSkill *skill)
 
     QList<TriggerEvent> events = skill->getTriggerEvents();
     foreach (const TriggerEvent &triggerEvent, events) {
-        QList<const TriggerSkill *> &table = skill_table[triggerEvent];
-        table << skill;
-        qStableSort(table.begin(), table.end(), [triggerEvent](const TriggerSkill *a, const TriggerSkill *b) {return a->getDynamicPriority(triggerEvent) > b->getDynamicPriority(triggerEvent); });
+        skill_table[triggerEvent] << skill;
+        insertIntoBuckets(trigger_table[triggerEvent], skill, skill->getDynamicPriority(triggerEvent));
     }
 
     if (skill->isVisible()) {
@@ -655,11 +644,59 @@ void RoomThread::addTriggerSkill(const TriggerSkill *skill)
     }
 }
 
+bool RoomThread::collectTriggerRecords(TriggerRecordMap &trigger_who, const TriggerRecordMap &records, const QList<ServerPlayer *> &players)
+{
+    bool collected = false;
+    foreach (ServerPlayer *p, players) {
+        if (!records.contains(p)) continue;
+        foreach (const TriggerRecord &record, records.value(p)) {
+            if (record.isValid()) {
+                trigger_who[p] << record;
+                collected = true;
+            }
+        }
+    }
+    return collected;
+}
+
+void RoomThread::insertIntoBuckets(QList<TriggerBucket> &buckets, const TriggerSkill *skill, double priority)
+{
+    int i = 0;
+    while (i < buckets.length() && buckets.at(i).priority > priority)
+        ++i;
+
+    if (i < buckets.length() && buckets.at(i).priority == priority) {
+        buckets[i].skills << skill;
+    } else {
+        TriggerBucket bucket;
+        bucket.priority = priority;
+        bucket.skills << skill;
+        buckets.insert(i, bucket);
+    }
+}
+
+void RoomThread::rebuildTriggerTables()
+{
+    priority_generation = TriggerSkill::getPriorityGeneration();
+    for (int i = 0; i < NumOfEvents; ++i) {
+        TriggerEvent triggerEvent = static_cast<TriggerEvent>(i);
+        trigger_table[i].clear();
+        foreach (const TriggerSkill *skill, skill_table[i])
+            insertIntoBuckets(trigger_table[i], skill, skill->getDynamicPriority(triggerEvent));
+    }
+}
+
+void RoomThread::recordPhase(Player::Phase phase, qint64 nsecs)
+{
+    profile.phaseCount[phase]++;
+    profile.phaseNsecs[phase] += nsecs;
+}
+
 void RoomThread::delay(long secs)
 {
     if (secs == -1) secs = Config.AIDelay;
     Q_ASSERT(secs >= 0);
     if (room->property("to_test").toString().isEmpty() && Config.AIDelay > 0)
-        msleep(secs);
+        RoomScheduler::sleep(secs);
 }
 
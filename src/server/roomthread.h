@@ -23,7 +23,7 @@
 
 #include "structs.h"
 
-#include <QThread>
+#include <QObject>
 #include <QSemaphore>
 #include <QVariant>
 
@@ -44,7 +44,24 @@ private:
     ServerPlayer *_m_target;
 };
 
-class RoomThread : public QThread
+struct TriggerBucket
+{
+    double priority;
+    QList<const TriggerSkill *> skills;
+};
+
+// counters collected by a RoomThread when its room has the "profile" property set
+struct RoomProfile
+{
+    RoomProfile();
+    void merge(const RoomProfile &other);
+
+    int turns;
+    int phaseCount[Player::PhaseNone + 1];
+    qint64 phaseNsecs[Player::PhaseNone + 1];
+};
+
+class RoomThread : public QObject
 {
     Q_OBJECT
 
@@ -55,27 +72,51 @@ public:
     bool trigger(TriggerEvent triggerEvent, Room *room, ServerPlayer *target);
 
     void addPlayerSkills(ServerPlayer *player, bool invoke_game_start = false);
+    // called whenever a player gets a skill, so that the skill and its related skills can be triggered in this room
+    void addPlayerSkill(const QString &skill_name);
 
     void addTriggerSkill(const TriggerSkill *skill);
     void delay(long msecs = -1);
     void actionNormal(GameRule *game_rule);
+    // runs the whole game loop on the calling thread, which is the room's own thread in Room::run()
+    void runGame();
 
     const QList<EventTriplet> *getEventStack() const;
 
-protected:
-    virtual void run();
+    inline bool isProfiling() const
+    {
+        return profiling;
+    }
+    inline const RoomProfile &getProfile() const
+    {
+        return profile;
+    }
+    void recordPhase(Player::Phase phase, qint64 nsecs);
 
 private:
     void _handleTurnBrokenNormal(GameRule *game_rule);
 
+    static bool collectTriggerRecords(TriggerRecordMap &trigger_who, const TriggerRecordMap &records, const QList<ServerPlayer *> &players);
+    static void insertIntoBuckets(QList<TriggerBucket> &buckets, const TriggerSkill *skill, double priority);
+    void rebuildTriggerTables();
+
     Room *room;
     QString order;
 
+    // all trigger skills of an event in the order they are added
     QList<const TriggerSkill *> skill_table[NumOfEvents];
+    // the same skills grouped by their priority, from the highest to the lowest
+    QList<TriggerBucket> trigger_table[NumOfEvents];
+    int priority_generation;
     QSet<QString> skillSet;
+    // skills which come with a general are only added once somebody in the room has them, see constructTriggerTable()
+    bool trigger_table_constructed;
 
     QList<EventTriplet> event_stack;
     GameRule *game_rule;
+
+    bool profiling;
+    RoomProfile profile;
 };
 
 #endif
@@ -27,6 +27,7 @@
 #include "engine.h"
 #include "scenario.h"
 #include "socket.h"
+#include "luastatepool.h"
 
 #include <QApplication>
 
@@ -35,6 +36,9 @@ using namespace QSanProtocol;
 Server::Server(QObject *parent)
     : QObject(parent)
 {
+    // packets parsed in the I/O threads are queued to the rooms
+    qRegisterMetaType<QSanProtocol::Packet>("QSanProtocol::Packet");
+
     server = new NativeServerSocket;
     server->setParent(this);
 
@@ -43,6 +47,11 @@ Server::Server(QObject *parent)
 
     current = NULL;
 
+    initPacketSymbols();
+
+    // have the Lua states of the first rooms ready before anyone signs up
+    LuaStatePool::getInstance()->warmUp();
+
     connect(server, &NativeServerSocket::new_connection, this, &Server::processNewConnection);
     connect(qApp, &QApplication::aboutToQuit, this, &Server::deleteLater);
 }
@@ -78,6 +87,7 @@ Room *Server::createNewRoom()
 
     connect(current, &Room::room_message, this, &Server::server_message);
     connect(current, &Room::game_over, this, &Server::gameOver);
+    connect(current, &Room::run_finished, this, &Server::roomFinished);
 
     return current;
 }
@@ -102,13 +112,14 @@ void Server::processNewConnection(ClientSocket *socket)
     }
 
     connect(socket, &ClientSocket::disconnected, this, &Server::cleanup);
+    connect(socket, &ClientSocket::error_message, this, &Server::server_message);
+    // the socket may live in an I/O thread, so listen before the client can possibly answer
+    connect(socket, &ClientSocket::message_got, this, &Server::processRequest);
 
     notifyClient(socket, S_COMMAND_CHECK_VERSION, Sanguosha->getVersion());
     notifyClient(socket, S_COMMAND_SETUP, Sanguosha->getSetupString());
 
     emit server_message(tr("%1 connected").arg(socket->peerName()));
-
-    connect(socket, &ClientSocket::message_got, this, &Server::processRequest);
 }
 
 void Server::processRequest(const QByteArray &request)
@@ -130,6 +141,18 @@ void Server::processRequest(const QByteArray &request)
     }
 }
 
+void Server::initPacketSymbols()
+{
+    foreach (const QString &kingdom, Sanguosha->getKingdoms())
+        packetSymbols.addSymbol(kingdom);
+    foreach (const QString &general, Sanguosha->getGeneralNames())
+        packetSymbols.addSymbol(general);
+    foreach (const QString &skill, Sanguosha->getSkillNames())
+        packetSymbols.addSymbol(skill);
+    for (int i = 0; i < Sanguosha->getCardCount(); ++i)
+        packetSymbols.addSymbol(Sanguosha->getEngineCard(i)->objectName());
+}
+
 void Server::notifyClient(ClientSocket *socket, CommandType command, const QVariant &arg)
 {
     Packet packet(S_SRC_ROOM | S_TYPE_NOTIFICATION | S_DEST_CLIENT, command);
@@ -153,10 +176,33 @@ void Server::processClientRequest(ClientSocket *socket, const Packet &signup)
     QString screen_name = body[1].toString();
     QString avatar = body[2].toString();
 
+    // newer clients append whether they understand length-prefixed frames, older ones simply don't.
+    // The client switches as soon as the first frame arrives, and frames take messages of any size
+    const bool framed = body.length() > 4 && body[4].toBool() && Config.value("FramedTransport", true).toBool();
+    if (framed)
+        socket->setFramed(true);
+
+    // likewise for the binary encoding
+    const PacketSymbolTable *symbols = NULL;
+    if (body.length() > 3 && body[3].toBool() && Config.value("BinaryProtocol", true).toBool()) {
+        Packet packet(S_SRC_ROOM | S_TYPE_NOTIFICATION | S_DEST_CLIENT, S_COMMAND_SETUP_SYMBOLS);
+        packet.setMessageBody(packetSymbols.toVariant());
+        const QByteArray message = packet.toJson();
+        // stay with JSON if the table does not fit into a line of an unframed connection
+        if (!message.isEmpty() && (framed || message.length() <= ClientSocket::S_MAX_LINE_SIZE)) {
+            socket->send(message);
+            symbols = &packetSymbols;
+        } else {
+            emit server_message(tr("The symbol table of %1 bytes is too long for %2, staying with JSON")
+                                .arg(message.length()).arg(screen_name));
+        }
+    }
+
     if (is_reconnection) {
         foreach (const QString &objname, name2objname.values(screen_name)) {
             ServerPlayer *player = players.value(objname);
             if (player && player->getState() == "offline" && !player->getRoom()->isFinished()) {
+                player->setPacketSymbols(symbols);
                 player->getRoom()->reconnect(player, socket);
                 return;
             }
@@ -167,6 +213,7 @@ void Server::processClientRequest(ClientSocket *socket, const Packet &signup)
         createNewRoom();
 
     ServerPlayer *player = current->addSocket(socket);
+    player->setPacketSymbols(symbols);
     current->signup(player, screen_name, avatar, false);
     emit newPlayer(player);
 
@@ -193,7 +240,17 @@ void Server::signupPlayer(ServerPlayer *player)
 void Server::gameOver()
 {
     Room *room = qobject_cast<Room *>(sender());
-    rooms.remove(room);
+    forgetPlayers(room);
+    // the last human has left a room which is already finished
+    if (finishedRooms.contains(room))
+        releaseRoom(room);
+}
+
+void Server::forgetPlayers(Room *room)
+{
+    // game_over is emitted a second time if the last human leaves before the end
+    if (!rooms.remove(room))
+        return;
 
     foreach(ServerPlayer *player, room->findChildren<ServerPlayer *>())
     {
@@ -201,3 +258,36 @@ void Server::gameOver()
         players.remove(player->objectName());
     }
 }
+
+void Server::roomFinished()
+{
+    // the thread of a room leaves when its game is over, only the disconnections of its clients touch the room afterwards
+    Room *room = qobject_cast<Room *>(sender());
+    if (room == NULL)
+        return;
+
+    forgetPlayers(room);
+    if (current == room)
+        current = NULL;
+
+    // connections stay open for the game-over screen, the room goes once the clients have left
+    finishedRooms << room;
+    releaseRoom(room);
+}
+
+void Server::releaseRoom(Room *room)
+{
+    foreach (ServerPlayer *player, room->getPlayers()) {
+        if (player->getState() == "online" || player->getState() == "trust")
+            return;
+    }
+    finishedRooms.remove(room);
+
+    RoomMemoryUsage usage = room->getMemoryUsage();
+    emit server_message(tr("Room %1 released: %2 players, %3 KB in Lua, %4 KB of records, up to %5 transient cards per turn (%6 held by all rooms)")
+                        .arg(room->getId()).arg(usage.players)
+                        .arg(usage.luaBytes / 1024).arg(usage.recordBytes / 1024)
+                        .arg(usage.transientCardPeak).arg(RoomState::getLiveTransientCardCount()));
+
+    room->deleteLater();
+}
@@ -54,10 +54,15 @@ private:
     void notifyClient(ClientSocket *socket, QSanProtocol::CommandType command, const QVariant &arg = QVariant());
 
     void processClientRequest(ClientSocket *socket, const QSanProtocol::Packet &signup);
+    void initPacketSymbols();
+    void forgetPlayers(Room *room);
+    void releaseRoom(Room *room);
 
     ServerSocket *server;
+    QSanProtocol::PacketSymbolTable packetSymbols;
     Room *current;
     QSet<Room *> rooms;
+    QSet<Room *> finishedRooms; // their threads are over, they are released once all clients have left
     QHash<QString, ServerPlayer *> players;
     QStringList addresses;
     QMultiHash<QString, QString> name2objname;
@@ -67,6 +72,7 @@ private slots:
     void processRequest(const QByteArray &request);
     void cleanup();
     void gameOver();
+    void roomFinished();
 
 signals:
     void server_message(const QString &);
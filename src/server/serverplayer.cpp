@@ -29,27 +29,61 @@
 #include "gamerule.h"
 #include "roomthread.h"
 
+#include <QElapsedTimer>
+#include <QThread>
+
 using namespace QSanProtocol;
 
-const int ServerPlayer::S_NUM_SEMAPHORES = 6;
+ClientRequest::ClientRequest()
+    : m_state(Released), m_expectedCommand(S_COMMAND_UNKNOWN), m_serial(0), m_timeOut(-1)
+{
+}
+
+void ClientRequest::open(CommandType expectedCommand, unsigned int serial, time_t timeOut)
+{
+    m_state = Pending;
+    m_expectedCommand = expectedCommand;
+    m_serial = serial;
+    m_reply = QVariant();
+    m_timeOut = timeOut;
+    m_timer.start();
+    m_waiting.store(1);
+}
+
+void ClientRequest::complete(const QVariant &reply)
+{
+    Q_ASSERT(isWaiting() && m_state == Pending);
+    m_reply = reply;
+    m_state = Replied;
+}
+
+void ClientRequest::release()
+{
+    if (isWaiting() && m_state == Pending)
+        m_state = Released;
+}
+
+void ClientRequest::close()
+{
+    m_waiting.store(0);
+}
+
+qint64 ClientRequest::remainingTime() const
+{
+    if (m_timeOut < 0)
+        return -1;
+    return qMax(qint64(0), qint64(m_timeOut) - m_timer.elapsed());
+}
 
 ServerPlayer::ServerPlayer(Room *room)
-    : Player(room), m_isClientResponseReady(false), m_isWaitingReply(false),
-    event_received(false), socket(NULL), room(room),
+    : Player(room), event_received(false), socket(NULL), packetSymbols(NULL), room(room),
     ai(NULL), trust_ai(new TrustAI(this)), recorder(NULL),
     _m_phases_index(0)
 {
-    semas = new QSemaphore *[S_NUM_SEMAPHORES];
-    for (int i = 0; i < S_NUM_SEMAPHORES; i++)
-        semas[i] = new QSemaphore(0);
 }
 
 ServerPlayer::~ServerPlayer()
 {
-    for (int i = 0; i < S_NUM_SEMAPHORES; i++)
-        delete semas[i];
-
-    delete[] semas;
     delete trust_ai;
 }
 
@@ -142,11 +176,12 @@ void ServerPlayer::throwAllHandCardsAndEquips()
 void ServerPlayer::throwAllMarks(bool visible_only)
 {
     // throw all marks
-    foreach (const QString &mark_name, marks.keys()) {
+    foreach (int mark, marks.keys()) {
+        QString mark_name = Sanguosha->getAtomName(mark);
         if (!mark_name.startsWith("@"))
             continue;
 
-        int n = marks.value(mark_name, 0);
+        int n = marks.value(mark);
         if (n != 0)
             room->setPlayerMark(this, mark_name, 0);
     }
@@ -165,6 +200,7 @@ void ServerPlayer::clearOnePrivatePile(const QString &pile_name)
     CardMoveReason reason(CardMoveReason::S_REASON_REMOVE_FROM_PILE, this->objectName());
     room->throwCard(&dummy, reason, NULL);
     piles.remove(pile_name);
+    touchDistanceDependency(pile_name);
 }
 
 void ServerPlayer::clearPrivatePiles()
@@ -192,7 +228,7 @@ void ServerPlayer::throwAllCards()
         card->addSubcard(equip);
     if (card->subcardsLength() != 0)
         room->throwCard(card, this);
-    card->deleteLater();
+    Sanguosha->autoReleaseCard(card);
 
     QList<const Card *> tricks = getJudgingArea();
     foreach (const Card *trick, tricks) {
@@ -277,7 +313,7 @@ int ServerPlayer::aliveCount(bool includeRemoved) const
 {
     int n = room->alivePlayerCount();
     if (!includeRemoved) {
-        foreach (ServerPlayer *p, room->getAllPlayers()) {
+        foreach (ServerPlayer *p, room->getPlayers()) {
             if (p->isRemoved())
                 n--;
         }
@@ -331,23 +367,32 @@ void ServerPlayer::setSocket(ClientSocket *socket)
 {
     if (socket) {
         connect(socket, &ClientSocket::disconnected, this, &ServerPlayer::disconnected);
-        connect(socket, &ClientSocket::message_got, this, &ServerPlayer::getMessage);
-        connect(this, &ServerPlayer::message_ready, this, &ServerPlayer::sendMessage);
+        // parse requests right in the thread of the socket, and let the socket pick up messages by itself
+        connect(socket, &ClientSocket::message_got, this, &ServerPlayer::getMessage, Qt::DirectConnection);
+        connect(this, &ServerPlayer::message_ready, socket, &ClientSocket::send);
     } else {
         if (this->socket) {
             this->disconnect(this->socket);
             this->socket->disconnect(this);
             //this->socket->disconnectFromHost();
-            this->socket->deleteLater();
+            // a message may still be in hand in the thread of the socket,
+            // the socket is deleted there once it is done so that no reply reaches a room being torn down
+            QThread *io_thread = this->socket->thread();
+            if (io_thread != QThread::currentThread() && io_thread->isRunning())
+                QMetaObject::invokeMethod(this->socket, "deleteLater", Qt::BlockingQueuedConnection);
+            else
+                this->socket->deleteLater();
         }
-
-
-        disconnect(this, &ServerPlayer::message_ready, this, &ServerPlayer::sendMessage);
     }
 
     this->socket = socket;
 }
 
+void ServerPlayer::setPacketSymbols(const PacketSymbolTable *symbols)
+{
+    packetSymbols = symbols;
+}
+
 void ServerPlayer::kick()
 {
     room->notifyProperty(this, this, "flags", "is_kicked");
@@ -367,7 +412,10 @@ void ServerPlayer::getMessage(QByteArray request)
     if (packet.parse(request)) {
         switch (packet.getPacketDestination()) {
         case S_DEST_ROOM:
-            emit roomPacketReceived(packet);
+            if (packet.getPacketType() == S_TYPE_REPLY)
+                emit roomReplyReceived(this, packet);
+            else
+                emit roomPacketReceived(packet);
             break;
             //unused destination. Lobby hasn't been implemented.
         case S_DEST_LOBBY:
@@ -412,6 +460,11 @@ void ServerPlayer::saveRecord(const QString &filename)
         recorder->save(filename);
 }
 
+int ServerPlayer::getRecordSize() const
+{
+    return recorder ? recorder->size() : 0;
+}
+
 void ServerPlayer::addToSelected(const QString &general)
 {
     selected.append(general);
@@ -441,26 +494,31 @@ void ServerPlayer::clearSelected()
     selected.clear();
 }
 
-void ServerPlayer::sendMessage(const QByteArray &message)
+void ServerPlayer::unicast(const AbstractPacket *packet)
 {
-    if (socket) {
-#ifndef QT_NO_DEBUG
-        printf("%s", qPrintable(objectName()));
-#endif
-        socket->send(message);
-    }
+    SerializedPacket serialized(packet);
+    unicast(serialized);
 }
 
-void ServerPlayer::unicast(const AbstractPacket *packet)
+void ServerPlayer::unicast(SerializedPacket &packet)
 {
-    unicast(packet->toJson());
+    if (packetSymbols == NULL) {
+        unicast(packet.toJson());
+        return;
+    }
+
+    emit message_ready(packet.toBinary(packetSymbols));
+
+    // replays are always kept as JSON lines
+    if (recorder)
+        recorder->recordLine(packet.toJson());
 }
 
 void ServerPlayer::notify(CommandType type, const QVariant &arg)
 {
     Packet packet(S_SRC_ROOM | S_TYPE_NOTIFICATION | S_DEST_CLIENT, type);
     packet.setMessageBody(arg);
-    unicast(packet.toJson());
+    unicast(&packet);
 }
 
 QString ServerPlayer::reportHeader() const
@@ -487,7 +545,7 @@ void ServerPlayer::removeCard(const Card *card, Place place)
         removeEquip(wrapped);
 
         bool show_log = true;
-        foreach(const QString &flag, flags)
+        foreach (const QString &flag, getFlagList())
             if (flag.endsWith("_InTempMoving")) {
                 show_log = false;
                 break;
@@ -510,8 +568,10 @@ void ServerPlayer::removeCard(const Card *card, Place place)
         QString pile_name = getPileName(card_id);
 
         //@todo: sanity check required
-        if (!pile_name.isEmpty())
+        if (!pile_name.isEmpty()) {
             piles[pile_name].removeOne(card_id);
+            touchDistanceDependency(pile_name);
+        }
 
         break;
     }
@@ -905,10 +965,18 @@ void ServerPlayer::play(QList<Player::Phase> set_phases)
             && phases[i] != NotActive)
             continue;
 
+        QElapsedTimer timer;
+        if (thread->isProfiling())
+            timer.start();
+
         if (!thread->trigger(EventPhaseStart, room, this)) {
             if (getPhase() != NotActive)
                 thread->trigger(EventPhaseProceeding, room, this);
         }
+
+        if (thread->isProfiling())
+            thread->recordPhase(phases[i], timer.nsecsElapsed());
+
         if (getPhase() != NotActive)
             thread->trigger(EventPhaseEnd, room, this);
         else
@@ -1016,6 +1084,8 @@ void ServerPlayer::loseAllMarks(const QString &mark_name)
 void ServerPlayer::addSkill(const QString &skill_name, bool head_skill)
 {
     Player::addSkill(skill_name, head_skill);
+    if (room->getThread())
+        room->getThread()->addPlayerSkill(skill_name);
     JsonArray args;
     args << (int)QSanProtocol::S_GAME_EVENT_ADD_SKILL;
     args << objectName();
@@ -1300,14 +1370,15 @@ void ServerPlayer::marshal(ServerPlayer *player) const
     }
 
     QStringList pmarks;
-    foreach (QString key, marks.keys()) {                           //for playerMark
-        if (!key.startsWith("@") && marks.value(key, 0) > 0) {
+    foreach (int atom, marks.keys()) {                              //for playerMark
+        QString key = Sanguosha->getAtomName(atom);
+        if (!key.startsWith("@") && marks.value(atom) > 0) {
             JsonArray arg;
             arg << objectName();
             arg << key;
-            arg << marks.value(key, 0);
+            arg << marks.value(atom);
             room->doNotify(player, S_COMMAND_SET_MARK, arg);
-        } else if (key.startsWith("@") && marks.value(key, 0) > 0)
+        } else if (key.startsWith("@") && marks.value(atom) > 0)
             pmarks << key;
     }
     foreach (const Skill *skill, getSkillList(false, false))
@@ -1349,11 +1420,12 @@ void ServerPlayer::marshal(ServerPlayer *player) const
         room->notifyProperty(player, this, "kingdom", "god");
     }
 
-    foreach(const QString &flag, flags)
+    foreach(const QString &flag, getFlagList())
         room->notifyProperty(player, this, "flags", flag);
 
-    foreach (const QString &item, history.keys()) {
-        int value = history.value(item);
+    foreach (int atom, history.keys()) {
+        QString item = Sanguosha->getAtomName(atom);
+        int value = history.value(atom);
         if (value > 0) {
 
             JsonArray arg;
@@ -1404,6 +1476,7 @@ void ServerPlayer::addToPile(const QString &pile_name, QList<int> card_ids,
     foreach(ServerPlayer *p, open_players)
         setPileOpen(pile_name, p->objectName());
     piles[pile_name].append(card_ids);
+    touchDistanceDependency(pile_name);
 
     CardsMoveStruct move;
     move.card_ids = card_ids;
@@ -1416,6 +1489,7 @@ void ServerPlayer::addToPile(const QString &pile_name, QList<int> card_ids,
 void ServerPlayer::pileAdd(const QString &pile_name, QList<int> card_ids)
 {
     piles[pile_name].append(card_ids);
+    touchDistanceDependency(pile_name);
 }
 
 void ServerPlayer::gainAnExtraTurn()
@@ -2208,13 +2282,8 @@ bool ServerPlayer::event(QEvent *event) {
     event_received = true; \
 }
     if (event->type() == QEvent::User) {
-        if (semas[SEMA_MUTEX]) {
-            semas[SEMA_MUTEX]->acquire();
-            SET_MY_PROPERTY;
-            semas[SEMA_MUTEX]->release();
-        }
-        else
-            SET_MY_PROPERTY;
+        QMutexLocker locker(&m_mutex);
+        SET_MY_PROPERTY;
     }
     return Player::event(event);
 }
@@ -35,8 +35,10 @@ struct PindianStruct;
 #include "protocol.h"
 #include "namespace.h"
 
-#include <QSemaphore>
+#include <QMutex>
+#include <QAtomicInt>
 #include <QDateTime>
+#include <QElapsedTimer>
 
 #ifndef QT_NO_DEBUG
 #include <QEvent>
@@ -50,6 +52,73 @@ public:
 };
 #endif
 
+// The request a room waits on a client for: the command and serial its reply
+// must carry, the deadline after which it is given up, and how it completed.
+// Only the room thread changes it. The socket threads and the main thread hand
+// it replies and wake-ups through Room::postClientReply() and
+// Room::_releaseReply(), so no reply takes a lock on the player.
+class ClientRequest
+{
+public:
+    enum State
+    {
+        Pending, // sent, no valid reply yet
+        Replied, // the expected reply has arrived
+        Released // ended without a reply: offline, trust, cheat or surrender
+    };
+
+    ClientRequest();
+
+    // timeOut is in milliseconds, -1 for no deadline
+    void open(QSanProtocol::CommandType expectedCommand, unsigned int serial, time_t timeOut);
+    // the room checks the command and serial of a reply before it completes the request
+    void complete(const QVariant &reply);
+    void release();
+    // the room is done with the request, later replies are stale; the reply is kept
+    void close();
+
+    // read by the main thread too, see Room::processRequestSurrender()
+    inline bool isWaiting() const
+    {
+        return m_waiting.load() != 0;
+    }
+    inline State getState() const
+    {
+        return m_state;
+    }
+    inline bool isDone() const
+    {
+        return m_state != Pending;
+    }
+    inline bool hasReply() const
+    {
+        return m_state == Replied;
+    }
+    inline QSanProtocol::CommandType getExpectedCommand() const
+    {
+        return m_expectedCommand;
+    }
+    inline unsigned int getSerial() const
+    {
+        return m_serial;
+    }
+    inline const QVariant &getReply() const
+    {
+        return m_reply;
+    }
+    // milliseconds left before the deadline, -1 if there is none
+    qint64 remainingTime() const;
+
+private:
+    QAtomicInt m_waiting;
+    State m_state;
+    QSanProtocol::CommandType m_expectedCommand;
+    unsigned int m_serial;
+    QVariant m_reply;
+    QElapsedTimer m_timer;
+    time_t m_timeOut;
+};
+
 class ServerPlayer : public Player
 {
     Q_OBJECT
@@ -60,7 +129,10 @@ public:
     ~ServerPlayer();
 
     void setSocket(ClientSocket *socket);
+    // packets are sent in the binary encoding once the client has received this table
+    void setPacketSymbols(const QSanProtocol::PacketSymbolTable *symbols);
     void unicast(const QSanProtocol::AbstractPacket *packet);
+    void unicast(QSanProtocol::SerializedPacket &packet);
     void notify(QSanProtocol::CommandType type, const QVariant &arg = QVariant());
     void kick();
     QString reportHeader() const;
@@ -136,6 +208,7 @@ public:
 
     void startRecord();
     void saveRecord(const QString &filename);
+    int getRecordSize() const;
 
     // 3v3 methods
     void addToSelected(const QString &general);
@@ -162,52 +235,25 @@ public:
     void startNetworkDelayTest();
     qint64 endNetworkDelayTest();
 
-    //Synchronization helpers
-    enum SemaphoreType
-    {
-        SEMA_MUTEX, // used to protect mutex access to member variables
-        SEMA_COMMAND_INTERACTIVE // used to wait for response from client
-    };
-    inline QSemaphore *getSemaphore(SemaphoreType type)
+    // guards the state the main thread changes while the room thread runs, such as preshown skills
+    inline QMutex *getMutex()
     {
-        return semas[type];
+        return &m_mutex;
     }
-    inline void acquireLock(SemaphoreType type)
+    // the request the room is waiting on this player for, see Room::doRequest()
+    inline ClientRequest &getRequest()
     {
-        semas[type]->acquire();
+        return m_request;
     }
-    inline bool tryAcquireLock(SemaphoreType type, int timeout = 0)
+    inline const ClientRequest &getRequest() const
     {
-        return semas[type]->tryAcquire(1, timeout);
-    }
-    inline void releaseLock(SemaphoreType type)
-    {
-        semas[type]->release();
-    }
-    inline void drainLock(SemaphoreType type)
-    {
-        while (semas[type]->tryAcquire()) {
-        }
-    }
-    inline void drainAllLocks()
-    {
-        for (int i = 0; i < S_NUM_SEMAPHORES; i++) {
-            drainLock((SemaphoreType)i);
-        }
+        return m_request;
     }
     inline const QVariant &getClientReply() const
     {
-        return _m_clientResponse;
-    }
-    inline void setClientReply(const QVariant &val)
-    {
-        _m_clientResponse = val;
+        return m_request.getReply();
     }
-    unsigned int m_expectedReplySerial; // Suggest the acceptable serial number of an expected response.
-    bool m_isClientResponseReady; //Suggest whether a valid player's reponse has been received.
-    bool m_isWaitingReply; // Suggest if the server player is waiting for client's response.
     QVariant m_cheatArgs; // Store the cheat code received from client.
-    QSanProtocol::CommandType m_expectedReplyCommand; // Store the command to be sent to the client.
     QVariant m_commandArgs; // Store the command args to be sent to the client.
 
     // static function
@@ -239,15 +285,15 @@ public:
     void setActualGeneral2Name(const QString &name);
 
 protected:
-    //Synchronization helpers
-    QSemaphore **semas;
-    static const int S_NUM_SEMAPHORES;
+    QMutex m_mutex;
+    ClientRequest m_request;
 #ifndef QT_NO_DEBUG
     bool event(QEvent *event);
 #endif
 
 private:
     ClientSocket *socket;
+    const QSanProtocol::PacketSymbolTable *packetSymbols;
     QList<const Card *> handcards;
     Room *room;
     AI *ai;
@@ -259,11 +305,9 @@ private:
     QList<PhaseStruct> _m_phases_state;
     QStringList selected; // 3v3 mode use only
     QDateTime test_time;
-    QVariant _m_clientResponse;
 
 private slots:
     void getMessage(QByteArray request);
-    void sendMessage(const QByteArray &message);
 
 signals:
     void disconnected();
@@ -271,6 +315,7 @@ signals:
     void message_ready(const QByteArray &msg);
 
     void roomPacketReceived(const QSanProtocol::Packet &packet);
+    void roomReplyReceived(ServerPlayer *player, const QSanProtocol::Packet &packet);
     void lobbyPacketReceived(const QSanProtocol::Packet &packet);
     void invalidPacketReceived(const QByteArray &message);
 };
@@ -0,0 +1,114 @@
+/********************************************************************
+    Copyright (c) 2013-2015 - Mogara
+
+    This file is part of QSanguosha-Hegemony.
+
+    This game is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 3.0
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    See the LICENSE file for more details.
+
+    Mogara
+    *********************************************************************/
+
+#include "simulator.h"
+#include "room.h"
+#include "settings.h"
+#include "engine.h"
+
+Simulator::Simulator(QObject *parent, int games, int jobs, const QString &mode)
+    : QObject(parent), mode(mode), games(qMax(games, 1)), jobs(jobs), launched(0), finished(0)
+{
+    if (this->mode.isEmpty())
+        this->mode = Config.GameMode;
+    if (this->jobs <= 0)
+        this->jobs = qMax(QThread::idealThreadCount(), 1);
+
+    // the simulator never asks a human, so there is nothing to wait for
+    Config.ForbidAddingRobot = false;
+    Config.AIDelay = Config.OriginAIDelay = 0;
+}
+
+void Simulator::start()
+{
+    printf("Simulating %d games of mode %s with %d jobs\n", games, mode.toLatin1().constData(), jobs);
+
+    timer.start();
+    for (int i = 0; i < jobs && launched < games; i++)
+        launchGame();
+}
+
+void Simulator::launchGame()
+{
+    Room *room = new Room(this, mode);
+    room->setProperty("to_test", "simulator");
+    room->setProperty("profile", true);
+    rooms << room;
+    launched++;
+
+    connect(room, &Room::game_over, this, &Simulator::gameOver);
+    connect(room, &Room::run_finished, this, &Simulator::roomFinished);
+
+    // the last robot to sign up starts the room
+    room->fillRobotsCommand(NULL, QVariant());
+}
+
+void Simulator::gameOver(const QString &winner)
+{
+    Room *room = qobject_cast<Room *>(sender());
+    if (room == NULL || !rooms.contains(room))
+        return;
+
+    winners.insert(room, winner);
+}
+
+void Simulator::roomFinished()
+{
+    // run() goes on for a while after the game is over, the profile is complete once it has returned
+    Room *room = qobject_cast<Room *>(sender());
+    if (room == NULL || !rooms.contains(room))
+        return;
+
+    rooms.remove(room);
+    finished++;
+    QString winner = winners.take(room);
+
+    RoomThread *thread = room->getThread();
+    if (thread != NULL)
+        profile.merge(thread->getProfile());
+    room->deleteLater();
+
+    printf("Game %d/%d is over, winner: %s\n", finished, games, winner.toLatin1().constData());
+
+    if (launched < games) {
+        launchGame();
+    } else if (rooms.isEmpty()) {
+        report();
+        emit simulation_finished();
+    }
+}
+
+void Simulator::report() const
+{
+    static const char *phaseNames[] = {
+        "RoundStart", "Start", "Judge", "Draw", "Play", "Discard", "Finish", "NotActive", "PhaseNone"
+    };
+
+    double secs = qMax(timer.nsecsElapsed(), Q_INT64_C(1)) / 1e9;
+    printf("%d games in %.3f s\n", finished, secs);
+    printf("games/s: %.3f\n", finished / secs);
+    printf("turns/s: %.3f (%d turns)\n", profile.turns / secs, profile.turns);
+
+    for (int i = 0; i <= Player::PhaseNone; i++) {
+        if (profile.phaseCount[i] == 0) continue;
+        printf("%-10s count: %8d  avg latency: %10.3f ms\n", phaseNames[i], profile.phaseCount[i],
+               profile.phaseNsecs[i] / 1e6 / profile.phaseCount[i]);
+    }
+}
@@ -0,0 +1,67 @@
+/********************************************************************
+    Copyright (c) 2013-2015 - Mogara
+
+    This file is part of QSanguosha-Hegemony.
+
+    This game is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public License as
+    published by the Free Software Foundation; either version 3.0
+    of the License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    General Public License for more details.
+
+    See the LICENSE file for more details.
+
+    Mogara
+    *********************************************************************/
+
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <QObject>
+#include <QHash>
+#include <QSet>
+#include <QElapsedTimer>
+
+#include "roomthread.h"
+
+class Room;
+
+// Runs AI-only games without any socket or GUI, several rooms at a time,
+// and reports the throughput of the engine when all of them are over.
+class Simulator : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Simulator(QObject *parent, int games, int jobs = 0, const QString &mode = QString());
+
+    void start();
+
+private:
+    void launchGame();
+    void report() const;
+
+    QString mode;
+    int games;
+    int jobs;
+    int launched;
+    int finished;
+
+    QSet<Room *> rooms;
+    QHash<Room *, QString> winners;
+    RoomProfile profile;
+    QElapsedTimer timer;
+
+private slots:
+    void gameOver(const QString &winner);
+    void roomFinished();
+
+signals:
+    void simulation_finished();
+};
+
+#endif // SIMULATOR_H
@@ -26,12 +26,54 @@
 #include <QRegExp>
 #include <QStringList>
 #include <QUdpSocket>
+#include <QTimer>
+#include <QThread>
+#include <QAtomicInteger>
+#include <QtEndian>
+
+static QAtomicInteger<quint64> TotalWritesSaved;
+
+// never the first byte of a text line, which is either JSON or a binary packet
+static const char S_FRAME_MARKER = '\x02';
+static const char S_FRAME_MORE = 0x1;
+static const int S_FRAME_HEADER_SIZE = 6;
+static const int S_FRAME_CHUNK_SIZE = 65536;
+static const int S_MAX_FRAMED_MESSAGE_SIZE = 16 * 1024 * 1024;
 
 NativeServerSocket::NativeServerSocket()
 {
     server = new QTcpServer(this);
     daemon = NULL;
     connect(server, &QTcpServer::newConnection, this, &NativeServerSocket::processNewConnection);
+
+    // reading, parsing and writing of the connections happen in these threads instead of the main one
+    int count = Config.value("IOThreads", qBound(1, QThread::idealThreadCount() / 2, 4)).toInt();
+    for (int i = 0; i < count; ++i) {
+        QThread *thread = new QThread(this);
+        thread->setObjectName(QString("IOThread%1").arg(i));
+        thread->start();
+        ioThreads << thread;
+        ioStats << new SocketIOStats;
+    }
+}
+
+NativeServerSocket::~NativeServerSocket()
+{
+    foreach (QThread *thread, ioThreads) {
+        thread->quit();
+        thread->wait();
+    }
+    qDeleteAll(ioStats);
+}
+
+int NativeServerSocket::getIOThreadCount() const
+{
+    return ioThreads.length();
+}
+
+const SocketIOStats *NativeServerSocket::getIOStats(int thread) const
+{
+    return ioStats.value(thread);
 }
 
 bool NativeServerSocket::listen()
@@ -64,6 +106,18 @@ void NativeServerSocket::processNewConnection()
 {
     QTcpSocket *socket = server->nextPendingConnection();
     NativeClientSocket *connection = new NativeClientSocket(socket);
+
+    if (!ioThreads.isEmpty()) {
+        // the least loaded I/O thread takes the new connection
+        int index = 0;
+        for (int i = 1; i < ioStats.length(); ++i) {
+            if (ioStats.at(i)->connections.load() < ioStats.at(index)->connections.load())
+                index = i;
+        }
+        connection->setIOStats(ioStats.at(index));
+        connection->moveToThread(ioThreads.at(index));
+    }
+
     emit new_connection(connection);
 }
 
@@ -82,8 +136,41 @@ NativeClientSocket::NativeClientSocket(QTcpSocket *socket)
     init();
 }
 
+NativeClientSocket::~NativeClientSocket()
+{
+    if (ioStats)
+        ioStats->connections.deref();
+}
+
+void NativeClientSocket::setIOStats(SocketIOStats *stats)
+{
+    if (ioStats)
+        ioStats->connections.deref();
+    ioStats = stats;
+    if (ioStats)
+        ioStats->connections.ref();
+}
+
 void NativeClientSocket::init()
 {
+    ioStats = NULL;
+    framed = false;
+    inboundFilled = 0;
+    frameEnd = -1;
+    frameHasMore = false;
+    queuedMessages = 0;
+    messagesSent = 0;
+    writesSaved = 0;
+
+    // messages sent during one pass of the event loop leave in one write
+    coalescing = Config.value("SocketWriteCoalescing", true).toBool();
+    flushThreshold = Config.value("SocketFlushThreshold", 16384).toInt();
+
+    flushTimer = new QTimer(this);
+    flushTimer->setSingleShot(true);
+    flushTimer->setInterval(0);
+    connect(flushTimer, &QTimer::timeout, this, &NativeClientSocket::flush);
+
     connect(socket, &QTcpSocket::disconnected, this, &NativeClientSocket::disconnected);
     connect(socket, &QTcpSocket::readyRead, this, &NativeClientSocket::getMessage);
     connect(socket, (void (QTcpSocket::*)(QAbstractSocket::SocketError))(&QTcpSocket::error), this, &NativeClientSocket::raiseError);
@@ -121,17 +208,79 @@ void NativeClientSocket::connectToHost(const QHostAddress &address, ushort port)
 
 void NativeClientSocket::getMessage()
 {
-    while (socket->canReadLine()) {
-        QByteArray msg = socket->readLine();
+    forever {
+        if (frameEnd < 0) {
+            // between messages: either a frame header or a text line follows
+            char marker;
+            if (socket->peek(&marker, 1) != 1)
+                return;
+
+            if (marker != S_FRAME_MARKER) {
+                if (!socket->canReadLine())
+                    return;
+                messageReceived(socket->readLine());
+                continue;
+            }
+
+            if (socket->bytesAvailable() < S_FRAME_HEADER_SIZE)
+                return;
+
+            uchar header[S_FRAME_HEADER_SIZE];
+            socket->read(reinterpret_cast<char *>(header), S_FRAME_HEADER_SIZE);
+            quint32 length = qFromBigEndian<quint32>(header + 2);
+            if (length > quint32(S_FRAME_CHUNK_SIZE) || inboundFilled + int(length) > S_MAX_FRAMED_MESSAGE_SIZE) {
+                socket->abort();
+                return;
+            }
+
+            // the peer understands frames, so answer in frames as well
+            framed = true;
+            frameHasMore = header[1] & S_FRAME_MORE;
+            frameEnd = inboundFilled + length;
+            inbound.resize(frameEnd);
+        }
+
+        // the payload is read straight into the buffer of the message, chunks are appended in place
+        if (inboundFilled < frameEnd) {
+            qint64 read = socket->read(inbound.data() + inboundFilled, frameEnd - inboundFilled);
+            if (read <= 0)
+                return;
+            inboundFilled += read;
+            if (inboundFilled < frameEnd)
+                return;
+        }
+
+        frameEnd = -1;
+        if (frameHasMore)
+            continue;
+
+        QByteArray msg = inbound;
+        inbound = QByteArray();
+        inboundFilled = 0;
+        messageReceived(msg);
+    }
+}
+
+void NativeClientSocket::messageReceived(const QByteArray &msg)
+{
 #ifndef QT_NO_DEBUG
-        printf("recv: %s", msg.constData());
+    printf("recv: %s\n", msg.constData());
 #endif
-        emit message_got(msg);
+    if (ioStats) {
+        ioStats->messagesIn.fetchAndAddRelaxed(1);
+        ioStats->bytesIn.fetchAndAddRelaxed(msg.length());
     }
+    emit message_got(msg);
 }
 
 void NativeClientSocket::disconnectFromHost()
 {
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "disconnectFromHost", Qt::QueuedConnection);
+        return;
+    }
+
+    flush();
     socket->disconnectFromHost();
 }
 
@@ -140,15 +289,89 @@ void NativeClientSocket::send(const QByteArray &message)
     if (message.isEmpty())
         return;
 
-    socket->write(message);
-    if (!message.endsWith('\n')) {
-        socket->write("\n");
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "send", Qt::QueuedConnection, Q_ARG(QByteArray, message));
+        return;
+    }
+
+    if (framed) {
+        appendFrames(message);
+    } else if (message.length() <= S_MAX_LINE_SIZE) {
+        outbound.append(message);
+        if (!message.endsWith('\n'))
+            outbound.append('\n');
+    } else {
+        // the peer would cut the line, so it is better not to send it at all
+        emit error_message(tr("A message of %1 bytes was not sent, it is longer than a line can be").arg(message.length()));
+        return;
     }
+    ++queuedMessages;
 
 #ifndef QT_NO_DEBUG
     printf(": %s\n", message.constData());
 #endif
+
+    if (!coalescing || outbound.length() >= flushThreshold)
+        flush();
+    else if (!flushTimer->isActive())
+        flushTimer->start();
+}
+
+void NativeClientSocket::setFramed(bool framed)
+{
+    if (QThread::currentThread() != thread()) {
+        QMetaObject::invokeMethod(this, "setFramed", Qt::QueuedConnection, Q_ARG(bool, framed));
+        return;
+    }
+
+    this->framed = framed;
+}
+
+void NativeClientSocket::appendFrames(const QByteArray &message)
+{
+    int length = message.length();
+    if (message.endsWith('\n'))
+        --length;
+
+    int pos = 0;
+    do {
+        int chunk = qMin(length - pos, S_FRAME_CHUNK_SIZE);
+        uchar header[S_FRAME_HEADER_SIZE];
+        header[0] = S_FRAME_MARKER;
+        header[1] = pos + chunk < length ? S_FRAME_MORE : 0;
+        qToBigEndian<quint32>(chunk, header + 2);
+        outbound.append(reinterpret_cast<const char *>(header), S_FRAME_HEADER_SIZE);
+        outbound.append(message.constData() + pos, chunk);
+        pos += chunk;
+    } while (pos < length);
+}
+
+void NativeClientSocket::flush()
+{
+    flushTimer->stop();
+    if (queuedMessages == 0)
+        return;
+
+    socket->write(outbound);
     socket->flush();
+
+    if (ioStats) {
+        ioStats->messagesOut.fetchAndAddRelaxed(queuedMessages);
+        ioStats->bytesOut.fetchAndAddRelaxed(outbound.length());
+        ioStats->writes.fetchAndAddRelaxed(1);
+    }
+
+    messagesSent += queuedMessages;
+    writesSaved += queuedMessages - 1;
+    TotalWritesSaved.fetchAndAddRelaxed(queuedMessages - 1);
+
+    outbound.clear();
+    queuedMessages = 0;
+}
+
+quint64 NativeClientSocket::getTotalWritesSaved()
+{
+    return TotalWritesSaved.load();
 }
 
 bool NativeClientSocket::isConnected() const
@@ -24,6 +24,8 @@
 #include "socket.h"
 
 class QUdpSocket;
+class QTimer;
+class QThread;
 
 class NativeServerSocket : public ServerSocket
 {
@@ -31,9 +33,12 @@ class NativeServerSocket : public ServerSocket
 
 public:
     NativeServerSocket();
+    ~NativeServerSocket();
 
     virtual bool listen();
     virtual void daemonize();
+    virtual int getIOThreadCount() const;
+    virtual const SocketIOStats *getIOStats(int thread) const;
 
 private slots:
     void processNewConnection();
@@ -42,6 +47,8 @@ private slots:
 private:
     QTcpServer *server;
     QUdpSocket *daemon;
+    QList<QThread *> ioThreads;
+    QList<SocketIOStats *> ioStats;
 };
 
 
@@ -52,17 +59,37 @@ class NativeClientSocket : public ClientSocket
 public:
     NativeClientSocket();
     NativeClientSocket(QTcpSocket *socket);
+    ~NativeClientSocket();
 
     virtual void connectToHost();
     virtual void connectToHost(const QHostAddress &address);
     virtual void connectToHost(const QHostAddress &address, ushort port);
-    virtual void disconnectFromHost();
-    virtual void send(const QByteArray &message);
+    // both may be called from any thread, the work is done in the thread the socket lives in
+    Q_INVOKABLE virtual void disconnectFromHost();
+    Q_INVOKABLE virtual void send(const QByteArray &message);
+    Q_INVOKABLE virtual void setFramed(bool framed);
     virtual bool isConnected() const;
     virtual QString peerName() const;
     virtual QString peerAddress() const;
     virtual ushort peerPort() const;
 
+    inline quint64 getMessagesSent() const
+    {
+        return messagesSent;
+    }
+    inline quint64 getWritesSaved() const
+    {
+        return writesSaved;
+    }
+    static quint64 getTotalWritesSaved();
+
+    // counts the traffic of this socket into the stats of the I/O thread it is moved to
+    void setIOStats(SocketIOStats *stats);
+
+public slots:
+    // writes everything queued by send() with a single write() call
+    void flush();
+
 private slots:
     void getMessage();
     void raiseError(QAbstractSocket::SocketError socket_error);
@@ -70,7 +97,26 @@ private slots:
 private:
     QTcpSocket *const socket;
 
+    QByteArray outbound;
+    int queuedMessages;
+    QTimer *flushTimer;
+    bool coalescing;
+    int flushThreshold;
+    quint64 messagesSent;
+    quint64 writesSaved;
+    SocketIOStats *ioStats;
+
+    // a frame is a marker byte, a flag byte and a big-endian 32-bit length, followed by the payload.
+    // Messages larger than one chunk are split into frames flagged S_FRAME_MORE.
+    bool framed;
+    QByteArray inbound;
+    int inboundFilled;
+    int frameEnd;
+    bool frameHasMore;
+
     void init();
+    void appendFrames(const QByteArray &message);
+    void messageReceived(const QByteArray &message);
 };
 
 #endif
@@ -38,6 +38,10 @@ public:
     static QImage TXT2PNG(const QByteArray &data);
     bool save(const QString &filename) const;
     QList<QByteArray> getRecords() const;
+    inline int size() const
+    {
+        return data.size();
+    }
 
 public slots:
     void recordLine(const QByteArray &line);
@@ -24,9 +24,22 @@
 #include <QObject>
 #include <QTcpSocket>
 #include <QTcpServer>
+#include <QAtomicInteger>
 
 class ClientSocket;
 
+// traffic of one network I/O thread. Only that thread writes the counters,
+// anyone may read them.
+struct SocketIOStats
+{
+    QAtomicInt connections;
+    QAtomicInteger<quint64> messagesIn;
+    QAtomicInteger<quint64> messagesOut;
+    QAtomicInteger<quint64> bytesIn;
+    QAtomicInteger<quint64> bytesOut;
+    QAtomicInteger<quint64> writes;
+};
+
 class ServerSocket : public QObject
 {
     Q_OBJECT
@@ -35,6 +48,10 @@ public:
     virtual bool listen() = 0;
     virtual void daemonize() = 0;
 
+    // connections are spread over this many threads, 0 means they stay in the caller's thread
+    virtual int getIOThreadCount() const = 0;
+    virtual const SocketIOStats *getIOStats(int thread) const = 0;
+
 signals:
     void new_connection(ClientSocket *connection);
 };
@@ -44,11 +61,16 @@ class ClientSocket : public QObject
     Q_OBJECT
 
 public:
+    // the longest newline-terminated message older peers can take, longer ones need frames
+    static const int S_MAX_LINE_SIZE = 65535;
+
     virtual void connectToHost() = 0;
     virtual void connectToHost(const QHostAddress &address) = 0;
     virtual void connectToHost(const QHostAddress &address, ushort port) = 0;
     virtual void disconnectFromHost() = 0;
     virtual void send(const QByteArray &message) = 0;
+    // switches outgoing messages from newline framing to length-prefixed frames
+    virtual void setFramed(bool framed) = 0;
     virtual bool isConnected() const = 0;
     virtual QString peerName() const = 0;
     virtual QString peerAddress() const = 0;
@@ -36,6 +36,9 @@ public:
     QList<ServerPlayer *> getEnemies() const;
     QList<ServerPlayer *> getFriends() const;
 
+    bool isEventSubscribed(TriggerEvent triggerEvent) const;
+    void setSubscribedEvents(const QList<int> &events);
+
     virtual void activate(CardUseStruct &card_use) = 0;
     virtual Card::Suit askForSuit(const QString&) = 0;
     virtual QString askForKingdom() = 0;
@@ -177,8 +180,11 @@ void LuaAI::activate(CardUseStruct &card_use)
 
 AI *Room::cloneAI(ServerPlayer *player)
 {
-    if (L == NULL)
-        return new TrustAI(player);
+    if (L == NULL) {
+        AI *ai = new TrustAI(player);
+        native_ais << ai;
+        return ai;
+    }
 
     lua_getglobal(L, "CloneAI");
 
@@ -199,7 +205,9 @@ AI *Room::cloneAI(ServerPlayer *player)
         }
     }
 
-    return new TrustAI(player);
+    AI *ai = new TrustAI(player);
+    native_ais << ai;
+    return ai;
 }
 
 ServerPlayer *LuaAI::askForYiji(const QList<int> &cards, const QString &reason, int &card_id)
@@ -97,6 +97,10 @@ public:
     DistanceSkill(const QString &name);
 
     virtual int getCorrect(const Player *from, const Player *to) const = 0;
+
+    QStringList getDependencies() const;
+    void setDependencies(const QString &names);
+    bool isCacheable() const;
 };
 
 class MaxCardsSkill: public Skill {
@@ -157,6 +161,7 @@ public:
     LuaViewHasSkill(const char *name);
     virtual bool ViewHas(const Player *player, const QString &skill_name, const QString &flag) const;
     void setGlobal(bool global);
+    void setViewHasSkills(const char *skills);
 
     LuaFunction is_viewhas;
 };
@@ -246,6 +251,10 @@ public:
 
     virtual int getExtra(const Player *target, bool include_weapon) const;
     virtual int getFixed(const Player *target, bool include_weapon) const;
+
+    QStringList getDependencies() const;
+    void setDependencies(const QString &names);
+    bool isCacheable() const;
 };
 
 class LuaAttackRangeSkill: public AttackRangeSkill{
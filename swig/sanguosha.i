@@ -179,6 +179,8 @@ public:
 
     int getAttackRange(bool include_weapon = true) const;
     bool inMyAttackRange(const Player *other) const;
+    QList<const Player *> getPlayersInAttackRange() const;
+    QList<const Player *> getPlayersWithinDistance(int distance) const;
 
     bool isAlive() const;
     bool isDead() const;
@@ -1191,6 +1193,8 @@ public:
     QStringList getBanPackages() const;
     Card *cloneCard(const Card *card) const;
     Card *cloneCard(const char *name, Card::Suit suit = Card::SuitToBeDecided, int number = -1) const;
+    QList<const Card *> cloneCards(QStringList names, Card::Suit suit = Card::SuitToBeDecided, int number = -1) const;
+    void autoReleaseCard(const Card *card) const;
     SkillCard *cloneSkillCard(const char *name) const;
     //QSanVersionNumber getVersionNumber() const;
     QString getVersion() const;
@@ -1370,7 +1374,7 @@ struct AskForMoveCardsStruct
     bool is_success;
 };
 
-class RoomThread: public QThread {
+class RoomThread: public QObject {
 public:
     explicit RoomThread(Room *room);
     void constructTriggerTable();
@@ -1378,6 +1382,7 @@ public:
     bool trigger(TriggerEvent event, Room *room, ServerPlayer *target);
 
     void addPlayerSkills(ServerPlayer *player, bool invoke_game_start = false);
+    void addPlayerSkill(const char *skill_name);
 
     void addTriggerSkill(const TriggerSkill *skill);
     void delay(unsigned long msecs = 1000);
@@ -1534,6 +1539,7 @@ public:
     QList<int> getCardIdsOnTable(const QList<int> &card_ids) const;
     ServerPlayer *getCardOwner(int card_id) const;
     void setCardMapping(int card_id, ServerPlayer *owner, Player::Place place);
+    QList<int> getCardIdsInPlace(Player::Place place, const ServerPlayer *owner = NULL) const;
 
     void drawCards(ServerPlayer *player, int n, const char *reason = NULL);
     void drawCards(QList<ServerPlayer *> players, int n, const char *reason = NULL);